@@ -0,0 +1,495 @@
+/*
+ * THIS SOFTWARE IS PROVIDED `AS IS' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+// A cache of conversions shared by the converters (prt2geo, geo2voxel),
+// so re-running a conversion only converts the frames whose inputs
+// changed.
+//
+// Conversions are keyed by the content of the input and by the options
+// that affect the output.  An input is identified in two steps: a fast
+// fingerprint hashes its size, its first 64KB (which holds any header)
+// and 16 blocks sampled through the rest.  Only when that matches an
+// earlier conversion is the whole input hashed to confirm it.  Then:
+//  - if the output is the one that earlier conversion wrote, and it
+//    hasn't been touched since, the conversion is skipped;
+//  - otherwise, if that earlier output is still intact, it is hard
+//    linked to the new output, as for a sim that holds still for
+//    several frames.
+//
+// The manifest is a text file that is only ever appended to, one line
+// per conversion, and the last line for an output wins.  Appends and
+// reads take an flock(), so any number of converters on one host may
+// use the same manifest at once.  flock() only excludes other hosts on
+// network file systems that forward it to the server (NFS may not), so
+// converters on several machines should use separate manifests.  Each
+// process only reads the part of the manifest added since it last
+// looked.  On Windows the manifest isn't locked.
+
+#pragma once
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+// The XXH64 hash, fed incrementally.
+class hash64
+{
+public:
+    hash64() : myTotal(0), myBuffered(0)
+    {
+	myLane[0] = thePrime1 + thePrime2;
+	myLane[1] = thePrime2;
+	myLane[2] = 0;
+	myLane[3] = 0 - thePrime1;
+    }
+
+    void update(const void *data, size_t size)
+    {
+	const unsigned char	*p = (const unsigned char *)data;
+
+	myTotal += size;
+	if (myBuffered + size < 32)
+	{
+	    memcpy(myBuffer + myBuffered, p, size);
+	    myBuffered += size;
+	    return;
+	}
+
+	if (myBuffered > 0)
+	{
+	    size_t	fill = 32 - myBuffered;
+	    memcpy(myBuffer + myBuffered, p, fill);
+	    stripe(myBuffer);
+	    p += fill;
+	    size -= fill;
+	    myBuffered = 0;
+	}
+
+	for (; size >= 32; p += 32, size -= 32)
+	    stripe(p);
+
+	memcpy(myBuffer, p, size);
+	myBuffered = size;
+    }
+
+    unsigned long long digest() const
+    {
+	unsigned long long	h;
+
+	if (myTotal >= 32)
+	{
+	    h = rotl(myLane[0], 1) + rotl(myLane[1], 7)
+	      + rotl(myLane[2], 12) + rotl(myLane[3], 18);
+	    for (int i = 0; i < 4; i++)
+		h = (h ^ round(0, myLane[i])) * thePrime1 + thePrime4;
+	}
+	else
+	    h = thePrime5;	// Plus the seed, which is 0.
+
+	h += myTotal;
+
+	const unsigned char	*p = myBuffer;
+	size_t			 left = myBuffered;
+	for (; left >= 8; p += 8, left -= 8)
+	    h = rotl(h ^ round(0, read64(p)), 27) * thePrime1 + thePrime4;
+	if (left >= 4)
+	{
+	    h = rotl(h ^ (read32(p) * thePrime1), 23) * thePrime2 + thePrime3;
+	    p += 4;
+	    left -= 4;
+	}
+	for (; left > 0; p++, left--)
+	    h = rotl(h ^ (*p * thePrime5), 11) * thePrime1;
+
+	h ^= h >> 33;
+	h *= thePrime2;
+	h ^= h >> 29;
+	h *= thePrime3;
+	h ^= h >> 32;
+	return h;
+    }
+
+private:
+    static const unsigned long long	thePrime1 = 11400714785074694791ULL;
+    static const unsigned long long	thePrime2 = 14029467366897019727ULL;
+    static const unsigned long long	thePrime3 = 1609587929392839161ULL;
+    static const unsigned long long	thePrime4 = 9650029242287828579ULL;
+    static const unsigned long long	thePrime5 = 2870177450012600261ULL;
+
+    static unsigned long long rotl(unsigned long long x, int r)
+    { return (x << r) | (x >> (64 - r)); }
+
+    // Assumes a little endian machine, like the PRT format does.
+    static unsigned long long read64(const unsigned char *p)
+    { unsigned long long v; memcpy(&v, p, 8); return v; }
+    static unsigned long long read32(const unsigned char *p)
+    { unsigned int v; memcpy(&v, p, 4); return v; }
+
+    static unsigned long long round(unsigned long long acc,
+				    unsigned long long input)
+    { return rotl(acc + input * thePrime2, 31) * thePrime1; }
+
+    void stripe(const unsigned char *p)
+    {
+	for (int i = 0; i < 4; i++)
+	    myLane[i] = round(myLane[i], read64(p + 8 * i));
+    }
+
+    unsigned long long	 myLane[4];
+    unsigned long long	 myTotal;
+    unsigned char	 myBuffer[32];
+    size_t		 myBuffered;
+};
+
+// What the cache knows about an input file.
+struct conversionFingerprint
+{
+    long long		 size;
+    unsigned long long	 sample;	// Hash of the size and sampled blocks.
+    unsigned long long	 full;		// Hash of the whole file.
+    bool		 hasFull;
+
+    conversionFingerprint() : size(-1), sample(0), full(0), hasFull(false) {}
+};
+
+class conversionCache
+{
+public:
+    enum lookupResult
+    {
+	CACHE_MISS,		// The input has to be converted.
+	CACHE_UNCHANGED,	// The output is already up to date.
+	CACHE_LINKED		// The output was linked to an identical one.
+    };
+
+    conversionCache() : myFile(NULL), myOffset(0) {}
+    ~conversionCache() { close(); }
+
+    // Opens the manifest, creating it if needed.
+    bool open(const std::string &manifest)
+    {
+	close();
+	myFile = fopen(manifest.c_str(), "a+b");
+	if (!myFile)
+	    return false;
+	myPath = manifest;
+	return true;
+    }
+
+    void close()
+    {
+	if (myFile)
+	    fclose(myFile);
+	myFile = NULL;
+	myOffset = 0;
+	myEntries.clear();
+	myBySample.clear();
+	myByOutput.clear();
+    }
+
+    bool isOpen() const { return myFile != NULL; }
+
+    // Checks whether 'output' needs converting from 'input' with the
+    // options summarized by 'key'.  On CACHE_LINKED, 'linkedFrom' gets
+    // the earlier output that 'output' now shares.  The fingerprint is
+    // filled in for record().
+    lookupResult lookup(const std::string &input, const std::string &output,
+			const std::string &key,
+			conversionFingerprint &print,
+			std::string *linkedFrom = NULL)
+    {
+	lookupResult	result = find(input, output, key, print, linkedFrom);
+
+	// An output that was linked to another must not be rewritten in
+	// place, or the other would change with it.
+	if (result == CACHE_MISS)
+	    unshare(output);
+	return result;
+    }
+
+    // Records that 'output' now holds the conversion of 'input'.
+    void record(const std::string &input, const std::string &output,
+		const std::string &key, conversionFingerprint &print)
+    {
+	struct stat	st;
+	if (!isOpen() || stat(output.c_str(), &st) != 0)
+	    return;
+	if (print.size < 0 && !samplePrint(input, print))
+	    return;
+	if (!fullPrint(input, print))
+	    return;
+
+	char	fields[256];
+	sprintf(fields, "%016llx %016llx %lld %016llx %lld %lld",
+		print.full, print.sample, print.size, hashString(key),
+		(long long)st.st_size, (long long)st.st_mtime);
+	std::string	line = std::string(fields) + "\t" + input + "\t" +
+			       output + "\n";
+
+	std::lock_guard<std::mutex>	lock(myMutex);
+	lockFile(true);
+	fseek(myFile, 0, SEEK_END);
+	fwrite(line.data(), 1, line.size(), myFile);
+	fflush(myFile);
+	unlockFile();
+    }
+
+private:
+    struct entry
+    {
+	unsigned long long	 full, sample, key;
+	long long		 size, outputSize, outputTime;
+	std::string		 input, output;
+    };
+
+    static const size_t	theHeadSize = 65536;
+    static const size_t	theSampleSize = 4096;
+    static const int	theSampleCount = 16;
+
+    lookupResult find(const std::string &input, const std::string &output,
+		      const std::string &key, conversionFingerprint &print,
+		      std::string *linkedFrom)
+    {
+	if (!isOpen() || !samplePrint(input, print))
+	    return CACHE_MISS;
+
+	unsigned long long	keyHash = hashString(key);
+	std::vector<entry>	candidates;
+	{
+	    std::lock_guard<std::mutex>	lock(myMutex);
+	    refresh();
+
+	    typedef std::multimap<unsigned long long, size_t>::const_iterator
+		    iterator;
+	    std::pair<iterator, iterator> range =
+		    myBySample.equal_range(print.sample);
+	    for (iterator it = range.first; it != range.second; ++it)
+	    {
+		const entry	&e = myEntries[it->second];
+		if (e.size == print.size && e.key == keyHash &&
+		    isCurrent(e))
+		    candidates.push_back(e);
+	    }
+	}
+	if (candidates.empty())
+	    return CACHE_MISS;
+
+	// Only now is the whole input read, to confirm the samples.
+	if (!fullPrint(input, print))
+	    return CACHE_MISS;
+
+	const entry	*source = NULL;
+	for (size_t i = 0; i < candidates.size(); i++)
+	{
+	    if (candidates[i].full != print.full)
+		continue;
+	    if (candidates[i].output == output)
+		return outputIntact(candidates[i]) ? CACHE_UNCHANGED
+						   : CACHE_MISS;
+	    if (!source && outputIntact(candidates[i]))
+		source = &candidates[i];
+	}
+
+	if (!source || !linkFile(source->output, output))
+	    return CACHE_MISS;
+
+	if (linkedFrom)
+	    *linkedFrom = source->output;
+	record(input, output, key, print);
+	return CACHE_LINKED;
+    }
+
+    static unsigned long long hashString(const std::string &s)
+    {
+	hash64	h;
+	h.update(s.data(), s.size());
+	return h.digest();
+    }
+
+    bool samplePrint(const std::string &input, conversionFingerprint &print)
+    {
+	FILE	*f = fopen(input.c_str(), "rb");
+	if (!f)
+	    return false;
+
+	fseek(f, 0, SEEK_END);
+	print.size = ftell(f);
+	print.hasFull = false;
+
+	hash64			 h;
+	std::vector<char>	 buf(theHeadSize);
+	h.update(&print.size, sizeof(print.size));
+
+	fseek(f, 0, SEEK_SET);
+	h.update(&buf[0], fread(&buf[0], 1, theHeadSize, f));
+
+	long long	rest = print.size - (long long)theHeadSize;
+	if (rest > 0)
+	{
+	    for (int i = 0; i < theSampleCount; i++)
+	    {
+		long long	offset = theHeadSize +
+			(rest - (long long)theSampleSize) * i /
+			(theSampleCount - 1);
+		if (offset < (long long)theHeadSize)
+		    offset = theHeadSize;
+		fseek(f, (long)offset, SEEK_SET);
+		h.update(&buf[0], fread(&buf[0], 1, theSampleSize, f));
+	    }
+	}
+	fclose(f);
+
+	print.sample = h.digest();
+	return true;
+    }
+
+    bool fullPrint(const std::string &input, conversionFingerprint &print)
+    {
+	if (print.hasFull)
+	    return true;
+
+	FILE	*f = fopen(input.c_str(), "rb");
+	if (!f)
+	    return false;
+
+	hash64			 h;
+	std::vector<char>	 buf(1 << 20);
+	long long		 total = 0;
+	for (size_t n; (n = fread(&buf[0], 1, buf.size(), f)) > 0; total += n)
+	    h.update(&buf[0], n);
+	fclose(f);
+
+	// The file changed since it was sampled.
+	if (total != print.size)
+	    return false;
+
+	print.full = h.digest();
+	print.hasFull = true;
+	return true;
+    }
+
+    // True if 'e' is the last line recorded for its output.
+    bool isCurrent(const entry &e) const
+    {
+	std::map<std::string, size_t>::const_iterator it =
+		myByOutput.find(e.output);
+	return it != myByOutput.end() && &myEntries[it->second] == &e;
+    }
+
+    // True if an output is still the file the cache recorded.
+    static bool outputIntact(const entry &e)
+    {
+	struct stat	st;
+	return stat(e.output.c_str(), &st) == 0 &&
+	       (long long)st.st_size == e.outputSize &&
+	       (long long)st.st_mtime == e.outputTime;
+    }
+
+    static void unshare(const std::string &path)
+    {
+	struct stat	st;
+	if (stat(path.c_str(), &st) == 0 && st.st_nlink > 1)
+	    remove(path.c_str());
+    }
+
+    static bool linkFile(const std::string &from, const std::string &to)
+    {
+	remove(to.c_str());
+#if defined(WIN32) || defined(_WIN64)
+	return CreateHardLinkA(to.c_str(), from.c_str(), NULL) != 0;
+#else
+	return link(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+
+    void lockFile(bool exclusive)
+    {
+#if !defined(WIN32) && !defined(_WIN64)
+	while (flock(fileno(myFile), exclusive ? LOCK_EX : LOCK_SH) != 0 &&
+	       errno == EINTR)
+	    ;
+#endif
+    }
+
+    void unlockFile()
+    {
+#if !defined(WIN32) && !defined(_WIN64)
+	flock(fileno(myFile), LOCK_UN);
+#endif
+    }
+
+    // Reads the lines appended to the manifest since the last refresh.
+    void refresh()
+    {
+	std::string	text;
+	lockFile(false);
+	fseek(myFile, myOffset, SEEK_SET);
+	char	buf[65536];
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), myFile)) > 0; )
+	    text.append(buf, n);
+	unlockFile();
+
+	size_t	start = 0;
+	for (size_t end; (end = text.find('\n', start)) != std::string::npos;
+	     start = end + 1)
+	{
+	    parseLine(text.substr(start, end - start));
+	}
+	myOffset += (long)start;
+    }
+
+    void parseLine(const std::string &line)
+    {
+	size_t	tab1 = line.find('\t');
+	size_t	tab2 = (tab1 == std::string::npos) ? tab1
+						   : line.find('\t', tab1 + 1);
+	if (tab2 == std::string::npos)
+	    return;
+
+	entry	e;
+	if (sscanf(line.c_str(), "%llx %llx %lld %llx %lld %lld",
+		   &e.full, &e.sample, &e.size, &e.key,
+		   &e.outputSize, &e.outputTime) != 6)
+	    return;
+	e.input = line.substr(tab1 + 1, tab2 - tab1 - 1);
+	e.output = line.substr(tab2 + 1);
+
+	myByOutput[e.output] = myEntries.size();
+	myBySample.insert(std::make_pair(e.sample, myEntries.size()));
+	myEntries.push_back(e);
+    }
+
+    std::string					 myPath;
+    FILE					*myFile;
+    long					 myOffset;
+    std::vector<entry>				 myEntries;
+    std::multimap<unsigned long long, size_t>	 myBySample;
+    std::map<std::string, size_t>		 myByOutput;
+    std::mutex					 myMutex;
+};
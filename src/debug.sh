@@ -1,3 +1,22 @@
 #!/bin/bash
 
 hcustom -g -s -lz -lHalf -I$HT/include/zlib -I$HT/include/OpenEXR -I../thirdparty/PRT-IO-Library prt2geo.C
+
+# The .prt geometry translator, installed as a DSO in $HOME/houdiniX.Y/dso.
+hcustom -g -lz -lHalf -I$HT/include/zlib -I$HT/include/OpenEXR -I../thirdparty/PRT-IO-Library GEO_PRTIO.C
+
+# Tools that only need the PRT library, not the HDK.
+PRTFLAGS="-I$HT/include/zlib -I$HT/include/OpenEXR -I../thirdparty/PRT-IO-Library -L$HFS/dsolib"
+g++ -g $PRTFLAGS prtprogressive.C -o prtprogressive -lHalf -lz
+g++ -g $PRTFLAGS prtmerge.C -o prtmerge -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtsplit.C -o prtsplit -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtinterp.C -o prtinterp -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtinfo.C -o prtinfo -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtbench.C -o prtbench -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtfind.C -o prtfind -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtneighbors.C -o prtneighbors -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtnearest.C -o prtnearest -lHalf -lz -lpthread
+g++ -g $PRTFLAGS voxelbench.C -o voxelbench -lpthread
+g++ -g $PRTFLAGS voxelseq.C -o voxelseq -lz -lpthread
+g++ -g $PRTFLAGS voxel2prt.C -o voxel2prt -lHalf -lz -lpthread
+g++ -g $PRTFLAGS prtroundtrip.C -o prtroundtrip -lHalf -lz -lpthread
@@ -0,0 +1,283 @@
+/*
+ * THIS SOFTWARE IS PROVIDED `AS IS' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+// The point containers of prt_points.h for Houdini geometry.  Loading
+// adds the points to a particle primitive, so they render as particles.
+
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "prt_points.h"
+
+#include <GA/GA_AIFTuple.h>
+#include <GA/GA_Attribute.h>
+#include <GA/GA_AttributeRef.h>
+#include <GEO/GEO_Detail.h>
+#include <GU/GU_Detail.h>
+#include <GU/GU_PrimPart.h>
+
+// Loads particles into a GU_Detail.  The point indices are offsets.
+class gdpPoints
+{
+public:
+    gdpPoints(GU_Detail *gdp)
+	: myGdp(gdp)
+    {
+	myParticles = GU_PrimParticle::build(gdp, 0);
+	if (!myParticles)
+	    throw std::runtime_error("Unable to create a particle primitive.");
+    }
+
+    int
+    addAttribute(const std::string &name, prtio::data_types::enum_t type,
+		 int arity, prtAttribKind kind)
+    {
+	GA_Storage		storage = attributeStorage(type);
+	GA_RWAttributeRef	ref = prtio::detail::is_float(type)
+	    ? myGdp->addFloatTuple(GA_ATTRIB_POINT, name.c_str(), arity,
+				   GA_Defaults(0), 0, 0, storage)
+	    : myGdp->addIntTuple(GA_ATTRIB_POINT, name.c_str(), arity,
+				 GA_Defaults(0), 0, 0, storage);
+	if (!ref.isValid())
+	    throw std::runtime_error("Unable to create the attribute \"" + name + "\".");
+	if (kind != PRT_KIND_VALUE)
+	    ref.setTypeInfo(typeInfo(kind));
+
+	attribute	a;
+	a.attrib = ref.getAttribute();
+	a.tuple = a.attrib->getAIFTuple();
+	a.arity = arity;
+	myAttributes.push_back(a);
+	return (int)myAttributes.size() - 1;
+    }
+
+    prtInt64
+    appendPoints(prtInt64 count)
+    {
+	return myGdp->appendPointBlock(count);
+    }
+
+    void
+    setPositions(prtInt64 first, const float *P, std::size_t count)
+    {
+	for (std::size_t i = 0; i < count; i++, P += 3)
+	{
+	    myGdp->setPos3(first + i, UT_Vector3(P[0], P[1], P[2]));
+	    myParticles->appendParticle(first + i);
+	}
+    }
+
+    // T is one of the types the tuple interface takes, which converts
+    // to the attribute's storage.
+    template <typename T>
+    void
+    setValues(int attrib, prtInt64 first, const T *values,
+	      std::size_t count)
+    {
+	setTuples(myAttributes[attrib], first, values, count);
+    }
+
+    void
+    setValues(int attrib, prtInt64 first, const prtInt64 *values,
+	      std::size_t count)
+    {
+	myInt64s.assign(values, values + count * myAttributes[attrib].arity);
+	setTuples(myAttributes[attrib], first, &myInt64s[0], count);
+    }
+
+    // The attribute storage that holds a channel's values without losing
+    // precision.  Houdini has no unsigned storage wider than 8 bits, so
+    // those go to the next wider signed type.
+    static GA_Storage
+    attributeStorage(prtio::data_types::enum_t type)
+    {
+	switch (type)
+	{
+	case prtio::data_types::type_float16:	return GA_STORE_REAL16;
+	case prtio::data_types::type_float32:	return GA_STORE_REAL32;
+	case prtio::data_types::type_float64:	return GA_STORE_REAL64;
+	case prtio::data_types::type_int8:	return GA_STORE_INT8;
+	case prtio::data_types::type_uint8:	return GA_STORE_UINT8;
+	case prtio::data_types::type_int16:	return GA_STORE_INT16;
+	case prtio::data_types::type_int32:
+	case prtio::data_types::type_uint16:	return GA_STORE_INT32;
+	default:				return GA_STORE_INT64;
+	}
+    }
+
+    static GA_TypeInfo
+    typeInfo(prtAttribKind kind)
+    {
+	switch (kind)
+	{
+	case PRT_KIND_VECTOR:		return GA_TYPE_VECTOR;
+	case PRT_KIND_NORMAL:		return GA_TYPE_NORMAL;
+	case PRT_KIND_COLOR:		return GA_TYPE_COLOR;
+	case PRT_KIND_QUATERNION:	return GA_TYPE_QUATERNION;
+	default:			return GA_TYPE_VOID;
+	}
+    }
+
+private:
+    struct attribute
+    {
+	GA_Attribute		*attrib;
+	const GA_AIFTuple	*tuple;
+	int			 arity;
+    };
+
+    template <typename T>
+    static void
+    setTuples(const attribute &a, GA_Offset first, const T *values,
+	      std::size_t count)
+    {
+	for (std::size_t i = 0; i < count; i++, values += a.arity)
+	    a.tuple->set(a.attrib, first + i, values, a.arity);
+    }
+
+    GU_Detail			*myGdp;
+    GU_PrimParticle		*myParticles;
+    std::vector<attribute>	 myAttributes;
+    std::vector<int64>		 myInt64s;
+};
+
+// Saves the points of a GEO_Detail.  The point indices are GA_Index,
+// so the particles are written in point number order.
+class gdpConstPoints
+{
+public:
+    gdpConstPoints(const GEO_Detail *gdp)
+	: myGdp(gdp)
+    {
+	for (GA_AttributeDict::iterator it =
+		gdp->pointAttribs().begin(GA_SCOPE_PUBLIC);
+	     !it.atEnd(); ++it)
+	{
+	    const GA_Attribute	*attrib = it.attrib();
+	    const GA_AIFTuple	*tuple = attrib->getAIFTuple();
+	    std::string		 name = attrib->getName();
+	    if (!tuple || name == "P" || name == "Pw")
+		continue;
+
+	    attribute	a;
+	    a.attrib = attrib;
+	    a.tuple = tuple;
+	    a.name = name;
+	    a.arity = tuple->getTupleSize(attrib);
+	    if (channelType(tuple->getStorage(attrib), a.type) && a.arity > 0)
+		myAttributes.push_back(a);
+	}
+    }
+
+    prtInt64
+    numPoints() const
+    {
+	return myGdp->getNumPoints();
+    }
+
+    int
+    numAttributes() const
+    {
+	return (int)myAttributes.size();
+    }
+
+    bool
+    getAttribute(int attrib, std::string &name,
+		 prtio::data_types::enum_t &type, int &arity) const
+    {
+	const attribute	&a = myAttributes[attrib];
+	name = a.name;
+	type = a.type;
+	arity = a.arity;
+	return true;
+    }
+
+    void
+    getPositions(prtInt64 first, float *P, std::size_t count) const
+    {
+	for (std::size_t i = 0; i < count; i++, P += 3)
+	{
+	    UT_Vector3	pos = myGdp->getPos3(myGdp->pointOffset(first + i));
+	    P[0] = pos(0);
+	    P[1] = pos(1);
+	    P[2] = pos(2);
+	}
+    }
+
+    template <typename T>
+    void
+    getValues(int attrib, prtInt64 first, T *values, std::size_t count) const
+    {
+	getTuples(myAttributes[attrib], first, values, count);
+    }
+
+    void
+    getValues(int attrib, prtInt64 first, prtInt64 *values,
+	      std::size_t count) const
+    {
+	myInt64s.resize(count * myAttributes[attrib].arity);
+	getTuples(myAttributes[attrib], first, &myInt64s[0], count);
+	std::copy(myInt64s.begin(), myInt64s.end(), values);
+    }
+
+    // The channel type for an attribute's storage, the reverse of
+    // gdpPoints::attributeStorage().  Returns false for storage that
+    // isn't numeric.
+    static bool
+    channelType(GA_Storage storage, prtio::data_types::enum_t &type)
+    {
+	switch (storage)
+	{
+	case GA_STORE_REAL16:	type = prtio::data_types::type_float16; break;
+	case GA_STORE_REAL32:	type = prtio::data_types::type_float32; break;
+	case GA_STORE_REAL64:	type = prtio::data_types::type_float64; break;
+	case GA_STORE_INT8:	type = prtio::data_types::type_int8; break;
+	case GA_STORE_UINT8:	type = prtio::data_types::type_uint8; break;
+	case GA_STORE_INT16:	type = prtio::data_types::type_int16; break;
+	case GA_STORE_INT32:	type = prtio::data_types::type_int32; break;
+	case GA_STORE_INT64:	type = prtio::data_types::type_int64; break;
+	default:		return false;
+	}
+	return true;
+    }
+
+private:
+    struct attribute
+    {
+	const GA_Attribute		*attrib;
+	const GA_AIFTuple		*tuple;
+	std::string			 name;
+	prtio::data_types::enum_t	 type;
+	int				 arity;
+    };
+
+    template <typename T>
+    void
+    getTuples(const attribute &a, prtInt64 first, T *values,
+	      std::size_t count) const
+    {
+	for (std::size_t i = 0; i < count; i++, values += a.arity)
+	    a.tuple->get(a.attrib, myGdp->pointOffset(first + i),
+			 values, a.arity);
+    }
+
+    const GEO_Detail		*myGdp;
+    std::vector<attribute>	 myAttributes;
+    mutable std::vector<int64>	 myInt64s;
+};
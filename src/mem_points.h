@@ -0,0 +1,151 @@
+/*
+ * THIS SOFTWARE IS PROVIDED `AS IS' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+// A point container for prt_points.h that keeps the points in memory,
+// without the HDK.  It checks that the translation builds and runs
+// outside Houdini (see prtroundtrip.C), and can load particles for
+// tools that don't link against Houdini.
+
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "prt_points.h"
+
+class memPoints
+{
+public:
+    int
+    addAttribute(const std::string &name, prtio::data_types::enum_t type,
+		 int arity, prtAttribKind kind)
+    {
+	for (std::size_t i = 0; i < myAttributes.size(); i++)
+	    if (myAttributes[i].name == name)
+		throw std::runtime_error("The attribute \"" + name + "\" already exists.");
+
+	attribute	a;
+	a.name = name;
+	a.type = type;
+	a.arity = arity;
+	a.kind = kind;
+	resize(a, numPoints());
+	myAttributes.push_back(a);
+	return (int)myAttributes.size() - 1;
+    }
+
+    prtInt64
+    appendPoints(prtInt64 count)
+    {
+	prtInt64	first = numPoints();
+
+	myP.resize((first + count) * 3);
+	for (std::size_t i = 0; i < myAttributes.size(); i++)
+	    resize(myAttributes[i], first + count);
+	return first;
+    }
+
+    void
+    setPositions(prtInt64 first, const float *P, std::size_t count)
+    {
+	std::copy(P, P + count * 3, myP.begin() + first * 3);
+    }
+
+    // Floating point channels are kept as doubles and integer channels
+    // as 64 bit integers, which hold every channel type exactly.
+    template <typename T>
+    void
+    setValues(int attrib, prtInt64 first, const T *values,
+	      std::size_t count)
+    {
+	attribute	&a = myAttributes[attrib];
+	std::size_t	 n = count * a.arity;
+
+	if (prtio::detail::is_float(a.type))
+	    std::copy(values, values + n, a.floats.begin() + first * a.arity);
+	else
+	    std::copy(values, values + n, a.ints.begin() + first * a.arity);
+    }
+
+    prtInt64
+    numPoints() const
+    {
+	return (prtInt64)(myP.size() / 3);
+    }
+
+    int
+    numAttributes() const
+    {
+	return (int)myAttributes.size();
+    }
+
+    bool
+    getAttribute(int attrib, std::string &name,
+		 prtio::data_types::enum_t &type, int &arity) const
+    {
+	const attribute	&a = myAttributes[attrib];
+	name = a.name;
+	type = a.type;
+	arity = a.arity;
+	return true;
+    }
+
+    void
+    getPositions(prtInt64 first, float *P, std::size_t count) const
+    {
+	std::copy(myP.begin() + first * 3, myP.begin() + (first + count) * 3, P);
+    }
+
+    template <typename T>
+    void
+    getValues(int attrib, prtInt64 first, T *values,
+	      std::size_t count) const
+    {
+	const attribute	&a = myAttributes[attrib];
+	std::size_t	 n = count * a.arity;
+
+	if (prtio::detail::is_float(a.type))
+	    for (std::size_t i = 0; i < n; i++)
+		values[i] = (T)a.floats[first * a.arity + i];
+	else
+	    for (std::size_t i = 0; i < n; i++)
+		values[i] = (T)a.ints[first * a.arity + i];
+    }
+
+private:
+    struct attribute
+    {
+	std::string			 name;
+	prtio::data_types::enum_t	 type;
+	int				 arity;
+	prtAttribKind			 kind;
+	std::vector<double>		 floats;
+	std::vector<prtInt64>		 ints;
+    };
+
+    static void
+    resize(attribute &a, prtInt64 count)
+    {
+	if (prtio::detail::is_float(a.type))
+	    a.floats.resize(count * a.arity);
+	else
+	    a.ints.resize(count * a.arity);
+    }
+
+    std::vector<float>		 myP;
+    std::vector<attribute>	 myAttributes;
+};
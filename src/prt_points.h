@@ -0,0 +1,491 @@
+/*
+ * THIS SOFTWARE IS PROVIDED `AS IS' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+// The translation between PRT particles and point geometry, shared by
+// prt2geo and the .prt geometry translator (GEO_PRTIO.C).
+//
+// Nothing here uses the HDK.  The points are reached through a
+// container class given as a template parameter, so the translation
+// can be run without Houdini against a stand-in container.
+// gdp_points.h has the containers for a GU_Detail.
+//
+// A container that particles are loaded into has these members:
+//
+//	int	addAttribute(const std::string &name,
+//			     prtio::data_types::enum_t type, int arity,
+//			     prtAttribKind kind);
+//	    Creates a point attribute that holds values of 'type' without
+//	    loss, returning a handle for setValues().  Throws on failure.
+//	prtInt64 appendPoints(prtInt64 count);
+//	    Adds points, returning the index of the first.  Points added by
+//	    one call have consecutive indices.
+//	void	setPositions(prtInt64 first, const float *P,
+//			     std::size_t count);
+//	template <typename T>
+//	void	setValues(int attrib, prtInt64 first, const T *values,
+//			  std::size_t count);
+//	    T is float, double, int or prtInt64, whichever holds the
+//	    channel's type exactly.
+//
+// A container that particles are saved from has these:
+//
+//	prtInt64 numPoints() const;
+//	int	numAttributes() const;
+//	bool	getAttribute(int attrib, std::string &name,
+//			     prtio::data_types::enum_t &type,
+//			     int &arity) const;
+//	    Describes an attribute, or returns false for one that can't be
+//	    a channel (ex. a string attribute, or P).
+//	void	getPositions(prtInt64 first, float *P,
+//			     std::size_t count) const;
+//	template <typename T>
+//	void	getValues(int attrib, prtInt64 first, T *values,
+//			  std::size_t count) const;
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <prtio/particle_filter.hpp>
+#include <prtio/particle_table.hpp>
+#include <prtio/particle_transform.hpp>
+#include <prtio/prt_block_reader.hpp>
+#include <prtio/prt_istream.hpp>
+#include <prtio/prt_ofstream.hpp>
+#include <prtio/prt_trace.hpp>
+
+typedef prtio::data_types::int64_t	prtInt64;
+
+// What an attribute's values mean, for the containers to pass on as
+// Houdini's type info.
+enum prtAttribKind
+{
+    PRT_KIND_VALUE,
+    PRT_KIND_VECTOR,
+    PRT_KIND_NORMAL,
+    PRT_KIND_COLOR,
+    PRT_KIND_QUATERNION
+};
+
+// Houdini's names for the standard PRT channels.  Other channels keep
+// their own names, unless renamed.
+static const struct
+{
+    const char		*channel;
+    const char		*attribute;
+    prtAttribKind	 kind;
+} thePRTChannelNames[] = {
+    { "Velocity",	"v",		PRT_KIND_VECTOR },
+    { "Color",		"Cd",		PRT_KIND_COLOR },
+    { "Normal",		"N",		PRT_KIND_NORMAL },
+    { "Density",	"density",	PRT_KIND_VALUE },
+    { "ID",		"id",		PRT_KIND_VALUE },
+    { "Age",		"age",		PRT_KIND_VALUE },
+    { "Acceleration",	"accel",	PRT_KIND_VECTOR },
+    { "Orientation",	"orient",	PRT_KIND_QUATERNION },
+    { "Spin",		"w",		PRT_KIND_VECTOR },
+    { "Emission",	"Ce",		PRT_KIND_COLOR },
+    { "TextureCoord",	"uv",		PRT_KIND_VALUE },
+    { NULL,		NULL,		PRT_KIND_VALUE }
+};
+
+// How particles are loaded.  The filter and transform are applied as
+// each block is decoded, before any points are created for it.
+struct prtPointOptions
+{
+    prtio::particle_filter	 filter;
+    prtio::particle_transform	 xform;
+    double			 fraction;
+
+    // Which channels become attributes, and what they are called.  The
+    // renames go from channel to attribute, and are applied in reverse
+    // when saving.
+    std::vector<std::string>	 include, exclude;
+    std::map<std::string, std::string> renames;
+
+    // Where to record a span for each block decoded and each block of
+    // points created, or NULL.
+    prtio::prt_trace		*trace;
+
+    // The time spent creating points and filling their attributes,
+    // added to by prtLoadPoints() when the stream's timing is enabled.
+    double			 pointSeconds;
+
+    prtPointOptions() : fraction(1), trace(NULL), pointSeconds(0) {}
+};
+
+// The name of the attribute for a channel.
+static inline std::string
+prtAttributeName(const std::string &channel,
+		 const std::map<std::string, std::string> &renames,
+		 prtAttribKind &kind)
+{
+    kind = PRT_KIND_VALUE;
+    for (int i = 0; thePRTChannelNames[i].channel; i++)
+	if (channel == thePRTChannelNames[i].channel)
+	    kind = thePRTChannelNames[i].kind;
+
+    std::map<std::string, std::string>::const_iterator it =
+	    renames.find(channel);
+    if (it != renames.end())
+	return it->second;
+
+    for (int i = 0; thePRTChannelNames[i].channel; i++)
+	if (channel == thePRTChannelNames[i].channel)
+	    return thePRTChannelNames[i].attribute;
+    return channel;
+}
+
+// The name of the channel for an attribute, the reverse of
+// prtAttributeName().
+static inline std::string
+prtChannelName(const std::string &attribute,
+	       const std::map<std::string, std::string> &renames)
+{
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = renames.begin(); it != renames.end(); ++it)
+	if (it->second == attribute)
+	    return it->first;
+
+    for (int i = 0; thePRTChannelNames[i].channel; i++)
+	if (attribute == thePRTChannelNames[i].attribute &&
+	    renames.find(thePRTChannelNames[i].channel) == renames.end())
+	    return thePRTChannelNames[i].channel;
+    return attribute;
+}
+
+// A channel being copied to or from a point attribute.
+struct prtPointChannel
+{
+    std::string			 channel;
+    prtio::data_types::enum_t	 type;
+    int				 arity;
+    int				 attrib;
+};
+
+// Copies a channel of a block into consecutive points.  T is the type
+// that holds the channel's values exactly; the container converts to
+// its own storage.
+template <typename POINTS, typename T>
+static void
+prtFillAttribute(POINTS &points, const prtio::particle_table &block,
+		 const prtPointChannel &c, prtInt64 first,
+		 std::vector<T> &buffer)
+{
+    std::size_t		n = block.size();
+
+    buffer.resize(n * c.arity);
+    block.copy_channel(c.channel, &buffer[0], 0, n);
+    points.setValues(c.attrib, first, &buffer[0], n);
+}
+
+// Copies consecutive points of an attribute into a block's column.
+template <typename POINTS, typename T>
+static void
+prtFillColumn(const POINTS &points, prtio::particle_table &block,
+	      std::size_t column, const prtPointChannel &c, prtInt64 first,
+	      std::vector<T> &buffer)
+{
+    std::size_t		n = block.size();
+
+    buffer.resize(n * c.arity);
+    points.getValues(c.attrib, first, &buffer[0], n);
+    prtio::detail::get_write_converter<T>(c.type)(
+	    block.get_column(column), &buffer[0], n * c.arity);
+}
+
+// Loads the particles of a stream into points, one block at a time.
+// Only the channels that are wanted (and those the filter tests) are
+// copied out of the decompressed stream.  Returns the number of points
+// created.
+template <typename POINTS>
+prtInt64
+prtLoadPoints(prtio::prt_istream &stream, POINTS &points,
+	      prtPointOptions &opts, std::ostream &log)
+{
+    prtInt64 prtSize = stream.particles_remaining();
+
+    std::vector<std::string> chanlist = stream.get_channels_list();
+    int numchan = chanlist.size();
+    log << "PRT file contains these channels..." << std::endl;
+    for(int c=0; c<numchan; c++){
+      log << chanlist[c] << std::endl;
+    }
+
+    //We demand a "Position" channel exist, as a 3-vector.
+    if( !stream.has_channel( "Position" ) )
+      throw std::runtime_error( "The PRT file has no Position channel." );
+    if( stream.get_layout().get_channel( "Position" ).arity != 3 )
+      throw std::runtime_error( "The PRT file's Position channel doesn't have an arity of 3." );
+
+    // Version 2 files store the bounds of their particles, which lets
+    // the filter reject a whole file without decoding it, or skip the
+    // per-particle tests when the file is entirely inside it.  An
+    // unfinished file's bounds are only placeholders until it's closed.
+    prtio::particle_filter *filter = &opts.filter;
+    float bmin[3], bmax[3];
+    if( prtSize >= 0 && stream.get_metadata().get_bounds( bmin, bmax ) )
+    {
+      log << "Stored bounds: [" << bmin[0] << ", " << bmin[1] << ", " << bmin[2]
+	   << "] to [" << bmax[0] << ", " << bmax[1] << ", " << bmax[2] << "]" << std::endl;
+
+      if( !opts.filter.empty() )
+      {
+	switch( opts.filter.test_bounds( bmin, bmax ) )
+	{
+	case prtio::particle_filter::bounds_outside:
+	  log << "The stored bounds are outside the filter, so no particles were loaded." << std::endl;
+	  return 0;
+	case prtio::particle_filter::bounds_inside:
+	  log << "The stored bounds are inside the filter, so every particle is kept." << std::endl;
+	  filter = NULL;
+	  break;
+	default:
+	  break;
+	}
+      }
+    }
+
+    // Pick the channels to load before anything is decoded, so the
+    // others are never copied out of the decompressed stream.  The
+    // filter's channels are loaded even if they don't become attributes.
+    const prtio::prt_layout &layout = stream.get_layout();
+    std::vector<std::string> wanted;
+    for( size_t i = 0; i < opts.include.size(); i++ )
+      if( !stream.has_channel( opts.include[i] ) )
+	log << "Warning: there is no " << opts.include[i] << " channel to include." << std::endl;
+    for( size_t i = 0; i < chanlist.size(); i++ )
+    {
+      const std::string &name = chanlist[i];
+      bool keep = name == "Position" ||
+		  ( ( opts.include.empty() || std::find( opts.include.begin(), opts.include.end(), name ) != opts.include.end() ) &&
+		    std::find( opts.exclude.begin(), opts.exclude.end(), name ) == opts.exclude.end() );
+      if( keep )
+	wanted.push_back( name );
+    }
+
+    std::vector<std::string> loaded( wanted );
+    if( filter )
+    {
+      std::vector<std::string> filterChannels;
+      filter->get_channels( filterChannels );
+      for( size_t i = 0; i < filterChannels.size(); i++ )
+	if( stream.has_channel( filterChannels[i] ) &&
+	    std::find( loaded.begin(), loaded.end(), filterChannels[i] ) == loaded.end() )
+	  loaded.push_back( filterChannels[i] );
+    }
+
+    prtio::particle_table block;
+    for( size_t i = 0; i < loaded.size(); i++ )
+    {
+      const prtio::detail::prt_channel &ch = layout.get_channel( loaded[i] );
+      block.add_channel( loaded[i], ch.type, ch.arity );
+    }
+
+    // Decode a block at a time, so the filter can discard particles
+    // before any points are created for them, and the transform is
+    // applied while each block is still in cache.
+    prtio::prt_block_reader reader( stream );
+    reader.set_filter( filter );
+    reader.set_transform( &opts.xform );
+    prtInt64 exactCount = ( filter && !filter->empty() ) ? -1 : prtSize;
+    if( opts.fraction < 1 && prtSize < 0 )
+      log << "Ignoring the fraction, since the particle count isn't known yet." << std::endl;
+    else if( opts.fraction < 1 )
+    {
+      prtInt64 limit = (prtInt64)ceil( opts.fraction * prtSize );
+      reader.set_max_particles( limit );
+      if( exactCount >= 0 )
+	exactCount = limit;
+      log << "Decoding the first " << limit << " particles." << std::endl;
+    }
+
+    // Create an attribute for every channel, stored like the channel.
+    std::vector<prtPointChannel> channels;
+    std::vector<std::string> attribNames;
+    log << "Loading channels as point attributes..." << std::endl;
+    for( size_t i = 0; i < wanted.size(); i++ )
+    {
+      if( wanted[i] == "Position" )
+	continue;
+
+      const prtio::detail::prt_channel &ch = layout.get_channel( wanted[i] );
+      prtAttribKind kind;
+      std::string name = prtAttributeName( wanted[i], opts.renames, kind );
+
+      if( name == "P" || std::find( attribNames.begin(), attribNames.end(), name ) != attribNames.end() )
+	throw std::runtime_error( "More than one channel would become the attribute \"" + name + "\"." );
+      attribNames.push_back( name );
+
+      prtPointChannel c;
+      c.channel = wanted[i];
+      c.type = ch.type;
+      c.arity = (int)ch.arity;
+      c.attrib = points.addAttribute( name, ch.type, c.arity, kind );
+      channels.push_back( c );
+
+      log << "  " << wanted[i] << " -> " << name << " (" << prtio::data_types::names[ch.type] << "[" << ch.arity << "])" << std::endl;
+    }
+
+    // When every particle decoded is kept, the count is known up front
+    // and the points are allocated all at once.
+    prtInt64 first = ( exactCount > 0 ) ? points.appendPoints( exactCount ) : 0;
+    prtInt64 created = 0;
+
+    std::vector<float> pos, floats;
+    std::vector<double> doubles;
+    std::vector<int> ints;
+    std::vector<prtInt64> int64s;
+
+    double *pointTimer = stream.convert_timer() ? &opts.pointSeconds : NULL;
+    for( ;; )
+    {
+      {
+	prtio::prt_trace::span decode( opts.trace, "decode block" );
+	if( !reader.read_next_block( block ) )
+	  break;
+	decode.add_arg( "particles", (prtInt64)block.size() );
+      }
+
+      std::size_t n = block.size();
+      if( n == 0 )
+	continue;
+
+      prtio::prt_trace::span create( opts.trace, "create points" );
+      prtio::detail::stats_timer timer( pointTimer );
+      prtInt64 start = ( exactCount > 0 ) ? first + created : points.appendPoints( n );
+      created += n;
+
+      pos.resize( 3*n );
+      block.copy_channel( "Position", &pos[0], 0, n );
+      points.setPositions( start, &pos[0], n );
+
+      for( size_t c = 0; c < channels.size(); c++ )
+      {
+	switch( channels[c].type )
+	{
+	case prtio::data_types::type_float16:
+	case prtio::data_types::type_float32:
+	  prtFillAttribute( points, block, channels[c], start, floats );
+	  break;
+	case prtio::data_types::type_float64:
+	  prtFillAttribute( points, block, channels[c], start, doubles );
+	  break;
+	case prtio::data_types::type_int8:
+	case prtio::data_types::type_int16:
+	case prtio::data_types::type_int32:
+	case prtio::data_types::type_uint8:
+	case prtio::data_types::type_uint16:
+	  prtFillAttribute( points, block, channels[c], start, ints );
+	  break;
+	default:
+	  prtFillAttribute( points, block, channels[c], start, int64s );
+	  break;
+	}
+      }
+    }
+
+    if( filter && !filter->empty() )
+      log << "Kept " << created << " of " << reader.particles_decoded() << " particles." << std::endl;
+    if( prtSize < 0 )
+      log << "Read " << reader.particles_decoded() << " particles as they were written." << std::endl;
+
+    return created;
+}
+
+// Saves points as PRT particles to a seekable stream.  Position is
+// float32, and every other numeric attribute becomes a channel of the
+// type its storage maps to.  The file's bounds and channel ranges are
+// stored in its header.
+template <typename POINTS>
+void
+prtSavePoints(const POINTS &points, std::ostream &os, const std::string &name,
+	      const std::map<std::string, std::string> &renames)
+{
+    prtio::prt_ofstream			 out;
+    prtio::particle_table		 block;
+    std::vector<prtPointChannel>	 channels;
+
+    block.add_channel("Position", prtio::data_types::type_float32, 3);
+    for (int i = 0; i < points.numAttributes(); i++)
+    {
+	prtPointChannel		 c;
+	std::string		 attribute;
+
+	if (!points.getAttribute(i, attribute, c.type, c.arity))
+	    continue;
+	c.channel = prtChannelName(attribute, renames);
+	c.attrib = i;
+	if (block.has_channel(c.channel))
+	    throw std::runtime_error("More than one attribute would become the channel \"" + c.channel + "\".");
+
+	block.add_channel(c.channel, c.type, c.arity);
+	channels.push_back(c);
+    }
+
+    block.declare_channels(out);
+    out.set_compute_stats(true);
+    out.open(os, name);
+
+    std::vector<float>		 floats;
+    std::vector<double>		 doubles;
+    std::vector<int>		 ints;
+    std::vector<prtInt64>	 int64s;
+    const std::size_t		 blockSize = 4096;
+    prtInt64			 total = points.numPoints();
+
+    for (prtInt64 first = 0; first < total; first += blockSize)
+    {
+	std::size_t	n = (std::size_t)std::min<prtInt64>(blockSize, total - first);
+
+	block.resize(n);
+	points.getPositions(first, block.get_column<float>("Position"), n);
+
+	for (std::size_t c = 0; c < channels.size(); c++)
+	{
+	    std::size_t	column = block.channel_index(channels[c].channel);
+	    switch (channels[c].type)
+	    {
+	    case prtio::data_types::type_float16:
+	    case prtio::data_types::type_float32:
+		prtFillColumn(points, block, column, channels[c], first, floats);
+		break;
+	    case prtio::data_types::type_float64:
+		prtFillColumn(points, block, column, channels[c], first, doubles);
+		break;
+	    case prtio::data_types::type_int8:
+	    case prtio::data_types::type_int16:
+	    case prtio::data_types::type_int32:
+	    case prtio::data_types::type_uint8:
+	    case prtio::data_types::type_uint16:
+		prtFillColumn(points, block, column, channels[c], first, ints);
+		break;
+	    default:
+		prtFillColumn(points, block, column, channels[c], first, int64s);
+		break;
+	    }
+	}
+
+	block.save(out);
+    }
+
+    out.close();
+}
@@ -0,0 +1,718 @@
+/*
+ * THIS SOFTWARE IS PROVIDED `AS IS' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+// Sequences of .voxel frames stored as keyframes plus per-tile deltas, so
+// the regions of a sim that hold still cost next to nothing.
+//
+// The volumes are cut into 16x16x16 tiles, as a UT_VoxelArray is.  In a
+// keyframe every tile is stored on its own: as one value if it is
+// constant, and otherwise deflated.  In the frames between, a tile is
+// compared against the same tile of the previous frame:
+//  - a tile with the same values is elided, costing one byte;
+//  - a tile that changed is stored as the XOR of its bits with the
+//    previous ones, deflated, unless storing it on its own is smaller.
+// Before deflating, the bytes of the floats are split into four planes,
+// so the sign and exponent bytes, which rarely change, compress well.
+// Storage is lossless.
+//
+// A volume is delta coded against the volume at the same position in the
+// previous frame.  If that has another name or resolution, or there is
+// none, the volume is stored as in a keyframe.
+//
+// Decoding frame n starts at the keyframe at or before it, so random
+// access never decodes more than the keyframe interval worth of frames.
+// Both directions work a layer of tiles (16 z slabs) at a time, so memory
+// stays bounded as the volumes grow.  The writer keeps the previous frame
+// in memory only in its compressed, stand alone form.
+//
+// The file is written in native byte order:
+//	char	magic[8]		"VOXSEQ1"
+//	frames
+//	index:	{ int64 offset; int32 key; int32 unused; } per frame
+//	int64	index offset
+//	int32	number of frames
+//	int32	keyframe interval
+//	char	magic[8]		"VOXSEQ1"
+// A frame is its number of volumes (int32), then for each volume:
+//	int32	name length, then the name
+//	int32	res[3]
+//	float	center[3], size[3]
+//	int32	1 if the volume is stored on its own
+//	int64	offset of each layer of tiles
+//	int64	offset of the end of the volume
+// followed by the layers, each a record per tile, y then x:
+//	uint8	kind
+//	float	value				for a constant tile
+//	uint32	size, then deflated bytes	for raw and XOR tiles
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "voxel_stream.h"
+
+enum voxelTileKind
+{
+    VOXEL_TILE_SAME,		// As in the previous frame.
+    VOXEL_TILE_CONSTANT,	// One value.
+    VOXEL_TILE_RAW,		// The values, deflated.
+    VOXEL_TILE_XOR,		// The values XOR the previous ones, deflated.
+    VOXEL_TILE_KINDS
+};
+
+// Encoding and decoding of single tiles, shared by the reader and writer.
+class voxelTileCodec
+{
+public:
+    enum { theTileBits = 4, theTileSize = 1 << theTileBits };
+
+    // Encodes a tile on its own, as a constant or raw tile.
+    static void encode(const float *values, size_t count,
+		       std::vector<unsigned char> &record)
+    {
+	const uint32_t	*bits = (const uint32_t *)values;
+	size_t		 i = 1;
+
+	while (i < count && bits[i] == bits[0])
+	    i++;
+
+	record.clear();
+	if (i >= count)
+	{
+	    record.push_back(VOXEL_TILE_CONSTANT);
+	    append(record, values, sizeof(float));
+	}
+	else
+	    deflateBits(VOXEL_TILE_RAW, bits, count, record);
+    }
+
+    // Encodes the change from 'previous' to 'values' as an XOR tile.
+    static void encodeXor(const float *values, const float *previous,
+			  size_t count, std::vector<unsigned char> &record,
+			  std::vector<uint32_t> &scratch)
+    {
+	const uint32_t	*bits = (const uint32_t *)values;
+	const uint32_t	*before = (const uint32_t *)previous;
+
+	scratch.resize(count);
+	for (size_t i = 0; i < count; i++)
+	    scratch[i] = bits[i] ^ before[i];
+	record.clear();
+	deflateBits(VOXEL_TILE_XOR, scratch.data(), count, record);
+    }
+
+    // Applies a record to the tile's values, which hold the previous
+    // frame's for same and XOR tiles.
+    static bool decode(const unsigned char *record, size_t size,
+		       float *values, size_t count,
+		       std::vector<unsigned char> &scratch)
+    {
+	if (size < 1)
+	    return false;
+
+	uint32_t	*bits = (uint32_t *)values;
+	switch (record[0])
+	{
+	case VOXEL_TILE_SAME:
+	    return size == 1;
+	case VOXEL_TILE_CONSTANT:
+	{
+	    uint32_t	value;
+	    if (size != 1 + sizeof(value))
+		return false;
+	    memcpy(&value, record + 1, sizeof(value));
+	    std::fill(bits, bits + count, value);
+	    return true;
+	}
+	case VOXEL_TILE_RAW:
+	case VOXEL_TILE_XOR:
+	{
+	    uLongf	length = (uLongf)(count * 4);
+	    scratch.resize(count * 4);
+	    if (size < 5 ||
+		uncompress(scratch.data(), &length, record + 5, (uLong)(size - 5)) != Z_OK ||
+		length != count * 4)
+		return false;
+
+	    // Gather the four byte planes back into floats.
+	    const unsigned char	*plane = scratch.data();
+	    for (size_t i = 0; i < count; i++)
+	    {
+		unsigned char	b[4] = { plane[i], plane[count + i],
+					 plane[2 * count + i], plane[3 * count + i] };
+		uint32_t	v;
+		memcpy(&v, b, 4);
+		bits[i] = record[0] == VOXEL_TILE_XOR ? bits[i] ^ v : v;
+	    }
+	    return true;
+	}
+	default:
+	    return false;
+	}
+    }
+
+    // The size of the record starting at 'p', from its header, or 0 if
+    // 'available' bytes don't hold the header.
+    static size_t recordSize(const unsigned char *p, size_t available)
+    {
+	if (available < 1)
+	    return 0;
+	switch (p[0])
+	{
+	case VOXEL_TILE_SAME:
+	    return 1;
+	case VOXEL_TILE_CONSTANT:
+	    return 5;
+	default:
+	{
+	    uint32_t	size;
+	    if (available < 5)
+		return 0;
+	    memcpy(&size, p + 1, 4);
+	    return 5 + (size_t)size;
+	}
+	}
+    }
+
+    // The number of values in tile (tx, ty) of a layer, depth slabs of
+    // rx by ry values.
+    static size_t tileCount(int rx, int ry, int depth, int tx, int ty)
+    {
+	return (size_t)std::min<int>(theTileSize, rx - tx * theTileSize)
+	     * std::min<int>(theTileSize, ry - ty * theTileSize) * depth;
+    }
+
+    // Copy a tile between a layer and a contiguous tile.
+
+    static void gather(const float *layer, int rx, int ry, int depth,
+		       int tx, int ty, float *tile)
+    {
+	int	x0 = tx * theTileSize, nx = std::min<int>(theTileSize, rx - x0);
+	int	y0 = ty * theTileSize, ny = std::min<int>(theTileSize, ry - y0);
+
+	for (int z = 0; z < depth; z++)
+	    for (int y = 0; y < ny; y++, tile += nx)
+		memcpy(tile, layer + ((size_t)z * ry + y0 + y) * rx + x0,
+		       nx * sizeof(float));
+    }
+
+    static void scatter(const float *tile, int rx, int ry, int depth,
+			int tx, int ty, float *layer)
+    {
+	int	x0 = tx * theTileSize, nx = std::min<int>(theTileSize, rx - x0);
+	int	y0 = ty * theTileSize, ny = std::min<int>(theTileSize, ry - y0);
+
+	for (int z = 0; z < depth; z++)
+	    for (int y = 0; y < ny; y++, tile += nx)
+		memcpy(layer + ((size_t)z * ry + y0 + y) * rx + x0, tile,
+		       nx * sizeof(float));
+    }
+
+    static void append(std::vector<unsigned char> &record, const void *data,
+		       size_t size)
+    {
+	const unsigned char	*p = (const unsigned char *)data;
+	record.insert(record.end(), p, p + size);
+    }
+
+private:
+    static void deflateBits(voxelTileKind kind, const uint32_t *bits,
+			    size_t count, std::vector<unsigned char> &record)
+    {
+	// Split the bytes into planes.
+	std::vector<unsigned char>	planes(count * 4);
+	for (size_t i = 0; i < count; i++)
+	{
+	    unsigned char	b[4];
+	    memcpy(b, &bits[i], 4);
+	    for (int k = 0; k < 4; k++)
+		planes[k * count + i] = b[k];
+	}
+
+	uLongf	length = compressBound((uLong)planes.size());
+	record.resize(5 + length);
+	record[0] = (unsigned char)kind;
+	compress2(&record[5], &length, planes.data(), (uLong)planes.size(),
+		  Z_BEST_SPEED);
+	record.resize(5 + length);
+
+	uint32_t	size = (uint32_t)length;
+	memcpy(&record[1], &size, 4);
+    }
+};
+
+// Writes a sequence of frames, each read from a .voxel stream:
+//	voxelSequenceWriter	writer;
+//	writer.open("smoke.voxseq", 24);
+//	for each frame
+//	    writer.addFrame(reader);
+//	writer.close();
+class voxelSequenceWriter
+{
+public:
+    explicit voxelSequenceWriter(unsigned threads = 0)
+	: myKeyInterval(1), myThreads(threads)
+    {
+	for (int k = 0; k < VOXEL_TILE_KINDS; k++)
+	    myTileCounts[k] = 0;
+    }
+
+    // keyInterval is the number of frames from one keyframe to the next.
+    bool open(const char *path, int keyInterval)
+    {
+	myStream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	myKeyInterval = std::max(keyInterval, 1);
+	myIndex.clear();
+	myVolumes.clear();
+	myStream.write("VOXSEQ1", 8);
+	return (bool)myStream;
+    }
+
+    // Adds the volumes of a .voxel file, just opened, as the next frame.
+    bool addFrame(voxelReader &reader)
+    {
+	indexEntry	entry;
+	int32_t		count = 0;
+
+	entry.offset = (int64_t)myStream.tellp();
+	entry.key = myIndex.size() % myKeyInterval == 0;
+	entry.unused = 0;
+	myStream.write((const char *)&count, sizeof(count));
+
+	voxelHeader	header;
+	while (reader.nextVolume(header))
+	{
+	    if (!addVolume(reader, header, entry.key, count))
+		return false;
+	    count++;
+	}
+	if (reader.error())
+	    return false;
+	myVolumes.resize(count);
+
+	std::streamoff	end = myStream.tellp();
+	myStream.seekp(entry.offset);
+	myStream.write((const char *)&count, sizeof(count));
+	myStream.seekp(end);
+
+	myIndex.push_back(entry);
+	return (bool)myStream;
+    }
+
+    bool close()
+    {
+	int64_t		indexOffset = (int64_t)myStream.tellp();
+	int32_t		frames = (int32_t)myIndex.size();
+	int32_t		interval = myKeyInterval;
+
+	if (!myIndex.empty())
+	    myStream.write((const char *)&myIndex[0], myIndex.size() * sizeof(indexEntry));
+	myStream.write((const char *)&indexOffset, sizeof(indexOffset));
+	myStream.write((const char *)&frames, sizeof(frames));
+	myStream.write((const char *)&interval, sizeof(interval));
+	myStream.write("VOXSEQ1", 8);
+	myStream.close();
+	myVolumes.clear();
+	return !myStream.fail();
+    }
+
+    // The number of tiles written of each voxelTileKind.
+    long long	tileCount(voxelTileKind kind) const
+		{ return myTileCounts[kind]; }
+
+private:
+    struct indexEntry
+    {
+	int64_t		offset;
+	int32_t		key;
+	int32_t		unused;
+    };
+
+    // The previous frame's volume at some position, its tiles encoded on
+    // their own, layer by layer.
+    struct volumeState
+    {
+	voxelHeader					header;
+	std::vector< std::vector<unsigned char> >	tiles;
+    };
+
+    bool addVolume(voxelReader &reader, const voxelHeader &header,
+		   bool key, int position)
+    {
+	const int	size = voxelTileCodec::theTileSize;
+	const int	rx = header.res[0], ry = header.res[1], rz = header.res[2];
+	const int	tilesX = (rx + size - 1) / size;
+	const int	tilesY = (ry + size - 1) / size;
+	const int	layers = (rz + size - 1) / size;
+	const size_t	perLayer = (size_t)tilesX * tilesY;
+
+	// Delta code against the volume in the same place last frame.
+	volumeState	*previous = NULL;
+	if (position < (int)myVolumes.size())
+	{
+	    previous = &myVolumes[position];
+	    if (key || previous->header.name != header.name ||
+		memcmp(previous->header.res, header.res, sizeof(header.res)))
+		previous = NULL;
+	}
+
+	volumeState	current;
+	current.header = header;
+	current.tiles.resize(perLayer * layers);
+
+	int32_t		nameLength = (int32_t)header.name.size();
+	int32_t		standalone = previous ? 0 : 1;
+	myStream.write((const char *)&nameLength, sizeof(nameLength));
+	myStream.write(header.name.data(), nameLength);
+	myStream.write((const char *)header.res, sizeof(header.res));
+	myStream.write((const char *)header.center, sizeof(header.center));
+	myStream.write((const char *)header.size, sizeof(header.size));
+	myStream.write((const char *)&standalone, sizeof(standalone));
+
+	// The layer offsets, then the end of the volume, are filled in
+	// once the layers are written.
+	std::streamoff		tableOffset = myStream.tellp();
+	std::vector<int64_t>	offsets(layers + 1);
+	myStream.write((const char *)&offsets[0], offsets.size() * sizeof(int64_t));
+
+	std::vector<float>			layer;
+	std::vector< std::vector<unsigned char> >	records(perLayer);
+	long long				counts[VOXEL_TILE_KINDS] = { 0 };
+
+	for (int l = 0; l < layers; l++)
+	{
+	    int		depth = std::min(size, rz - l * size);
+
+	    layer.resize(header.slabSize() * depth);
+	    for (int z = 0; z < depth; z++)
+		if (!reader.readSlab(&layer[header.slabSize() * z], header.slabSize()))
+		    return false;
+
+	    // Encode the tiles of the layer on several threads.
+	    prtio::detail::parallel_for(perLayer, [&](size_t t)
+	    {
+		int			tx = (int)(t % tilesX), ty = (int)(t / tilesX);
+		size_t			count = voxelTileCodec::tileCount(rx, ry, depth, tx, ty);
+		size_t			index = l * perLayer + t;
+		std::vector<float>	values(count), before;
+		std::vector<unsigned char>	xorRecord, scratch;
+		std::vector<uint32_t>	bits;
+
+		voxelTileCodec::gather(layer.data(), rx, ry, depth, tx, ty, values.data());
+
+		if (previous)
+		{
+		    const std::vector<unsigned char>	&old = previous->tiles[index];
+		    before.resize(count);
+		    voxelTileCodec::decode(old.data(), old.size(), before.data(), count, scratch);
+		    if (!memcmp(before.data(), values.data(), count * sizeof(float)))
+		    {
+			current.tiles[index] = old;
+			records[t].assign(1, (unsigned char)VOXEL_TILE_SAME);
+			return;
+		    }
+		}
+
+		voxelTileCodec::encode(values.data(), count, current.tiles[index]);
+		records[t] = current.tiles[index];
+		if (previous && records[t][0] == VOXEL_TILE_RAW)
+		{
+		    voxelTileCodec::encodeXor(values.data(), before.data(), count, xorRecord, bits);
+		    if (xorRecord.size() < records[t].size())
+			records[t].swap(xorRecord);
+		}
+	    }, myThreads);
+
+	    offsets[l] = (int64_t)myStream.tellp();
+	    for (size_t t = 0; t < perLayer; t++)
+	    {
+		myStream.write((const char *)records[t].data(), records[t].size());
+		counts[records[t][0]]++;
+	    }
+	}
+
+	if (!reader.endVolume())
+	    return false;
+
+	std::streamoff	end = myStream.tellp();
+	offsets[layers] = (int64_t)end;
+	myStream.seekp(tableOffset);
+	myStream.write((const char *)&offsets[0], offsets.size() * sizeof(int64_t));
+	myStream.seekp(end);
+
+	for (int k = 0; k < VOXEL_TILE_KINDS; k++)
+	    myTileCounts[k] += counts[k];
+	if (position >= (int)myVolumes.size())
+	    myVolumes.resize(position + 1);
+	myVolumes[position].header = header;
+	myVolumes[position].tiles.swap(current.tiles);
+	return (bool)myStream;
+    }
+
+    std::ofstream		myStream;
+    int				myKeyInterval;
+    unsigned			myThreads;
+    std::vector<indexEntry>	myIndex;
+    std::vector<volumeState>	myVolumes;
+    long long			myTileCounts[VOXEL_TILE_KINDS];
+};
+
+// Reads frames back out of a sequence, as .voxel:
+//	voxelSequenceReader	reader;
+//	reader.open("smoke.voxseq");
+//	reader.readFrame(12, writer);
+class voxelSequenceReader
+{
+public:
+    explicit voxelSequenceReader(unsigned threads = 0)
+	: myKeyInterval(1), myThreads(threads)
+    {
+    }
+
+    bool open(const char *path)
+    {
+	char		magic[8];
+	int64_t		indexOffset;
+	int32_t		frames, interval;
+
+	myStream.open(path, std::ios::in | std::ios::binary);
+	myStream.read(magic, sizeof(magic));
+	if (!myStream || memcmp(magic, "VOXSEQ1", 8))
+	    return false;
+
+	myStream.seekg(-(std::streamoff)(sizeof(indexOffset) + 2 * sizeof(int32_t) + sizeof(magic)), std::ios::end);
+	myStream.read((char *)&indexOffset, sizeof(indexOffset));
+	myStream.read((char *)&frames, sizeof(frames));
+	myStream.read((char *)&interval, sizeof(interval));
+	myStream.read(magic, sizeof(magic));
+	if (!myStream || memcmp(magic, "VOXSEQ1", 8) || frames < 0)
+	    return false;
+
+	myKeyInterval = interval;
+	myIndex.resize(frames);
+	myStream.seekg(indexOffset);
+	if (frames > 0)
+	    myStream.read((char *)&myIndex[0], frames * sizeof(indexEntry));
+	return (bool)myStream;
+    }
+
+    int		numFrames() const { return (int)myIndex.size(); }
+    int		keyInterval() const { return myKeyInterval; }
+
+    // Whether a frame is a keyframe.
+    bool	isKey(int frame) const { return myIndex[frame].key != 0; }
+
+    // Decodes a frame, writing its volumes in order.  Only the frames
+    // back to its keyframe are read.
+    bool readFrame(int frame, voxelWriter &writer)
+    {
+	if (frame < 0 || frame >= numFrames())
+	    return false;
+
+	int	key = frame;
+	while (key > 0 && !myIndex[key].key)
+	    key--;
+
+	// The volume headers and layer offsets of the frames from the key.
+	std::vector< std::vector<volumeInfo> >	frames(frame - key + 1);
+	for (int f = key; f <= frame; f++)
+	    if (!readVolumes(myIndex[f].offset, frames[f - key]))
+		return false;
+
+	const std::vector<volumeInfo>	&target = frames.back();
+	for (size_t v = 0; v < target.size(); v++)
+	{
+	    // Decode from the last frame where the volume stands alone.
+	    size_t	first = frames.size() - 1;
+	    while (!frames[first][v].standalone)
+	    {
+		if (first == 0 || frames[first - 1].size() <= v)
+		    return false;
+		first--;
+	    }
+
+	    if (!readVolume(frames, first, v, writer))
+		return false;
+	}
+	return true;
+    }
+
+private:
+    struct indexEntry
+    {
+	int64_t		offset;
+	int32_t		key;
+	int32_t		unused;
+    };
+
+    struct volumeInfo
+    {
+	voxelHeader		header;
+	bool			standalone;
+	std::vector<int64_t>	layers;
+    };
+
+    bool readVolumes(int64_t offset, std::vector<volumeInfo> &volumes)
+    {
+	int32_t		count;
+
+	myStream.clear();
+	myStream.seekg(offset);
+	myStream.read((char *)&count, sizeof(count));
+	if (!myStream || count < 0)
+	    return false;
+
+	volumes.resize(count);
+	for (int v = 0; v < count; v++)
+	{
+	    volumeInfo	&info = volumes[v];
+	    int32_t	 length, standalone;
+
+	    myStream.read((char *)&length, sizeof(length));
+	    if (!myStream || length < 0 || length > (1 << 20))
+		return false;
+	    info.header.name.resize(length);
+	    if (length > 0)
+		myStream.read(&info.header.name[0], length);
+	    myStream.read((char *)info.header.res, sizeof(info.header.res));
+	    myStream.read((char *)info.header.center, sizeof(info.header.center));
+	    myStream.read((char *)info.header.size, sizeof(info.header.size));
+	    myStream.read((char *)&standalone, sizeof(standalone));
+	    if (!myStream || info.header.res[2] < 0)
+		return false;
+
+	    int		size = voxelTileCodec::theTileSize;
+	    info.standalone = standalone != 0;
+	    int64_t	end;
+	    info.layers.resize((info.header.res[2] + size - 1) / size);
+	    if (!info.layers.empty())
+		myStream.read((char *)&info.layers[0], info.layers.size() * sizeof(int64_t));
+	    myStream.read((char *)&end, sizeof(end));
+	    if (!myStream)
+		return false;
+
+	    // Skip to the next volume's header.
+	    myStream.seekg(end);
+	}
+	return true;
+    }
+
+    // Decodes volume v of the last frame, applying each frame of the
+    // chain from 'first' to each layer in turn.
+    bool readVolume(const std::vector< std::vector<volumeInfo> > &frames,
+		    size_t first, size_t v, voxelWriter &writer)
+    {
+	const voxelHeader	&header = frames.back()[v].header;
+	const int		 size = voxelTileCodec::theTileSize;
+	const int		 rx = header.res[0], ry = header.res[1], rz = header.res[2];
+	const int		 tilesX = (rx + size - 1) / size;
+	const int		 tilesY = (ry + size - 1) / size;
+	const size_t		 perLayer = (size_t)tilesX * tilesY;
+
+	if (!writer.beginVolume(header))
+	    return false;
+
+	std::vector<float>		layer;
+	std::vector<unsigned char>	data;
+	std::vector<size_t>		starts(perLayer + 1);
+
+	for (size_t l = 0; l < frames.back()[v].layers.size(); l++)
+	{
+	    int		depth = std::min(size, rz - (int)l * size);
+	    layer.assign(header.slabSize() * depth, 0.0f);
+
+	    for (size_t f = first; f < frames.size(); f++)
+	    {
+		// Read the layer's records, then decode them in parallel.
+		if (!readLayer(frames[f][v].layers[l], perLayer, data, starts))
+		    return false;
+
+		std::atomic<bool>	ok(true);
+		prtio::detail::parallel_for(perLayer, [&](size_t t)
+		{
+		    int			tx = (int)(t % tilesX), ty = (int)(t / tilesX);
+		    size_t		count = voxelTileCodec::tileCount(rx, ry, depth, tx, ty);
+		    const unsigned char	*record = &data[starts[t]];
+
+		    if (record[0] == VOXEL_TILE_SAME)
+			return;
+
+		    std::vector<float>		values(count);
+		    std::vector<unsigned char>	scratch;
+		    if (record[0] == VOXEL_TILE_XOR)
+			voxelTileCodec::gather(layer.data(), rx, ry, depth, tx, ty, values.data());
+		    if (!voxelTileCodec::decode(record, starts[t + 1] - starts[t],
+						values.data(), count, scratch))
+			ok = false;
+		    voxelTileCodec::scatter(values.data(), rx, ry, depth, tx, ty, layer.data());
+		}, myThreads);
+		if (!ok)
+		    return false;
+	    }
+
+	    for (int z = 0; z < depth; z++)
+		if (!writer.writeSlab(&layer[header.slabSize() * z], header.slabSize()))
+		    return false;
+	}
+
+	return writer.endVolume();
+    }
+
+    // Reads the records of a layer, noting where each starts.
+    bool readLayer(int64_t offset, size_t count, std::vector<unsigned char> &data,
+		   std::vector<size_t> &starts)
+    {
+	myStream.clear();
+	myStream.seekg(offset);
+	data.clear();
+	for (size_t t = 0; t < count; t++)
+	{
+	    unsigned char	header[5];
+	    size_t		size;
+
+	    starts[t] = data.size();
+	    myStream.read((char *)header, 1);
+	    if (!myStream || header[0] >= VOXEL_TILE_KINDS)
+		return false;
+	    if (header[0] != VOXEL_TILE_SAME)
+		myStream.read((char *)header + 1, 4);
+
+	    size = voxelTileCodec::recordSize(header, 5);
+	    data.resize(starts[t] + size);
+	    memcpy(&data[starts[t]], header, std::min<size_t>(size, 5));
+	    if (size > 5)
+		myStream.read((char *)&data[starts[t] + 5], size - 5);
+	    if (!myStream)
+		return false;
+	}
+	starts[count] = data.size();
+	return true;
+    }
+
+    std::ifstream		myStream;
+    int				myKeyInterval;
+    unsigned			myThreads;
+    std::vector<indexEntry>	myIndex;
+};
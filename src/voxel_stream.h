@@ -0,0 +1,671 @@
+/*
+ * THIS SOFTWARE IS PROVIDED `AS IS' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+// Reading and writing the toy ascii .voxel format of geo2voxel, without
+// the HDK, so the conversion can be run and timed on its own (see
+// voxelbench.C).
+//
+// A .voxel file is the token VOXELS followed by any number of volumes:
+//	VOLUME name
+//	rx ry rz
+//	cx cy cz		(the center)
+//	sx sy sz		(the size)
+//	{
+//	    values, x fastest, then y, then z
+//	}
+//
+// The values are read and written one z slab (an rx by ry slice) at a
+// time, so a conversion only ever holds a slab of the volume rather than
+// the whole grid.  Writing a slab formats its rows on several threads.
+//
+// voxelMipChain builds half, quarter, etc. resolution copies of a volume
+// from the same slabs, to be written after it as extra volumes.
+
+#pragma once
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+//PRT includes
+#include <prtio/detail/parallel.hpp>
+#include <prtio/detail/simd.hpp>
+
+// The header of a volume in a .voxel file.
+struct voxelHeader
+{
+    voxelHeader()
+    {
+	for (int i = 0; i < 3; i++)
+	{
+	    res[i] = 0;
+	    center[i] = 0;
+	    size[i] = 0;
+	}
+    }
+
+    // The number of values in a z slab.
+    size_t	slabSize() const { return (size_t)res[0] * res[1]; }
+
+    std::string	name;
+    int		res[3];
+    float	center[3];
+    float	size[3];
+};
+
+// Reads the volumes of a .voxel file, one z slab at a time:
+//	voxelReader	reader(is);
+//	voxelHeader	header;
+//	if (!reader.open())
+//	    ...
+//	while (reader.nextVolume(header))
+//	{
+//	    for (int z = 0; z < header.res[2]; z++)
+//		reader.readSlab(slab, header.slabSize());
+//	    reader.endVolume();
+//	}
+// Every method returns false if the file is malformed or cut short, after
+// which error() is true.
+class voxelReader
+{
+public:
+    explicit voxelReader(std::istream &is)
+	: myStream(is), myBuffer((1 << 20) + 1), myPos(0), myEnd(0),
+	  myError(false)
+    {
+    }
+
+    // Checks the magic token.
+    bool open()
+    {
+	return expect("VOXELS");
+    }
+
+    // Reads the header of the next volume, up to its opening brace.
+    // Returns false at the end of the file.
+    bool nextVolume(voxelHeader &header)
+    {
+	std::string	token;
+	if (myError || !readToken(token))
+	    return false;
+	if (token != "VOLUME" || !readToken(header.name))
+	    return fail();
+
+	for (int i = 0; i < 3; i++)
+	    if (!readInt(header.res[i]) || header.res[i] < 0)
+		return fail();
+	for (int i = 0; i < 3; i++)
+	    if (!readFloat(header.center[i]))
+		return fail();
+	for (int i = 0; i < 3; i++)
+	    if (!readFloat(header.size[i]))
+		return fail();
+
+	return expect("{");
+    }
+
+    // Reads the next z slab of the current volume into values, which
+    // holds header.slabSize() floats.
+    bool readSlab(float *values, size_t count)
+    {
+	for (size_t i = 0; i < count; i++)
+	    if (!readFloat(values[i]))
+		return fail();
+	return true;
+    }
+
+    // Checks the closing brace after the last slab.
+    bool endVolume()
+    {
+	return expect("}");
+    }
+
+    // Skips the values of the current volume and its closing brace,
+    // without parsing them, for a reader that only wants some of the
+    // volumes in a file (ex. one level of a mip chain).
+    bool skipVolume()
+    {
+	for (;;)
+	{
+	    const char	*brace = (const char *)memchr(&myBuffer[myPos], '}',
+							myEnd - myPos);
+	    if (brace)
+	    {
+		myPos = brace - &myBuffer[0] + 1;
+		return true;
+	    }
+	    myPos = myEnd;
+	    fill(1);
+	    if (myPos == myEnd)
+		return fail();
+	}
+    }
+
+    bool error() const { return myError; }
+
+private:
+    bool fail()
+    {
+	myError = true;
+	return false;
+    }
+
+    // Makes sure at least 'want' bytes are buffered, short of the end of
+    // the stream, keeping the unread ones.  The buffer always ends in a
+    // NUL, so strtof() stops at the end of the data.
+    void fill(size_t want)
+    {
+	if (myEnd - myPos >= want || !myStream)
+	    return;
+
+	memmove(&myBuffer[0], &myBuffer[myPos], myEnd - myPos);
+	myEnd -= myPos;
+	myPos = 0;
+
+	size_t	capacity = myBuffer.size() - 1;
+	while (myEnd < want && myStream)
+	{
+	    myStream.read(&myBuffer[myEnd], capacity - myEnd);
+	    myEnd += (size_t)myStream.gcount();
+	}
+	myBuffer[myEnd] = '\0';
+    }
+
+    // Skips white space, returning false at the end of the stream.
+    bool skipSpace()
+    {
+	for (;;)
+	{
+	    while (myPos < myEnd && isspace((unsigned char)myBuffer[myPos]))
+		myPos++;
+	    if (myPos < myEnd)
+		return true;
+	    fill(1);
+	    if (myPos == myEnd)
+		return false;
+	}
+    }
+
+    bool readToken(std::string &token)
+    {
+	if (!skipSpace())
+	    return false;
+
+	token.clear();
+	for (;;)
+	{
+	    size_t	start = myPos;
+	    while (myPos < myEnd && !isspace((unsigned char)myBuffer[myPos]))
+		myPos++;
+	    token.append(&myBuffer[start], myPos - start);
+	    if (myPos < myEnd)
+		return true;
+	    fill(1);
+	    if (myPos == myEnd)
+		return true;
+	}
+    }
+
+    bool expect(const char *expected)
+    {
+	std::string	token;
+	if (myError || !readToken(token) || token != expected)
+	    return fail();
+	return true;
+    }
+
+    // Numbers are parsed in place.  A number is far shorter than
+    // theNumberSpace, so topping the buffer up to that many bytes first
+    // means a number is never split across a refill.
+    bool readFloat(float &value)
+    {
+	if (!skipSpace())
+	    return false;
+	fill(theNumberSpace);
+
+	char	*start = &myBuffer[myPos];
+	char	*end;
+	value = strtof(start, &end);
+	if (end == start)
+	    return false;
+	myPos += end - start;
+	return true;
+    }
+
+    bool readInt(int &value)
+    {
+	if (!skipSpace())
+	    return false;
+	fill(theNumberSpace);
+
+	char	*start = &myBuffer[myPos];
+	char	*end;
+	value = (int)strtol(start, &end, 10);
+	if (end == start)
+	    return false;
+	myPos += end - start;
+	return true;
+    }
+
+    static const size_t	theNumberSpace = 256;
+
+    std::istream	&myStream;
+    std::vector<char>	 myBuffer;
+    size_t		 myPos, myEnd;	// The unread part of myBuffer.
+    bool		 myError;
+};
+
+// Writes volumes to a .voxel file, one z slab at a time, in the same
+// form as voxelReader reads.  Values are written with 9 significant
+// digits, which reads back as the same float.
+class voxelWriter
+{
+public:
+    // threads is the maximum number of threads formatting a slab, or 0
+    // for one per core.
+    explicit voxelWriter(std::ostream &os, unsigned threads = 0)
+	: myStream(os), myThreads(threads), myRowsLeft(0), myRowSize(0)
+    {
+    }
+
+    bool open()
+    {
+	myStream << "VOXELS\n";
+	return (bool)myStream;
+    }
+
+    bool beginVolume(const voxelHeader &header)
+    {
+	char	buf[256];
+
+	myStream << "VOLUME " << header.name << "\n";
+	snprintf(buf, sizeof(buf), "%d %d %d\n",
+		 header.res[0], header.res[1], header.res[2]);
+	myStream << buf;
+	snprintf(buf, sizeof(buf), "%.9g %.9g %.9g\n",
+		 header.center[0], header.center[1], header.center[2]);
+	myStream << buf;
+	snprintf(buf, sizeof(buf), "%.9g %.9g %.9g\n",
+		 header.size[0], header.size[1], header.size[2]);
+	myStream << buf;
+	myStream << "{\n";
+
+	myRowSize = header.res[0];
+	myRowsLeft = myRowSize ? (size_t)header.res[1] * header.res[2] : 0;
+	return (bool)myStream;
+    }
+
+    // Writes the next z slab of the current volume, header.slabSize()
+    // values.
+    bool writeSlab(const float *values, size_t count)
+    {
+	size_t	rows = myRowSize ? count / myRowSize : 0;
+	if (rows > myRowsLeft || rows * myRowSize != count)
+	    return false;
+	myRowsLeft -= rows;
+
+	// The rows are split into a few runs per thread, each formatted
+	// into its own buffer, then written in order.
+	size_t	runs = std::min(rows, (size_t)prtio::detail::thread_count(myThreads) * 4);
+	if (runs == 0)
+	    return true;
+	if (myRuns.size() < runs)
+	    myRuns.resize(runs);
+
+	size_t	rowSize = myRowSize;
+	prtio::detail::parallel_for(runs, [&](size_t run)
+	{
+	    std::string	&text = myRuns[run];
+	    char	 buf[32];
+
+	    text.clear();
+	    for (size_t y = rows * run / runs; y < rows * (run + 1) / runs; y++)
+	    {
+		const float	*row = values + y * rowSize;
+
+		text += "    ";
+		for (size_t x = 0; x < rowSize; x++)
+		{
+		    // Fog is mostly empty space, which needn't go through
+		    // snprintf().
+		    if (row[x] == 0 && !signbit(row[x]))
+		    {
+			text += "0 ";
+			continue;
+		    }
+		    int		len = snprintf(buf, sizeof(buf), "%.9g ", row[x]);
+		    text.append(buf, len);
+		}
+		text += "\n";
+	    }
+	}, myThreads);
+
+	for (size_t run = 0; run < runs; run++)
+	    myStream.write(myRuns[run].data(), myRuns[run].size());
+	return (bool)myStream;
+    }
+
+    bool endVolume()
+    {
+	if (myRowsLeft != 0)
+	    return false;
+	myStream << "}\n\n";
+	return (bool)myStream;
+    }
+
+private:
+    std::ostream		&myStream;
+    unsigned			 myThreads;
+    size_t			 myRowsLeft;	// Rows of the volume to come.
+    size_t			 myRowSize;
+    std::vector<std::string>	 myRuns;
+};
+
+enum voxelMipFilter
+{
+    VOXEL_MIP_BOX,	// The average of each 2x2x2 block.
+    VOXEL_MIP_TENT	// A 4x4x4 tent, which aliases less.
+};
+
+// Sets out[i] to the sum of weights[t] * rows[t][i].
+static inline void
+voxelCombineRows(const float *const *rows, const float *weights, int taps,
+		 size_t count, float *out)
+{
+    size_t	i = 0;
+#ifdef PRTIO_USE_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+	__m128	sum = _mm_mul_ps(_mm_loadu_ps(rows[0] + i),
+				 _mm_set1_ps(weights[0]));
+	for (int t = 1; t < taps; t++)
+	    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[t] + i),
+					     _mm_set1_ps(weights[t])));
+	_mm_storeu_ps(out + i, sum);
+    }
+#endif
+    for (; i < count; i++)
+    {
+	float	sum = rows[0][i] * weights[0];
+	for (int t = 1; t < taps; t++)
+	    sum += rows[t][i] * weights[t];
+	out[i] = sum;
+    }
+}
+
+// Halves a row of n values along x into outN = (n + 1) / 2 values,
+// repeating the last value past the end.  The SSE path splits eight
+// values into their even and odd ones and computes the same sums as the
+// scalar one, so the result doesn't depend on where a row starts.
+static inline void
+voxelReduceRow(const float *in, int n, float *out, int outN,
+	       voxelMipFilter filter)
+{
+    int		i = 0;
+
+    if (filter == VOXEL_MIP_BOX)
+    {
+#ifdef PRTIO_USE_SSE2
+	const __m128	half = _mm_set1_ps(0.5f);
+	for (; i + 4 <= outN && 2 * i + 8 <= n; i += 4)
+	{
+	    __m128	a = _mm_loadu_ps(in + 2 * i);
+	    __m128	b = _mm_loadu_ps(in + 2 * i + 4);
+	    __m128	even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	    __m128	odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+	    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(even, odd), half));
+	}
+#endif
+	for (; i < outN; i++)
+	    out[i] = (in[2 * i] + in[std::min(2 * i + 1, n - 1)]) * 0.5f;
+	return;
+    }
+
+    // The tent: (in[2i-1] + in[2i+2]) / 8 + (in[2i] + in[2i+1]) * 3 / 8.
+    for (; i < outN && i < 1; i++)
+	out[i] = (in[0] + in[std::min(2, n - 1)]) * 0.125f
+	       + (in[0] + in[std::min(1, n - 1)]) * 0.375f;
+#ifdef PRTIO_USE_SSE2
+    const __m128	outer = _mm_set1_ps(0.125f);
+    const __m128	inner = _mm_set1_ps(0.375f);
+    for (; i + 4 <= outN && 2 * i + 9 <= n; i += 4)
+    {
+	// From 2i-1, the evens are in[2i-1], in[2i+1]... and the odds
+	// in[2i], in[2i+2]...; from 2i+1, they are one further on.
+	__m128	a = _mm_loadu_ps(in + 2 * i - 1);
+	__m128	b = _mm_loadu_ps(in + 2 * i + 3);
+	__m128	c = _mm_loadu_ps(in + 2 * i + 1);
+	__m128	d = _mm_loadu_ps(in + 2 * i + 5);
+	__m128	before = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	__m128	even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+	__m128	odd = _mm_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0));
+	__m128	after = _mm_shuffle_ps(c, d, _MM_SHUFFLE(3, 1, 3, 1));
+	_mm_storeu_ps(out + i,
+		_mm_add_ps(_mm_mul_ps(_mm_add_ps(before, after), outer),
+			   _mm_mul_ps(_mm_add_ps(even, odd), inner)));
+    }
+#endif
+    for (; i < outN; i++)
+	out[i] = (in[2 * i - 1] + in[std::min(2 * i + 2, n - 1)]) * 0.125f
+	       + (in[2 * i] + in[std::min(2 * i + 1, n - 1)]) * 0.375f;
+}
+
+// Builds the mip chain of a volume as its z slabs go by, so it costs no
+// extra pass over the volume:
+//	voxelMipChain	mips(header, 3, VOXEL_MIP_BOX);
+//	for (int z = 0; z < header.res[2]; z++)
+//	    mips.addSlab(slab);
+//	mips.write(writer);
+// Each level has half the resolution of the one before, rounded up, and
+// the same center and size.  Level n is named name_mipn.
+//
+// Each slab is filtered in y and x as it arrives, on several threads, and
+// a level keeps the last four of those to filter in z.  A finished slab
+// of a level is fed to the next level and spooled to a temporary file
+// until write(), so memory stays bounded by a few slabs however large
+// the volume.
+class voxelMipChain
+{
+public:
+    voxelMipChain(const voxelHeader &header, int levels,
+		  voxelMipFilter filter, unsigned threads = 0)
+	: myFilter(filter), myThreads(threads), myError(false)
+    {
+	myTaps = filter == VOXEL_MIP_BOX ? 2 : 4;
+	myFirst = filter == VOXEL_MIP_BOX ? 0 : -1;
+	if (filter == VOXEL_MIP_BOX)
+	{
+	    myWeights[0] = myWeights[1] = 0.5f;
+	}
+	else
+	{
+	    myWeights[0] = myWeights[3] = 0.125f;
+	    myWeights[1] = myWeights[2] = 0.375f;
+	}
+
+	const voxelHeader	*previous = &header;
+	myLevels.resize(levels > 0 ? levels : 0);
+	for (size_t l = 0; l < myLevels.size(); l++)
+	{
+	    mipLevel	&level = myLevels[l];
+	    char	 suffix[32];
+
+	    snprintf(suffix, sizeof(suffix), "_mip%d", (int)l + 1);
+	    level.header = *previous;
+	    level.header.name = header.name + suffix;
+	    for (int i = 0; i < 3; i++)
+	    {
+		level.inRes[i] = previous->res[i];
+		level.header.res[i] = (previous->res[i] + 1) / 2;
+	    }
+	    level.received = level.produced = 0;
+	    level.spool = tmpfile();
+	    if (!level.spool)
+		myError = true;
+	    previous = &level.header;
+	}
+    }
+
+    ~voxelMipChain()
+    {
+	for (size_t l = 0; l < myLevels.size(); l++)
+	    if (myLevels[l].spool)
+		fclose(myLevels[l].spool);
+    }
+
+    int			 levels() const { return (int)myLevels.size(); }
+    const voxelHeader	&header(int level) const
+			 { return myLevels[level - 1].header; }
+
+    // Adds the next z slab of the full resolution volume.
+    bool addSlab(const float *values)
+    {
+	if (!myError && !myLevels.empty())
+	    addSlab(0, values);
+	return !myError;
+    }
+
+    // Writes the levels, after the full resolution volume has been
+    // written and all its slabs added.
+    bool write(voxelWriter &writer)
+    {
+	std::vector<float>	slab;
+
+	for (size_t l = 0; l < myLevels.size() && !myError; l++)
+	{
+	    mipLevel	&level = myLevels[l];
+
+	    if (level.produced != level.header.res[2] ||
+		!writer.beginVolume(level.header))
+		return false;
+
+	    rewind(level.spool);
+	    slab.resize(level.header.slabSize());
+	    for (int z = 0; z < level.header.res[2]; z++)
+	    {
+		if (!slab.empty() &&
+		    fread(&slab[0], sizeof(float), slab.size(), level.spool) != slab.size())
+		    return false;
+		if (!writer.writeSlab(slab.data(), slab.size()))
+		    return false;
+	    }
+
+	    if (!writer.endVolume())
+		return false;
+	}
+	return !myError;
+    }
+
+private:
+    voxelMipChain(const voxelMipChain &);
+    voxelMipChain &operator=(const voxelMipChain &);
+
+    struct mipLevel
+    {
+	voxelHeader		 header;	// Of the level's output.
+	int			 inRes[3];	// Of the level before.
+	std::vector<float>	 window[4];	// Input slab z, filtered in
+						// y and x, is window[z & 3].
+	std::vector<float>	 slab;		// The last output slab.
+	int			 received, produced;
+	FILE			*spool;
+    };
+
+    // The input slab or row feeding tap t of output index i.
+    int tap(int i, int t, int n) const
+    {
+	return std::max(0, std::min(2 * i + myFirst + t, n - 1));
+    }
+
+    size_t runs(size_t count) const
+    {
+	return std::min(count, (size_t)prtio::detail::thread_count(myThreads) * 4);
+    }
+
+    void addSlab(size_t l, const float *values)
+    {
+	mipLevel		&level = myLevels[l];
+	const int		 rx = level.inRes[0], ry = level.inRes[1];
+	const int		 ox = level.header.res[0], oy = level.header.res[1];
+	std::vector<float>	&filtered = level.window[level.received & 3];
+
+	// Filter in y, then x, a few runs of output rows per thread.
+	filtered.resize(level.header.slabSize());
+	size_t	yRuns = runs(oy);
+	prtio::detail::parallel_for(yRuns, [&](size_t run)
+	{
+	    std::vector<float>	row(rx);
+	    const float		*rows[4];
+
+	    for (size_t y = oy * run / yRuns; y < oy * (run + 1) / yRuns; y++)
+	    {
+		for (int t = 0; t < myTaps; t++)
+		    rows[t] = values + (size_t)tap((int)y, t, ry) * rx;
+		voxelCombineRows(rows, myWeights, myTaps, rx, row.data());
+		voxelReduceRow(row.data(), rx, &filtered[y * ox], ox, myFilter);
+	    }
+	}, myThreads);
+
+	int	z = level.received++;
+
+	// Filter in z as soon as the last slab an output slab needs is in.
+	while (level.produced < level.header.res[2] &&
+	       tap(level.produced, myTaps - 1, level.inRes[2]) <= z)
+	{
+	    const float	*slabs[4];
+	    for (int t = 0; t < myTaps; t++)
+		slabs[t] = level.window[tap(level.produced, t, level.inRes[2]) & 3].data();
+
+	    size_t	size = level.header.slabSize();
+	    size_t	zRuns = runs(size / 4096 + 1);
+	    level.slab.resize(size);
+	    prtio::detail::parallel_for(zRuns, [&](size_t run)
+	    {
+		size_t		 begin = size * run / zRuns;
+		const float	*shifted[4];
+
+		for (int t = 0; t < myTaps; t++)
+		    shifted[t] = slabs[t] + begin;
+		voxelCombineRows(shifted, myWeights, myTaps,
+				 size * (run + 1) / zRuns - begin,
+				 level.slab.data() + begin);
+	    }, myThreads);
+
+	    level.produced++;
+	    if (fwrite(level.slab.data(), sizeof(float), size, level.spool) != size)
+	    {
+		myError = true;
+		return;
+	    }
+	    if (l + 1 < myLevels.size())
+		addSlab(l + 1, level.slab.data());
+	}
+    }
+
+    std::vector<mipLevel>	 myLevels;
+    voxelMipFilter		 myFilter;
+    float			 myWeights[4];
+    int				 myTaps, myFirst;
+    unsigned			 myThreads;
+    bool			 myError;
+};
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstring>
 #include <prtio/detail/data_types.hpp>
 
@@ -216,5 +217,79 @@ namespace detail{
 		}
 	}
 
+	/**
+	 * Gets a converter when both types are only known at runtime.
+	 * @param destType The PRT IO type of the destination data.
+	 * @param srcType The PRT IO type of the source data.
+	 * @return A function pointer to a function that converts from 'srcType' to 'destType'. NULL if either type is not known.
+	 */
+	inline convert_fn_t get_converter( data_types::enum_t destType, data_types::enum_t srcType ){
+		switch( srcType ){
+		case data_types::type_int8:
+			return get_write_converter<data_types::int8_t>( destType );
+		case data_types::type_int16:
+			return get_write_converter<data_types::int16_t>( destType );
+		case data_types::type_int32:
+			return get_write_converter<data_types::int32_t>( destType );
+		case data_types::type_int64:
+			return get_write_converter<data_types::int64_t>( destType );
+		case data_types::type_float16:
+			return get_write_converter<data_types::float16_t>( destType );
+		case data_types::type_float32:
+			return get_write_converter<data_types::float32_t>( destType );
+		case data_types::type_float64:
+			return get_write_converter<data_types::float64_t>( destType );
+		case data_types::type_uint8:
+			return get_write_converter<data_types::uint8_t>( destType );
+		case data_types::type_uint16:
+			return get_write_converter<data_types::uint16_t>( destType );
+		case data_types::type_uint32:
+			return get_write_converter<data_types::uint32_t>( destType );
+		case data_types::type_uint64:
+			return get_write_converter<data_types::uint64_t>( destType );
+		default:
+			return NULL;
+		}
+	}
+
+	/**
+	 * Finds a type that both 'a' and 'b' can be converted to without losing information, for combining channels of
+	 * the same name that are stored differently in different files.
+	 * @return The common type, or type_count if there is none (ex. uint64 and any signed type).
+	 */
+	inline data_types::enum_t common_type( data_types::enum_t a, data_types::enum_t b ){
+		//is_compatible() allows any float conversion, so floats are widened to the larger of the two explicitly.
+		if( is_float( a ) && is_float( b ) )
+			return data_types::sizes[a] >= data_types::sizes[b] ? a : b;
+
+		if( is_compatible( a, b ) )
+			return a;
+		if( is_compatible( b, a ) )
+			return b;
+
+		//Integers of up to 16 bits are exact in float32, anything wider needs float64.
+		if( is_float( a ) != is_float( b ) ){
+			data_types::enum_t intType = is_float( a ) ? b : a;
+			return data_types::sizes[intType] <= 2 ? common_type( data_types::type_float32, is_float( a ) ? a : b ) : data_types::type_float64;
+		}
+
+		//Mixed signed and unsigned integers need a signed type wider than the unsigned one.
+		std::size_t size = std::max( data_types::sizes[a], data_types::sizes[b] );
+		data_types::enum_t unsignedType = is_signed( a ) ? b : a;
+		if( data_types::sizes[unsignedType] == size )
+			size *= 2;
+
+		switch( size ){
+		case 2:
+			return data_types::type_int16;
+		case 4:
+			return data_types::type_int32;
+		case 8:
+			return data_types::type_int64;
+		default:
+			return data_types::type_count;
+		}
+	}
+
 }//namespace detail
 }//namespace prtio
\ No newline at end of file
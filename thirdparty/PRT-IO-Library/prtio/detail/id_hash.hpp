@@ -0,0 +1,116 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a hash table from particle IDs to the particles' positions in a table.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * This class maps particle IDs to row numbers. It is built once and then only queried, so it uses open addressing
+	 * with linear probing in two flat arrays, at most half full, which keeps a lookup to one or two cache lines.
+	 * Queries don't modify the table, so any number of threads may make them at once.
+	 */
+	class id_hash{
+		std::vector<data_types::int64_t> m_keys;
+		std::vector<std::size_t> m_rows; //The row for each key, or npos for an empty slot.
+		std::size_t m_mask;
+		std::size_t m_size;
+
+		std::size_t slot( data_types::int64_t id ) const {
+			//Fibonacci hashing spreads the sequential IDs that simulations hand out.
+			data_types::uint64_t h = static_cast<data_types::uint64_t>( id ) * 0x9E3779B97F4A7C15ull;
+			return static_cast<std::size_t>( h ^ ( h >> 32 ) ) & m_mask;
+		}
+
+	public:
+		static const std::size_t npos = static_cast<std::size_t>( -1 );
+
+		id_hash() : m_mask( 0 ), m_size( 0 )
+		{}
+
+		/**
+		 * Builds the table from one ID per row.
+		 * @param ids The IDs, where ids[i] belongs to row i.
+		 * @param count The number of rows.
+		 * @return The number of rows whose ID repeated an earlier row's. Only the first row with an ID is found.
+		 */
+		std::size_t build( const data_types::int64_t* ids, std::size_t count ){
+			std::size_t capacity = 16;
+			while( capacity < 2 * count )
+				capacity *= 2;
+
+			m_keys.assign( capacity, 0 );
+			m_rows.assign( capacity, static_cast<std::size_t>( npos ) ); //A copy, since npos has no definition to bind a reference to.
+			m_mask = capacity - 1;
+			m_size = 0;
+
+			std::size_t duplicates = 0;
+			for( std::size_t i = 0; i < count; ++i ){
+				std::size_t s = slot( ids[i] );
+				while( m_rows[s] != npos && m_keys[s] != ids[i] )
+					s = ( s + 1 ) & m_mask;
+
+				if( m_rows[s] != npos ){
+					++duplicates;
+					continue;
+				}
+
+				m_keys[s] = ids[i];
+				m_rows[s] = i;
+				++m_size;
+			}
+
+			return duplicates;
+		}
+
+		/**
+		 * @return The row with the ID, or npos if there isn't one.
+		 */
+		std::size_t find( data_types::int64_t id ) const {
+			if( m_size == 0 )
+				return npos;
+
+			for( std::size_t s = slot( id ); m_rows[s] != npos; s = ( s + 1 ) & m_mask ){
+				if( m_keys[s] == id )
+					return m_rows[s];
+			}
+			return npos;
+		}
+
+		/**
+		 * @return The number of distinct IDs in the table.
+		 */
+		std::size_t size() const {
+			return m_size;
+		}
+
+		/**
+		 * @return The memory held by the table, in bytes.
+		 */
+		std::size_t memory_usage() const {
+			return m_keys.capacity() * sizeof(data_types::int64_t) + m_rows.capacity() * sizeof(std::size_t);
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
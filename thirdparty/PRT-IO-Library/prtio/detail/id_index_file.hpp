@@ -0,0 +1,184 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the on-disk format of the ID index sidecar files (.prtidx) that sit next to PRT files.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * This struct marks a place in a PRT file's compressed data where decompression can start afresh, because the
+	 * writer reset the compressor's history there (ex. with Z_FULL_FLUSH). Raw inflate (no zlib header) started at
+	 * 'offset' decodes particles from 'particle' onwards.
+	 */
+	struct resume_point{
+		data_types::int64_t particle; //The index of the first particle decoded from this point.
+		data_types::int64_t offset;   //The file offset of the raw deflate data.
+	};
+
+	/**
+	 * This struct is one particle's entry in an ID index.
+	 */
+	struct id_entry{
+		data_types::int64_t id;
+		data_types::int64_t particle; //The index of the particle in the file.
+
+		bool operator<( const id_entry& rhs ) const {
+			return id < rhs.id || ( id == rhs.id && particle < rhs.particle );
+		}
+	};
+
+	/**
+	 * This struct holds the contents of an ID index sidecar. The file is laid out as:
+	 *   char[8]  "PRTIDX1" and a NUL
+	 *   int64    The size of the PRT file in bytes.
+	 *   uint32   The adler32 of the PRT file's particle data, from its zlib trailer.
+	 *   uint32   Zero.
+	 *   int64    The number of particles in the PRT file.
+	 *   char[32] The name of the ID channel, NUL padded.
+	 *   int64    The number of resume points, then each as two int64 (particle, offset), in particle order.
+	 *   int64    The number of entries, then each as two int64 (id, particle), sorted by id then particle.
+	 * Values are little endian, like the PRT header. The size, checksum and count tie the index to one version of the
+	 * PRT file, so an index left behind by a file that was since rewritten is detected as stale.
+	 */
+	struct id_index_file{
+		data_types::int64_t fileSize;
+		data_types::uint32_t adler;
+		data_types::int64_t particleCount;
+		std::string idChannel;
+		std::vector<resume_point> points;
+		std::vector<id_entry> entries;
+
+		id_index_file() : fileSize( 0 ), adler( 0 ), particleCount( 0 )
+		{}
+
+		/**
+		 * @return The path of the index for a PRT file, which is the same path with ".prtidx" appended.
+		 */
+		static std::string path_for( const std::string& prtFile ){
+			return prtFile + ".prtidx";
+		}
+
+		void save( const std::string& path ) const {
+			std::ofstream fout( path.c_str(), std::ios::out | std::ios::binary );
+			if( fout.fail() )
+				throw std::ios_base::failure( "Failed to open the ID index \"" + path + "\" for writing" );
+
+			char magic[8] = { 'P', 'R', 'T', 'I', 'D', 'X', '1', '\0' };
+			char channel[32];
+			memset( channel, 0, sizeof(channel) );
+			strncpy( channel, idChannel.c_str(), sizeof(channel) - 1 );
+
+			data_types::uint32_t reserved = 0;
+			data_types::int64_t numPoints = static_cast<data_types::int64_t>( points.size() );
+			data_types::int64_t numEntries = static_cast<data_types::int64_t>( entries.size() );
+
+			fout.write( magic, 8 );
+			fout.write( reinterpret_cast<const char*>( &fileSize ), 8 );
+			fout.write( reinterpret_cast<const char*>( &adler ), 4 );
+			fout.write( reinterpret_cast<const char*>( &reserved ), 4 );
+			fout.write( reinterpret_cast<const char*>( &particleCount ), 8 );
+			fout.write( channel, 32 );
+			fout.write( reinterpret_cast<const char*>( &numPoints ), 8 );
+			if( numPoints > 0 )
+				fout.write( reinterpret_cast<const char*>( &points[0] ), sizeof(resume_point) * points.size() );
+			fout.write( reinterpret_cast<const char*>( &numEntries ), 8 );
+			if( numEntries > 0 )
+				fout.write( reinterpret_cast<const char*>( &entries[0] ), sizeof(id_entry) * entries.size() );
+
+			fout.close();
+			if( fout.fail() )
+				throw std::ios_base::failure( "Failed to write the ID index \"" + path + "\"" );
+		}
+
+		void load( const std::string& path ){
+			std::ifstream fin( path.c_str(), std::ios::in | std::ios::binary );
+			if( fin.fail() )
+				throw std::ios_base::failure( "Failed to open the ID index \"" + path + "\"" );
+
+			char magic[8], channel[33];
+			data_types::uint32_t reserved;
+			data_types::int64_t numPoints = 0, numEntries = 0;
+
+			fin.read( magic, 8 );
+			if( !fin || memcmp( magic, "PRTIDX1", 8 ) != 0 )
+				throw std::runtime_error( "The file \"" + path + "\" is not a PRT ID index" );
+
+			fin.read( reinterpret_cast<char*>( &fileSize ), 8 );
+			fin.read( reinterpret_cast<char*>( &adler ), 4 );
+			fin.read( reinterpret_cast<char*>( &reserved ), 4 );
+			fin.read( reinterpret_cast<char*>( &particleCount ), 8 );
+			fin.read( channel, 32 );
+			channel[32] = '\0';
+			idChannel = channel;
+
+			fin.read( reinterpret_cast<char*>( &numPoints ), 8 );
+			if( !fin || numPoints < 0 || numPoints > particleCount + 1 )
+				throw std::runtime_error( "The ID index \"" + path + "\" is corrupt" );
+			points.resize( static_cast<std::size_t>( numPoints ) );
+			if( numPoints > 0 )
+				fin.read( reinterpret_cast<char*>( &points[0] ), sizeof(resume_point) * points.size() );
+
+			fin.read( reinterpret_cast<char*>( &numEntries ), 8 );
+			if( !fin || numEntries < 0 || numEntries > particleCount )
+				throw std::runtime_error( "The ID index \"" + path + "\" is corrupt" );
+			entries.resize( static_cast<std::size_t>( numEntries ) );
+			if( numEntries > 0 )
+				fin.read( reinterpret_cast<char*>( &entries[0] ), sizeof(id_entry) * entries.size() );
+
+			if( !fin || points.empty() )
+				throw std::runtime_error( "The ID index \"" + path + "\" is truncated" );
+		}
+
+		/**
+		 * Reads the fingerprint of a PRT file: its size, and the adler32 in the trailer of its zlib stream.
+		 * @return False if the file can't be read.
+		 */
+		static bool fingerprint( const std::string& prtFile, data_types::int64_t& size, data_types::uint32_t& adler ){
+			std::ifstream fin( prtFile.c_str(), std::ios::in | std::ios::binary );
+			fin.seekg( 0, std::ios::end );
+			size = static_cast<data_types::int64_t>( fin.tellg() );
+			if( !fin || size < 4 )
+				return false;
+
+			unsigned char trailer[4];
+			fin.seekg( -4, std::ios::end );
+			fin.read( reinterpret_cast<char*>( trailer ), 4 );
+			adler = ( static_cast<data_types::uint32_t>( trailer[0] ) << 24 ) | ( static_cast<data_types::uint32_t>( trailer[1] ) << 16 ) | ( static_cast<data_types::uint32_t>( trailer[2] ) << 8 ) | trailer[3];
+			return !fin.fail();
+		}
+
+		/**
+		 * @return True if the index was made for the current contents of the PRT file.
+		 */
+		bool matches( const std::string& prtFile ) const {
+			data_types::int64_t size;
+			data_types::uint32_t fileAdler;
+			return fingerprint( prtFile, size, fileAdler ) && size == fileSize && fileAdler == adler;
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
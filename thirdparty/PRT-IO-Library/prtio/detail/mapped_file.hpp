@@ -0,0 +1,120 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a read only view of a whole file, memory mapped where the platform allows it.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * This class holds the contents of a file for reading. On POSIX systems the file is memory mapped, so opening it
+	 * costs nothing until pages are touched and several processes share the same pages. Elsewhere the file is read
+	 * into memory. The data is at least 8 byte aligned.
+	 */
+	class mapped_file{
+		const char* m_data;
+		std::size_t m_size;
+		std::vector<data_types::int64_t> m_copy; //The file's contents when it couldn't be mapped, as int64 for alignment.
+
+		mapped_file( const mapped_file& );
+		mapped_file& operator=( const mapped_file& );
+
+	public:
+		mapped_file() : m_data( NULL ), m_size( 0 )
+		{}
+
+		~mapped_file(){
+			close();
+		}
+
+		void open( const std::string& path ){
+			close();
+
+#ifndef _WIN32
+			int fd = ::open( path.c_str(), O_RDONLY );
+			if( fd < 0 )
+				throw std::ios_base::failure( "Failed to open \"" + path + "\"" );
+
+			struct stat st;
+			if( fstat( fd, &st ) != 0 ){
+				::close( fd );
+				throw std::ios_base::failure( "Failed to read the size of \"" + path + "\"" );
+			}
+
+			m_size = static_cast<std::size_t>( st.st_size );
+			if( m_size > 0 ){
+				void* p = mmap( NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+				if( p != MAP_FAILED )
+					m_data = static_cast<const char*>( p );
+			}
+			::close( fd );
+
+			if( m_data || m_size == 0 )
+				return;
+#endif
+
+			std::ifstream fin( path.c_str(), std::ios::in | std::ios::binary );
+			if( fin.fail() )
+				throw std::ios_base::failure( "Failed to open \"" + path + "\"" );
+
+			fin.seekg( 0, std::ios::end );
+			m_size = static_cast<std::size_t>( fin.tellg() );
+			fin.seekg( 0, std::ios::beg );
+
+			m_copy.resize( ( m_size + 7 ) / 8 );
+			if( m_size > 0 )
+				fin.read( reinterpret_cast<char*>( &m_copy[0] ), m_size );
+			if( fin.fail() )
+				throw std::ios_base::failure( "Failed to read \"" + path + "\"" );
+			m_data = m_copy.empty() ? NULL : reinterpret_cast<const char*>( &m_copy[0] );
+		}
+
+		void close(){
+#ifndef _WIN32
+			if( m_data && m_copy.empty() )
+				munmap( const_cast<char*>( m_data ), m_size );
+#endif
+			m_data = NULL;
+			m_size = 0;
+			std::vector<data_types::int64_t>().swap( m_copy );
+		}
+
+		const char* data() const {
+			return m_data;
+		}
+
+		std::size_t size() const {
+			return m_size;
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
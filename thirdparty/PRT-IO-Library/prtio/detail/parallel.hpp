@@ -0,0 +1,198 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the minimal thread pool helpers used by the multi-file tools.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * @return The number of threads to use when the caller asked for 'requested' (0 meaning one per core).
+	 */
+	inline unsigned thread_count( unsigned requested ){
+		if( requested == 0 )
+			requested = std::thread::hardware_concurrency();
+		return std::max( requested, 1u );
+	}
+
+	/**
+	 * Calls fn(i) for every i in [0, count), spreading the calls over a set of threads. Work items are handed out one at
+	 * a time, so items of very different cost (ex. files of different sizes) still balance. If any call throws, the
+	 * remaining items are skipped and the first exception is rethrown on the calling thread.
+	 * @tparam Fn A callable as void fn( std::size_t index ).
+	 * @param count The number of work items.
+	 * @param fn The function to call for each item. It is called concurrently from several threads.
+	 * @param threads The maximum number of threads to use, or 0 for one per core.
+	 */
+	template <class Fn>
+	void parallel_for( std::size_t count, Fn fn, unsigned threads = 0 ){
+		threads = static_cast<unsigned>( std::min<std::size_t>( thread_count( threads ), count ) );
+
+		if( threads <= 1 ){
+			for( std::size_t i = 0; i < count; ++i )
+				fn( i );
+			return;
+		}
+
+		std::atomic<std::size_t> next( 0 );
+		std::exception_ptr error;
+		std::mutex errorMutex;
+
+		std::vector<std::thread> pool;
+		pool.reserve( threads );
+		for( unsigned t = 0; t < threads; ++t ){
+			pool.push_back( std::thread( [&](){
+				for( std::size_t i = next++; i < count; i = next++ ){
+					try{
+						fn( i );
+					}catch( ... ){
+						std::lock_guard<std::mutex> lock( errorMutex );
+						if( !error )
+							error = std::current_exception();
+						next = count;
+					}
+				}
+			} ) );
+		}
+
+		for( std::vector<std::thread>::iterator it = pool.begin(), itEnd = pool.end(); it != itEnd; ++it )
+			it->join();
+
+		if( error )
+			std::rethrow_exception( error );
+	}
+
+	/**
+	 * This class runs jobs on a fixed set of threads. The queue holds a bounded number of jobs, and push() blocks while
+	 * it is full, so a producer that allocates a buffer per job can't run ahead of the workers and exhaust memory.
+	 * If a job throws, later jobs are discarded and the exception is rethrown from the next push() or wait().
+	 */
+	class work_queue{
+		std::vector<std::thread> m_threads;
+		std::deque< std::function<void()> > m_jobs;
+		std::size_t m_capacity; //The maximum number of jobs waiting in m_jobs.
+		std::size_t m_running;  //The number of jobs currently executing.
+		bool m_stop;
+		std::exception_ptr m_error;
+
+		std::mutex m_mutex;
+		std::condition_variable m_jobReady, m_spaceReady, m_idle;
+
+		void worker(){
+			std::unique_lock<std::mutex> lock( m_mutex );
+			for( ;; ){
+				while( !m_stop && m_jobs.empty() )
+					m_jobReady.wait( lock );
+				if( m_jobs.empty() )
+					return;
+
+				std::function<void()> job;
+				job.swap( m_jobs.front() );
+				m_jobs.pop_front();
+				++m_running;
+				m_spaceReady.notify_one();
+
+				lock.unlock();
+				try{
+					job();
+				}catch( ... ){
+					lock.lock();
+					if( !m_error )
+						m_error = std::current_exception();
+					m_jobs.clear();
+					m_spaceReady.notify_all();
+					lock.unlock();
+				}
+				job = std::function<void()>(); //Release whatever the job captured before reporting it done.
+				lock.lock();
+
+				if( --m_running == 0 && m_jobs.empty() )
+					m_idle.notify_all();
+			}
+		}
+
+		void rethrow_error(){
+			if( m_error ){
+				std::exception_ptr error = m_error;
+				m_error = std::exception_ptr();
+				std::rethrow_exception( error );
+			}
+		}
+
+	public:
+		/**
+		 * @param threads The number of worker threads, or 0 for one per core.
+		 * @param capacity The number of jobs that may wait in the queue, or 0 for twice the number of threads.
+		 */
+		explicit work_queue( unsigned threads = 0, std::size_t capacity = 0 ) : m_running( 0 ), m_stop( false ) {
+			threads = thread_count( threads );
+			m_capacity = ( capacity > 0 ) ? capacity : 2 * threads;
+
+			m_threads.reserve( threads );
+			for( unsigned i = 0; i < threads; ++i )
+				m_threads.push_back( std::thread( &work_queue::worker, this ) );
+		}
+
+		/**
+		 * Finishes the jobs already queued, then stops the threads. Errors are discarded, so call wait() first.
+		 */
+		~work_queue(){
+			{
+				std::lock_guard<std::mutex> lock( m_mutex );
+				m_stop = true;
+			}
+			m_jobReady.notify_all();
+
+			for( std::vector<std::thread>::iterator it = m_threads.begin(), itEnd = m_threads.end(); it != itEnd; ++it )
+				it->join();
+		}
+
+		/**
+		 * Queues a job, blocking while the queue is full.
+		 */
+		void push( const std::function<void()>& job ){
+			std::unique_lock<std::mutex> lock( m_mutex );
+			while( !m_error && m_jobs.size() >= m_capacity )
+				m_spaceReady.wait( lock );
+			rethrow_error();
+
+			m_jobs.push_back( job );
+			m_jobReady.notify_one();
+		}
+
+		/**
+		 * Blocks until every queued job has finished.
+		 */
+		void wait(){
+			std::unique_lock<std::mutex> lock( m_mutex );
+			while( m_running > 0 || !m_jobs.empty() )
+				m_idle.wait( lock );
+			rethrow_error();
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
@@ -19,6 +19,16 @@
 #pragma once
 
 #include <prtio/detail/data_types.hpp>
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_metadata.hpp>
+
+#include <cstring>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace prtio{
 
@@ -54,6 +64,225 @@ namespace detail{
 	const char* prt_signature_string(){
 		return "Extensible Particle Format";
 	}
+
+	//Version 2 files follow the channel table with a sequence of chunks, each a four character code and a 32 bit length,
+	//ending with a "Stop" chunk. A "Meta" chunk holds one metadata value: the null terminated channel name (empty for
+	//file level values), the null terminated value name, the 32 bit data type and then the elements of the value.
+	typedef std::map<prt_metadata::key_type, std::ostream::pos_type> metadata_locations;
+
+	inline bool is_chunk( const char* code, const char* expected ){
+		return strncmp( code, expected, 4 ) == 0;
+	}
+
+	/**
+	 * Writes the metadata chunks of a version 2 header, ending with the "Stop" chunk.
+	 * @param locations If not NULL, receives the position in 'out' of the data of each value, so values whose size is
+	 *                  fixed in advance (ex. a bounding box) can be patched once the particles have been written.
+	 */
+	inline void write_prt_metadata( std::ostream& out, const prt_metadata& metadata, metadata_locations* locations ){
+		for( prt_metadata::const_iterator it = metadata.begin(), itEnd = metadata.end(); it != itEnd; ++it ){
+			const std::string& channel = it->first.first;
+			const std::string& name = it->first.second;
+			const prt_metadata::value& v = it->second;
+
+			prt_int32 length = static_cast<prt_int32>( channel.size() + 1 + name.size() + 1 + 4 + v.data.size() );
+			out.write( "Meta", 4 );
+			out.write( reinterpret_cast<const char*>( &length ), 4 );
+			out.write( channel.c_str(), channel.size() + 1 );
+			out.write( name.c_str(), name.size() + 1 );
+			out.write( reinterpret_cast<const char*>( &v.rawType ), 4 );
+
+			if( locations )
+				(*locations)[it->first] = out.tellp();
+			if( !v.data.empty() )
+				out.write( &v.data[0], v.data.size() );
+		}
+
+		prt_int32 stopLength = 0;
+		out.write( "Stop", 4 );
+		out.write( reinterpret_cast<const char*>( &stopLength ), 4 );
+	}
+
+	/**
+	 * Reads the chunks of a version 2 header, up to and including the "Stop" chunk. Chunks of unknown types are skipped.
+	 */
+	inline void read_prt_metadata( std::istream& in, const std::string& streamName, prt_metadata& metadata ){
+		std::vector<char> chunk;
+		for( ;; ){
+			char code[4];
+			prt_int32 length;
+			in.read( code, 4 );
+			in.read( reinterpret_cast<char*>( &length ), 4 );
+			if( !in || length < 0 )
+				throw std::runtime_error( "The input stream \"" + streamName + "\" has a corrupt metadata section." );
+
+			if( is_chunk( code, "Stop" ) ){
+				in.seekg( length, std::ios::cur );
+				return;
+			}
+
+			if( !is_chunk( code, "Meta" ) ){
+				in.seekg( length, std::ios::cur );
+				continue;
+			}
+
+			chunk.resize( static_cast<std::size_t>( length ) + 1 );
+			in.read( &chunk[0], length );
+			chunk[ static_cast<std::size_t>( length ) ] = '\0'; //Guarantees the name scans below terminate.
+
+			const char* it = &chunk[0];
+			const char* itEnd = it + length;
+			std::string channel( it );
+			it += channel.size() + 1;
+			std::string name( it < itEnd ? it : "" );
+			it += name.size() + 1;
+
+			if( !in || it + 4 > itEnd )
+				throw std::runtime_error( "The input stream \"" + streamName + "\" has a corrupt metadata chunk." );
+
+			prt_int32 type;
+			memcpy( &type, it, 4 );
+			it += 4;
+
+			metadata.set_raw( prt_metadata::key_type( channel, name ), type, it, static_cast<std::size_t>( itEnd - it ) );
+		}
+	}
+
+	/**
+	 * Writes the uncompressed header of a PRT file, which ends where the compressed particle data begins.
+	 * @param out The stream to write to, positioned at the start of the file.
+	 * @param layout The layout of the particles that will follow.
+	 * @param particleCount The number of particles, or -1 if it will be patched in once known.
+	 * @param metadata If not NULL and not empty, a version 2 header is written with these values.
+	 * @param locations See write_prt_metadata().
+	 * @return The position of the particle count in 'out', for seeking back to patch it.
+	 */
+	inline std::ostream::pos_type write_prt_header( std::ostream& out, const prt_layout& layout, prt_int64 particleCount, const prt_metadata* metadata = NULL, metadata_locations* locations = NULL ){
+		const bool hasMetadata = ( metadata != NULL && !metadata->empty() );
+
+		// Write the main header data
+		prt_header_v1 header;
+		memset( &header, 0, sizeof(prt_header_v1) );
+
+		header.magicNumber = prt_magic_number();
+		header.headerLength = sizeof(prt_header_v1);
+		strncpy(header.fmtIdentStr, prt_signature_string(), 32);
+		header.version = hasMetadata ? 2 : 1;
+		header.particleCount = particleCount;
+
+		std::ostream::pos_type countLocation = ((char*)&header.particleCount - (char*)&header) + out.tellp(); //This is where we need to seek to in order to write the particle count at the end.
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(prt_header_v1));
+
+		// Write the reserved bytes
+		prt_int32 reservedInt = 4;
+		out.write(reinterpret_cast<const char*>(&reservedInt), 4);
+
+		// Write the channel map
+		prt_channel_header_v1 prtChannel;
+
+		prt_int32 channelCount = static_cast<prt_int32>( layout.num_channels() );
+		prt_int32 channelHeaderItemSize = sizeof(prt_channel_header_v1);
+
+		out.write(reinterpret_cast<const char*>(&channelCount), 4);
+		out.write(reinterpret_cast<const char*>(&channelHeaderItemSize), 4);
+
+		for( int i = 0; i < channelCount; ++i ) {
+			memset( &prtChannel, 0, sizeof(prt_channel_header_v1) );
+
+			std::string chName = layout.get_channel_name( static_cast<std::size_t>(i) );
+
+			const detail::prt_channel& ch = layout.get_channel( chName );
+
+			strncpy( prtChannel.channelName, chName.c_str(), 32 );
+			prtChannel.channelArity = (prt_int32)ch.arity;
+			prtChannel.channelType = (prt_int32)ch.type;
+			prtChannel.channelOffset = (prt_int32)ch.offset;
+
+			out.write(reinterpret_cast<const char*>(&prtChannel), sizeof(prt_channel_header_v1));
+		}
+
+		if( hasMetadata )
+			write_prt_metadata( out, *metadata, locations );
+
+		return countLocation;
+	}
+
+	/**
+	 * Reads the uncompressed header portion of a PRT file and leaves the read pointer of 'in' at the beginning of the
+	 * compressed particle data.
+	 * @param in The stream to read from, positioned at the start of the file.
+	 * @param streamName The name of the stream, for error messages.
+	 * @param layout Receives the layout of the particle data after being decompressed. It should be empty.
+	 * @param metadata If not NULL, receives the metadata of a version 2 file.
+	 * @param allowUnfinished If true, a file that is still being written (whose count hasn't been patched) is accepted.
+	 * @return The number of particles in the file, or -1 for an unfinished file.
+	 */
+	inline prt_int64 read_prt_header( std::istream& in, const std::string& streamName, prt_layout& layout, prt_metadata* metadata = NULL, bool allowUnfinished = false ){
+
+		prt_header_v1 header;
+		in.read(reinterpret_cast<char*>(&header), sizeof(prt_header_v1));
+
+		//This is not a prt file (as opposed to a corrupt prt file);
+		if( header.magicNumber != prt_magic_number() )
+			throw std::runtime_error( "The input stream \"" + streamName + "\" did not contain the .prt file magic number." );
+
+		//This is not a prt file (as opposed to a corrupt prt file);
+		if( strncmp(prt_signature_string(), header.fmtIdentStr, 32) != 0 )
+			throw std::runtime_error( "The input stream \"" + streamName + "\" did not contain the signature string '" + prt_signature_string() + "'." );
+
+		if( header.particleCount < 0 && !allowUnfinished )
+			throw std::runtime_error( "The input stream \"" + streamName + "\" was not closed correctly and reported negative particles within." );
+
+		// Skip parts of the file header which may have been added since the first version of the .prt format
+		if( header.headerLength != sizeof(prt_header_v1) )
+			in.seekg(header.headerLength - sizeof(prt_header_v1), std::ios::cur);
+
+		prt_int32 attrLength;
+		in.read(reinterpret_cast<char*>(&attrLength), 4);
+
+		if( attrLength != 4 )
+			throw std::runtime_error( "The reserved int value is not set to 4." );
+
+		prt_int32 channelCount, perChannelLength;
+		in.read(reinterpret_cast<char*>(&channelCount), 4);
+		in.read(reinterpret_cast<char*>(&perChannelLength), 4);
+
+		for(int i = 0; i < channelCount; ++i){
+			prt_channel_header_v1 channel;
+			in.read(reinterpret_cast<char*>(&channel), sizeof(prt_channel_header_v1));
+
+			// Make sure the channel name is null terminated
+			channel.channelName[31] = '\0';
+
+			if( channel.channelType < 0 || channel.channelType >= data_types::type_count )
+				throw std::runtime_error( std::string() + "The data type specified in channel \"" + channel.channelName + "\" in the input stream \"" + streamName + "\" is not valid." );
+
+			if( channel.channelArity < 0 )
+				throw std::runtime_error( std::string() + "The arity specified in channel \"" + channel.channelName + "\" in the input stream \"" + streamName + "\" is not valid." );
+
+			if( channel.channelOffset < 0 )
+				throw std::runtime_error( std::string() + "The offset specified in channel \"" + channel.channelName + "\" in the input stream \"" + streamName + "\" is not valid." );
+
+			layout.add_channel(
+				std::string( channel.channelName ),
+				static_cast<data_types::enum_t>( channel.channelType ),
+				static_cast<std::size_t>( channel.channelArity ),
+				static_cast<std::size_t>( channel.channelOffset )
+			);
+
+			if( perChannelLength != sizeof(prt_channel_header_v1) )
+				in.seekg(perChannelLength - sizeof(prt_channel_header_v1), std::ios::cur);	//Skip unknown parts of the channel header
+		}
+
+		//The metadata chunks have to be read even if the caller doesn't want them, to find the particle data.
+		if( header.version >= 2 ){
+			prt_metadata ignored;
+			read_prt_metadata( in, streamName, metadata ? *metadata : ignored );
+		}
+	
+		return ( header.particleCount < 0 ) ? -1 : header.particleCount;
+	}
 }//namespace detail
 
 }//namespace prtio
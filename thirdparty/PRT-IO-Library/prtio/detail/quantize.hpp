@@ -0,0 +1,347 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the conversion between floating point channels and the fixed point form they are stored in when
+ * a file is written with prt_ofstream::set_quantization().
+ */
+
+#pragma once
+
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_metadata.hpp>
+#include <prtio/detail/conversion.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * The bounds and error a caller asked for on one channel, before the file layout is known.
+	 */
+	struct quantize_request{
+		std::string channel;
+		std::vector<double> minimum, maximum;
+		double maxError;
+	};
+
+	/**
+	 * This class converts particles between the layout a caller sees (the logical layout) and the layout stored in the
+	 * file, in which some floating point channels are replaced by unsigned integers. Each element of such a channel is
+	 * stored as round( ( value - min ) / step ), and read back as min + q * step. The step is chosen so that, after
+	 * rounding to the channel's type, no value read back is further than the requested error from the value written.
+	 *
+	 * The parameters are kept in the channel's metadata: "QuantizeMin" and "QuantizeStep" (float64, one per element),
+	 * "QuantizeType" (the int32 data type the channel had), and "QuantizeError" (the float64 guaranteed bound). A file
+	 * without them has nothing to convert, and both layouts are the same.
+	 */
+	class particle_quantizer{
+		/**
+		 * A quantized channel, with its offsets in both layouts.
+		 */
+		struct channel{
+			data_types::enum_t type, storedType;
+			std::size_t arity, offset, storedOffset;
+			std::vector<double> minimum, step;
+			data_types::uint32_t maxStep; //The largest stored value.
+			convert_fn_t toDouble, fromDouble;
+		};
+
+		/**
+		 * A run of bytes copied unchanged between the layouts.
+		 */
+		struct copy{
+			std::size_t offset, storedOffset, size;
+		};
+
+		prt_layout m_layout, m_storedLayout;
+		std::vector<channel> m_channels;
+		std::vector<copy> m_copies;
+		std::vector<double> m_scratch;
+
+		/**
+		 * The relative precision of a floating point type, used to leave room in the error bound for the rounding of a
+		 * value read back to that type, and of the double arithmetic that produced it.
+		 */
+		static double epsilon( data_types::enum_t type ){
+			switch( type ){
+			case data_types::type_float16:
+				return 1.0 / 1024.0;
+			case data_types::type_float32:
+				return 1.0 / 8388608.0;
+			default:
+				return 1.0 / 4503599627370496.0;
+			}
+		}
+
+		/**
+		 * Adds a channel stored as itself, merging it with the previous copy when both layouts have them adjacent.
+		 */
+		void add_copy( std::size_t offset, std::size_t storedOffset, std::size_t size ){
+			if( !m_copies.empty() ){
+				copy& last = m_copies.back();
+				if( last.offset + last.size == offset && last.storedOffset + last.size == storedOffset ){
+					last.size += size;
+					return;
+				}
+			}
+			copy c = { offset, storedOffset, size };
+			m_copies.push_back( c );
+		}
+
+		void add_channel( const std::string& name, channel& ch ){
+			if( !is_float( ch.type ) )
+				throw std::runtime_error( "The quantized channel \"" + name + "\" is not floating point" );
+			if( ch.minimum.size() != ch.arity || ch.step.size() != ch.arity )
+				throw std::runtime_error( "The quantization of channel \"" + name + "\" doesn't match its arity" );
+
+			ch.storedType = ( ch.maxStep <= 0xFFFFu ) ? data_types::type_uint16 : data_types::type_uint32;
+			ch.toDouble = get_read_converter<double>( ch.type );
+			ch.fromDouble = get_write_converter<double>( ch.type );
+			m_channels.push_back( ch );
+		}
+
+	public:
+		/**
+		 * @return True if no channel is quantized, so the layouts are the same.
+		 */
+		bool empty() const {
+			return m_channels.empty();
+		}
+
+		/**
+		 * @return The layout that particles are converted to and from.
+		 */
+		const prt_layout& get_layout() const {
+			return m_layout;
+		}
+
+		/**
+		 * @return The layout of the particles in the file.
+		 */
+		const prt_layout& get_stored_layout() const {
+			return m_storedLayout;
+		}
+
+		void clear(){
+			m_layout.clear();
+			m_storedLayout.clear();
+			m_channels.clear();
+			m_copies.clear();
+		}
+
+		/**
+		 * Prepares to write particles with the given layout, choosing a fixed point form for each requested channel and
+		 * recording it in 'metadata'.
+		 * @param layout The layout of the particles to be written.
+		 * @param requests The channels to quantize. Each must be a floating point channel of 'layout'.
+		 * @param metadata Receives the parameters of each quantized channel.
+		 * @param streamName The name of the stream, for error messages.
+		 */
+		void init_write( const prt_layout& layout, const std::vector<quantize_request>& requests, prt_metadata& metadata, const std::string& streamName ){
+			clear();
+			m_layout = layout;
+
+			std::vector<const quantize_request*> channelRequests( layout.num_channels(), static_cast<const quantize_request*>( NULL ) );
+			for( std::vector<quantize_request>::const_iterator it = requests.begin(), itEnd = requests.end(); it != itEnd; ++it ){
+				std::size_t i = 0, iEnd = layout.num_channels();
+				while( i < iEnd && layout.get_channel_name( i ) != it->channel )
+					++i;
+				if( i == iEnd )
+					throw std::runtime_error( "The quantized channel \"" + it->channel + "\" is not in the layout of \"" + streamName + "\"" );
+				channelRequests[i] = &*it;
+			}
+
+			for( std::size_t i = 0, iEnd = layout.num_channels(); i < iEnd; ++i ){
+				const std::string& name = layout.get_channel_name( i );
+				const prt_channel& src = layout.get_channel( name );
+				const quantize_request* req = channelRequests[i];
+
+				if( !req ){
+					add_copy( src.offset, m_storedLayout.size(), data_types::sizes[src.type] * src.arity );
+					m_storedLayout.add_channel( name, src.type, src.arity, m_storedLayout.size() );
+					continue;
+				}
+
+				if( req->minimum.size() != src.arity || req->maximum.size() != src.arity )
+					throw std::runtime_error( "The quantization bounds of channel \"" + name + "\" don't match its arity" );
+
+				channel ch;
+				ch.type = src.type;
+				ch.arity = src.arity;
+				ch.offset = src.offset;
+				ch.storedOffset = m_storedLayout.size();
+				ch.minimum = req->minimum;
+				ch.maxStep = 0;
+
+				//Half a step is the rounding error of the fixed point value, and the rest of the requested error is
+				//left for rounding the value read back to the channel's type.
+				double maxAbs = 0;
+				for( std::size_t j = 0; j < src.arity; ++j ){
+					if( !( req->minimum[j] <= req->maximum[j] ) )
+						throw std::runtime_error( "The quantization bounds of channel \"" + name + "\" are empty" );
+					maxAbs = std::max( maxAbs, std::max( std::fabs( req->minimum[j] ), std::fabs( req->maximum[j] ) ) );
+				}
+
+				const double step = 2.0 * ( req->maxError - 4.0 * epsilon( src.type ) * maxAbs );
+				if( !( step > 0 ) ){
+					std::stringstream ss;
+					ss << "An error of " << req->maxError << " is below the precision of channel \"" << name << "\" within its bounds";
+					throw std::runtime_error( ss.str() );
+				}
+
+				for( std::size_t j = 0; j < src.arity; ++j ){
+					const double steps = std::ceil( ( req->maximum[j] - req->minimum[j] ) / step );
+					if( steps > 4294967295.0 ){
+						std::stringstream ss;
+						ss << "An error of " << req->maxError << " needs more than 32 bits for channel \"" << name << "\" within its bounds";
+						throw std::runtime_error( ss.str() );
+					}
+					ch.maxStep = std::max( ch.maxStep, static_cast<data_types::uint32_t>( steps ) );
+				}
+				ch.step.assign( src.arity, step );
+
+				add_channel( name, ch );
+				m_storedLayout.add_channel( name, m_channels.back().storedType, src.arity, ch.storedOffset );
+
+				metadata.set( "QuantizeMin", &ch.minimum[0], ch.arity, name );
+				metadata.set( "QuantizeStep", &ch.step[0], ch.arity, name );
+				metadata.set( "QuantizeType", static_cast<data_types::int32_t>( ch.type ), name );
+				metadata.set( "QuantizeError", req->maxError, name );
+			}
+		}
+
+		/**
+		 * Prepares to read the particles of a file.
+		 * @param layout The layout from the file's header, which is replaced by the layout particles are read with.
+		 * @param metadata The file's metadata.
+		 * @param streamName The name of the stream, for error messages.
+		 */
+		void init_read( prt_layout& layout, const prt_metadata& metadata, const std::string& streamName ){
+			clear();
+			m_storedLayout = layout;
+
+			for( std::size_t i = 0, iEnd = layout.num_channels(); i < iEnd; ++i ){
+				const std::string& name = layout.get_channel_name( i );
+				const prt_channel& src = layout.get_channel( name );
+				const data_types::int32_t type = metadata.get( "QuantizeType", static_cast<data_types::int32_t>( -1 ), name );
+
+				if( type < 0 ){
+					add_copy( m_layout.size(), src.offset, data_types::sizes[src.type] * src.arity );
+					m_layout.add_channel( name, src.type, src.arity, m_layout.size() );
+					continue;
+				}
+
+				if( type >= data_types::type_count || ( src.type != data_types::type_uint16 && src.type != data_types::type_uint32 ) )
+					throw std::runtime_error( "The quantized channel \"" + name + "\" of \"" + streamName + "\" is not stored as uint16 or uint32" );
+
+				channel ch;
+				ch.type = static_cast<data_types::enum_t>( type );
+				ch.arity = src.arity;
+				ch.offset = m_layout.size();
+				ch.storedOffset = src.offset;
+				ch.maxStep = ( src.type == data_types::type_uint16 ) ? 0xFFFFu : 0xFFFFFFFFu;
+				ch.minimum.resize( src.arity );
+				ch.step.resize( src.arity );
+				if( !metadata.get( "QuantizeMin", &ch.minimum[0], src.arity, name ) || !metadata.get( "QuantizeStep", &ch.step[0], src.arity, name ) )
+					throw std::runtime_error( "The quantized channel \"" + name + "\" of \"" + streamName + "\" is missing its bounds" );
+
+				add_channel( name, ch );
+				m_layout.add_channel( name, ch.type, ch.arity, ch.offset );
+			}
+
+			if( !empty() )
+				layout = m_layout;
+		}
+
+		/**
+		 * Converts particles to the stored layout.
+		 * @throw std::out_of_range If a value of a quantized channel is outside its bounds.
+		 */
+		void encode( const char* src, std::size_t count, char* dest ){
+			const std::size_t particleSize = m_layout.size(), storedSize = m_storedLayout.size();
+
+			for( std::size_t p = 0; p < count; ++p, src += particleSize, dest += storedSize ){
+				for( std::vector<copy>::const_iterator it = m_copies.begin(), itEnd = m_copies.end(); it != itEnd; ++it )
+					memcpy( dest + it->storedOffset, src + it->offset, it->size );
+
+				for( std::vector<channel>::const_iterator it = m_channels.begin(), itEnd = m_channels.end(); it != itEnd; ++it ){
+					m_scratch.resize( it->arity );
+					it->toDouble( &m_scratch[0], src + it->offset, it->arity );
+
+					char* out = dest + it->storedOffset;
+					for( std::size_t j = 0; j < it->arity; ++j ){
+						const double f = ( m_scratch[j] - it->minimum[j] ) / it->step[j] + 0.5;
+						if( !( f >= 0 && f < it->maxStep + 1.0 ) ){
+							std::stringstream ss;
+							ss << "The value " << m_scratch[j] << " of a quantized channel is outside its bounds";
+							throw std::out_of_range( ss.str() );
+						}
+
+						const data_types::uint32_t q = static_cast<data_types::uint32_t>( f );
+						if( it->storedType == data_types::type_uint16 ){
+							const data_types::uint16_t q16 = static_cast<data_types::uint16_t>( q );
+							memcpy( out + 2 * j, &q16, 2 );
+						}else{
+							memcpy( out + 4 * j, &q, 4 );
+						}
+					}
+				}
+			}
+		}
+
+		/**
+		 * Converts particles from the stored layout.
+		 */
+		void decode( const char* src, std::size_t count, char* dest ){
+			const std::size_t particleSize = m_layout.size(), storedSize = m_storedLayout.size();
+
+			for( std::size_t p = 0; p < count; ++p, src += storedSize, dest += particleSize ){
+				for( std::vector<copy>::const_iterator it = m_copies.begin(), itEnd = m_copies.end(); it != itEnd; ++it )
+					memcpy( dest + it->offset, src + it->storedOffset, it->size );
+
+				for( std::vector<channel>::const_iterator it = m_channels.begin(), itEnd = m_channels.end(); it != itEnd; ++it ){
+					const char* in = src + it->storedOffset;
+					m_scratch.resize( it->arity );
+					for( std::size_t j = 0; j < it->arity; ++j ){
+						data_types::uint32_t q;
+						if( it->storedType == data_types::type_uint16 ){
+							data_types::uint16_t q16;
+							memcpy( &q16, in + 2 * j, 2 );
+							q = q16;
+						}else{
+							memcpy( &q, in + 4 * j, 4 );
+						}
+						m_scratch[j] = it->minimum[j] + static_cast<double>( q ) * it->step[j];
+					}
+
+					if( it->type == data_types::type_float32 ){
+						for( std::size_t j = 0; j < it->arity; ++j ){
+							const float value = static_cast<float>( m_scratch[j] );
+							memcpy( dest + it->offset + 4 * j, &value, 4 );
+						}
+					}else{
+						it->fromDouble( dest + it->offset, &m_scratch[0], it->arity );
+					}
+				}
+			}
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
@@ -0,0 +1,167 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains functions for reading selected particles from a PRT file, starting at its resume points.
+ */
+
+#pragma once
+
+#include <prtio/detail/id_index_file.hpp>
+#include <prtio/detail/quantize.hpp>
+#include <prtio/particle_table.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * Decompresses particles from a resume point, handing the wanted ones to 'result'.
+	 * @param fin The PRT file.
+	 * @param filePath The path of the file, for error messages.
+	 * @param layout The layout of the particles in the file.
+	 * @param point The resume point to start from.
+	 * @param wanted The indices of the particles to keep, sorted, all at or after the point.
+	 * @param result Receives the particles.
+	 * @param quantizer If not NULL, converts the kept particles from 'layout' to its layout.
+	 * @return The number of particles decompressed.
+	 */
+	inline data_types::int64_t read_from_point( std::ifstream& fin, const std::string& filePath, const prt_layout& layout, const resume_point& point, const std::vector<data_types::int64_t>& wanted, particle_table& result, particle_quantizer* quantizer = NULL ){
+		const std::size_t particleSize = layout.size();
+		const data_types::int64_t last = wanted.back();
+
+		z_stream zs;
+		memset( &zs, 0, sizeof(z_stream) );
+		if( Z_OK != inflateInit2( &zs, -MAX_WBITS ) )
+			throw std::runtime_error( "Unable to initialize a zlib inflate stream for \"" + filePath + "\"" );
+
+		fin.clear();
+		fin.seekg( point.offset, std::ios::beg );
+
+		//Particles are decompressed in batches, so those that aren't wanted only cost their inflate.
+		const std::size_t batchParticles = std::max<std::size_t>( 1, ( 1 << 18 ) / particleSize );
+		std::vector<char> inBuffer( 1 << 16 ), outBuffer( batchParticles * particleSize );
+		std::vector<char> converted( quantizer ? quantizer->get_layout().size() : 0 );
+
+		data_types::int64_t first = point.particle; //The index of the first particle in 'outBuffer'.
+		std::vector<data_types::int64_t>::const_iterator next = wanted.begin();
+
+		try{
+			while( first <= last ){
+				const std::size_t count = static_cast<std::size_t>( std::min<data_types::int64_t>( static_cast<data_types::int64_t>( batchParticles ), last - first + 1 ) );
+				zs.next_out = reinterpret_cast<Bytef*>( &outBuffer[0] );
+				zs.avail_out = static_cast<uInt>( count * particleSize );
+
+				while( zs.avail_out > 0 ){
+					if( zs.avail_in == 0 ){
+						fin.read( &inBuffer[0], inBuffer.size() );
+						if( fin.gcount() <= 0 )
+							throw std::runtime_error( "The file \"" + filePath + "\" ended before the particles in its index" );
+						zs.next_in = reinterpret_cast<Bytef*>( &inBuffer[0] );
+						zs.avail_in = static_cast<uInt>( fin.gcount() );
+					}
+
+					int ret = inflate( &zs, Z_NO_FLUSH );
+					if( ret == Z_STREAM_END && zs.avail_out > 0 )
+						throw std::runtime_error( "The file \"" + filePath + "\" ended before the particles in its index" );
+					if( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR )
+						throw std::runtime_error( "Failed to decompress \"" + filePath + "\" from a resume point in its index: " + ( zs.msg ? zs.msg : zError( ret ) ) );
+				}
+
+				for( ; next != wanted.end() && *next < first + static_cast<data_types::int64_t>( count ); ++next ){
+					const char* particle = &outBuffer[ static_cast<std::size_t>( *next - first ) * particleSize ];
+					if( quantizer ){
+						quantizer->decode( particle, 1, &converted[0] );
+						result.append_particles( &converted[0], 1, quantizer->get_layout() );
+					}else{
+						result.append_particles( particle, 1, layout );
+					}
+				}
+
+				first += static_cast<data_types::int64_t>( count );
+			}
+		}catch( ... ){
+			inflateEnd( &zs );
+			throw;
+		}
+
+		inflateEnd( &zs );
+		return first - point.particle;
+	}
+
+	inline bool resume_point_less( const resume_point& lhs, const resume_point& rhs ){
+		return lhs.particle < rhs.particle;
+	}
+
+	/**
+	 * Reads selected particles from a PRT file, decompressing from the resume point before each run of them and
+	 * stopping after the last one wanted before the next point.
+	 * @param filePath The PRT file.
+	 * @param layout The layout of the particles in the file.
+	 * @param points The file's resume points, in particle order, starting with particle 0.
+	 * @param numPoints The number of resume points.
+	 * @param particleCount The number of particles in the file.
+	 * @param particles The indices of the particles to read, sorted and without repeats.
+	 * @param result Receives the particles, in file order. If it has no channels it gets every channel of the file,
+	 *               otherwise the file must have its channels with the same types.
+	 * @param quantizer If not NULL, the file's fixed point channels (see particle_quantizer), with 'layout' being its
+	 *                  stored layout. The particles are converted back to floating point.
+	 * @return The number of particles that were decompressed.
+	 */
+	inline data_types::int64_t read_particles_at( const std::string& filePath, const prt_layout& layout, const resume_point* points, std::size_t numPoints, data_types::int64_t particleCount, const std::vector<data_types::int64_t>& particles, particle_table& result, const particle_quantizer* quantizer = NULL ){
+		if( particles.empty() )
+			return 0;
+		if( numPoints == 0 || particles.back() >= particleCount )
+			throw std::out_of_range( "A particle index is past the end of \"" + filePath + "\"" );
+
+		//Each call converts with its own copy, so calls from several threads don't share its scratch space.
+		particle_quantizer converter;
+		if( quantizer && !quantizer->empty() )
+			converter = *quantizer;
+
+		if( result.num_channels() == 0 ){
+			particle_table table( converter.empty() ? layout : converter.get_layout() );
+			result.swap( table );
+		}
+		result.reserve( result.size() + particles.size() );
+
+		std::ifstream fin( filePath.c_str(), std::ios::in | std::ios::binary );
+		if( fin.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + filePath + "\"" );
+
+		data_types::int64_t decoded = 0;
+		std::vector<data_types::int64_t> group;
+		for( std::vector<data_types::int64_t>::const_iterator it = particles.begin(), itEnd = particles.end(); it != itEnd; ){
+			resume_point key = { *it, 0 };
+			const std::size_t p = static_cast<std::size_t>( std::upper_bound( points, points + numPoints, key, resume_point_less ) - points ) - 1;
+			const data_types::int64_t end = ( p + 1 < numPoints ) ? points[p + 1].particle : particleCount;
+
+			group.clear();
+			for( ; it != itEnd && *it < end; ++it )
+				group.push_back( *it );
+
+			decoded += read_from_point( fin, filePath, layout, points[p], group, result, converter.empty() ? NULL : &converter );
+		}
+
+		return decoded;
+	}
+
+}//namespace detail
+}//namespace prtio
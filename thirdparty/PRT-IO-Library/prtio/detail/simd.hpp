@@ -0,0 +1,116 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file selects the SIMD instruction set used by the block processing kernels. Every kernel has a scalar
+ * fallback, so defining PRTIO_NO_SIMD before including any prtio header disables the intrinsics entirely.
+ */
+
+#pragma once
+
+#if !defined(PRTIO_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+#define PRTIO_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <cstddef>
+#include <vector>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * Splits 'count' interleaved 3-vectors into separate x, y and z arrays, so the kernels that follow can process
+	 * four particles per instruction.
+	 */
+	template <typename T>
+	inline void deinterleave3( const T* src, std::size_t count, T* x, T* y, T* z ){
+		for( std::size_t i = 0; i < count; ++i, src += 3 ){
+			x[i] = src[0];
+			y[i] = src[1];
+			z[i] = src[2];
+		}
+	}
+
+	/**
+	 * The inverse of deinterleave3().
+	 */
+	template <typename T>
+	inline void interleave3( const T* x, const T* y, const T* z, std::size_t count, T* dest ){
+		for( std::size_t i = 0; i < count; ++i, dest += 3 ){
+			dest[0] = x[i];
+			dest[1] = y[i];
+			dest[2] = z[i];
+		}
+	}
+
+	/**
+	 * Widens the running minimum and maximum of each component of 'count' interleaved vectors of 'arity' floats.
+	 * Groups of four vectors are processed with 'arity' SSE registers: lane j of register k always sees component
+	 * (4k + j) % arity, so no deinterleaving is needed and any arity up to 16 runs at four floats per instruction.
+	 * @param minimum The running minimum of each of the 'arity' components, updated in place.
+	 * @param maximum The running maximum of each of the 'arity' components, updated in place.
+	 */
+	inline void minmax_interleaved( const float* data, std::size_t count, std::size_t arity, float* minimum, float* maximum ){
+		const std::size_t total = count * arity;
+		std::size_t i = 0;
+#ifdef PRTIO_USE_SSE2
+		const std::size_t group = 4 * arity;
+		if( arity <= 16 && total >= group ){
+			__m128 lo[16], hi[16];
+			for( std::size_t k = 0; k < arity; ++k )
+				lo[k] = hi[k] = _mm_loadu_ps( data + 4 * k );
+
+			for( i = group; i + group <= total; i += group ){
+				for( std::size_t k = 0; k < arity; ++k ){
+					__m128 v = _mm_loadu_ps( data + i + 4 * k );
+					lo[k] = _mm_min_ps( lo[k], v );
+					hi[k] = _mm_max_ps( hi[k], v );
+				}
+			}
+
+			for( std::size_t k = 0; k < arity; ++k ){
+				float l[4], h[4];
+				_mm_storeu_ps( l, lo[k] );
+				_mm_storeu_ps( h, hi[k] );
+				for( std::size_t j = 0; j < 4; ++j ){
+					std::size_t c = ( 4 * k + j ) % arity;
+					minimum[c] = ( l[j] < minimum[c] ) ? l[j] : minimum[c];
+					maximum[c] = ( h[j] > maximum[c] ) ? h[j] : maximum[c];
+				}
+			}
+		}
+#endif
+		for( ; i < total; ++i ){
+			std::size_t c = i % arity;
+			minimum[c] = ( data[i] < minimum[c] ) ? data[i] : minimum[c];
+			maximum[c] = ( data[i] > maximum[c] ) ? data[i] : maximum[c];
+		}
+	}
+
+#ifdef PRTIO_USE_SSE2
+	/**
+	 * Clears the entries of 'keep' for each lane of 'pass' that is false.
+	 * @param pass The result of four comparisons, as produced by _mm_cmp*_ps.
+	 * @param keep Points to four mask bytes.
+	 */
+	inline void and_mask4( __m128 pass, unsigned char* keep ){
+		int bits = _mm_movemask_ps( pass );
+		keep[0] &= static_cast<unsigned char>( bits & 1 );
+		keep[1] &= static_cast<unsigned char>( ( bits >> 1 ) & 1 );
+		keep[2] &= static_cast<unsigned char>( ( bits >> 2 ) & 1 );
+		keep[3] &= static_cast<unsigned char>( ( bits >> 3 ) & 1 );
+	}
+#endif
+
+}//namespace detail
+}//namespace prtio
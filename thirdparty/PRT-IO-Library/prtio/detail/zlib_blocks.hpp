@@ -0,0 +1,330 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains support for compressing particle data as independent deflate blocks that can be stitched
+ * together into the single zlib stream a PRT file expects, and for joining existing zlib streams without
+ * recompressing them.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+namespace detail{
+
+	/**
+	 * This class holds one independently compressed piece of a PRT particle stream.
+	 */
+	struct deflate_block{
+		std::vector<char> data;  //Raw deflate data (no zlib header or trailer), ending on a byte boundary without a final block.
+		uLong adler;             //The adler32 checksum of the uncompressed bytes.
+		std::size_t rawSize;     //The number of uncompressed bytes.
+		std::size_t particles;   //The number of particles in the block.
+	};
+
+	/**
+	 * Compresses a buffer as a self contained raw deflate stream. The stream ends with a sync flush rather than a final
+	 * block, so any number of these can be concatenated and still decode as one deflate stream.
+	 * @param src The uncompressed data.
+	 * @param size The number of bytes in 'src'.
+	 * @param level The zlib compression level.
+	 * @param out Receives the compressed data and its checksum. Its buffer is reused when large enough.
+	 */
+	inline void compress_block( const char* src, std::size_t size, int level, deflate_block& out ){
+		z_stream zs;
+		memset( &zs, 0, sizeof(z_stream) );
+
+		if( Z_OK != deflateInit2( &zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) )
+			throw std::runtime_error( "Unable to initialize a zlib deflate stream for a particle block." );
+
+		//deflateBound() doesn't account for the sync flush marker, which adds at most 5 bytes plus a partial byte.
+		out.data.resize( deflateBound( &zs, static_cast<uLong>( size ) ) + 16 );
+
+		zs.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( src ) );
+		zs.next_out = reinterpret_cast<Bytef*>( &out.data[0] );
+
+		//avail_in and avail_out are uInts, so a block of 4GB or more is given to deflate() a piece at a time, and only
+		//the last piece of input is flushed.
+		const std::size_t maxPiece = std::numeric_limits<uInt>::max();
+		std::size_t inLeft = size, outLeft = out.data.size();
+		int ret;
+		for( ;; ){
+			if( zs.avail_in == 0 && inLeft != 0 ){
+				zs.avail_in = static_cast<uInt>( std::min( inLeft, maxPiece ) );
+				inLeft -= zs.avail_in;
+			}
+			if( zs.avail_out == 0 && outLeft != 0 ){
+				zs.avail_out = static_cast<uInt>( std::min( outLeft, maxPiece ) );
+				outLeft -= zs.avail_out;
+			}
+
+			ret = deflate( &zs, inLeft == 0 ? Z_SYNC_FLUSH : Z_NO_FLUSH );
+			if( ret != Z_OK || ( inLeft == 0 && zs.avail_in == 0 && zs.avail_out != 0 ) || ( zs.avail_out == 0 && outLeft == 0 ) )
+				break;
+		}
+		std::size_t written = out.data.size() - outLeft - zs.avail_out;
+		deflateEnd( &zs );
+
+		if( ret != Z_OK || zs.avail_in != 0 || inLeft != 0 || zs.avail_out == 0 )
+			throw std::runtime_error( std::string( "deflate() failed for a particle block: " ) + zError( ret ) );
+
+		out.data.resize( written );
+		out.adler = adler32( 0L, Z_NULL, 0 );
+		for( std::size_t done = 0; done < size; ){
+			const uInt piece = static_cast<uInt>( std::min( size - done, maxPiece ) );
+			out.adler = adler32( out.adler, reinterpret_cast<const Bytef*>( src + done ), piece );
+			done += piece;
+		}
+		out.rawSize = size;
+	}
+
+	/**
+	 * This struct describes where the deflate data of a complete zlib stream lies in a file, as found by
+	 * scan_zlib_stream(). It has what is needed to copy the compressed bits into another stream verbatim.
+	 */
+	struct deflate_span{
+		std::streamoff begin;       //The offset of the first byte of deflate data, just after the zlib header.
+		std::streamoff end;         //One past the offset of the last byte holding deflate data.
+		std::streamoff lastBlock;   //The offset of the byte holding the final block's BFINAL bit.
+		unsigned char lastMask;     //The mask of the BFINAL bit within that byte.
+		int unusedBits;             //The number of unused high bits in the byte at end - 1.
+		uLong adler;                //The adler32 checksum from the stream's trailer.
+		data_types::uint64_t rawSize; //The number of uncompressed bytes in the stream.
+	};
+
+	/**
+	 * Decodes a complete zlib stream to find its deflate block boundaries, without keeping the uncompressed data. This
+	 * follows the approach of zlib's examples/gzjoin.c: inflate() is asked to stop at every block boundary, and the
+	 * position of the next block's header bit is recorded until the stream ends, which leaves the final block's.
+	 * @param in The stream to read from, positioned at the zlib header. It is left just past the adler32 trailer.
+	 * @param streamName The name of the stream, for error messages.
+	 */
+	inline deflate_span scan_zlib_stream( std::istream& in, const std::string& streamName ){
+		unsigned char header[2];
+		in.read( reinterpret_cast<char*>( header ), 2 );
+		if( !in || ( header[0] & 0x0f ) != Z_DEFLATED || ( ( header[0] << 8 ) | header[1] ) % 31 != 0 )
+			throw std::runtime_error( "The input stream \"" + streamName + "\" does not contain a valid zlib header." );
+		if( header[1] & 0x20 )
+			throw std::runtime_error( "The input stream \"" + streamName + "\" uses a preset zlib dictionary, which isn't supported." );
+
+		deflate_span result;
+		result.begin = in.tellg();
+		result.lastBlock = result.begin;
+		result.lastMask = 1;
+
+		z_stream zs;
+		memset( &zs, 0, sizeof(z_stream) );
+		if( Z_OK != inflateInit2( &zs, -MAX_WBITS ) )
+			throw std::runtime_error( "Unable to initialize a zlib inflate stream for input stream \"" + streamName + "\"." );
+
+		std::vector<unsigned char> buffer( 1 << 16 ), junk( 1 << 16 );
+		std::streamoff bufferOffset = result.begin; //The file offset of buffer[0].
+
+		for( ;; ){
+			if( zs.avail_in == 0 ){
+				bufferOffset += zs.next_in ? static_cast<std::streamoff>( zs.next_in - &buffer[0] ) : 0;
+				in.read( reinterpret_cast<char*>( &buffer[0] ), static_cast<std::streamsize>( buffer.size() ) );
+				zs.next_in = &buffer[0];
+				zs.avail_in = static_cast<uInt>( in.gcount() );
+				in.clear();
+
+				if( zs.avail_in == 0 ){
+					inflateEnd( &zs );
+					throw std::runtime_error( "The input stream \"" + streamName + "\" ended before the end of its compressed particle data." );
+				}
+			}
+
+			zs.next_out = &junk[0];
+			zs.avail_out = static_cast<uInt>( junk.size() );
+			int ret = inflate( &zs, Z_BLOCK );
+			if( ret != Z_OK && ret != Z_BUF_ERROR ){
+				inflateEnd( &zs );
+				throw std::runtime_error( "The input stream \"" + streamName + "\" has corrupt compressed particle data: " + ( ret == Z_STREAM_END ? "no final block boundary" : zError( ret ) ) );
+			}
+
+			if( ret != Z_OK || !( zs.data_type & 128 ) )
+				continue;
+
+			//At a block boundary the next block's header starts in the partially used byte, or the next byte if none.
+			//Bit 64 means the block just finished was the final one, in which case the deflate data ends here. The
+			//unused bits must be read now, since inflate() discards them when it moves on to the trailer.
+			int bits = zs.data_type & 7;
+			std::streamoff pos = bufferOffset + static_cast<std::streamoff>( zs.next_in - &buffer[0] );
+			if( zs.data_type & 64 ){
+				result.end = pos;
+				result.unusedBits = bits;
+				break;
+			}else if( bits != 0 ){
+				result.lastBlock = pos - 1;
+				result.lastMask = static_cast<unsigned char>( 0x100 >> bits );
+			}else{
+				result.lastBlock = pos;
+				result.lastMask = 1;
+			}
+		}
+
+		result.rawSize = zs.total_out;
+		inflateEnd( &zs );
+
+		unsigned char trailer[4];
+		in.seekg( result.end, std::ios::beg );
+		in.read( reinterpret_cast<char*>( trailer ), 4 );
+		if( !in )
+			throw std::runtime_error( "The input stream \"" + streamName + "\" is missing its zlib checksum." );
+		result.adler = ( static_cast<uLong>( trailer[0] ) << 24 ) | ( static_cast<uLong>( trailer[1] ) << 16 ) | ( static_cast<uLong>( trailer[2] ) << 8 ) | trailer[3];
+
+		return result;
+	}
+
+	/**
+	 * This class writes the zlib framing around a sequence of raw deflate blocks. It produces exactly the byte stream
+	 * a PRT reader expects after the header: a zlib header, the concatenated blocks, an empty final block and the
+	 * adler32 of all the uncompressed data.
+	 */
+	class zlib_stitcher{
+		std::ostream* m_out;
+		uLong m_adler;
+		bool m_open;
+
+	public:
+		zlib_stitcher() : m_out( NULL ), m_adler( 1 ), m_open( false )
+		{}
+
+		/**
+		 * Writes the zlib stream header.
+		 */
+		void begin( std::ostream& out ){
+			m_out = &out;
+			m_adler = adler32( 0L, Z_NULL, 0 );
+			m_open = true;
+
+			//CMF = deflate with a 32K window, FLG = default level with a valid check value.
+			static const char header[2] = { 0x78, static_cast<char>( 0x9c ) };
+			m_out->write( header, 2 );
+		}
+
+		bool is_open() const {
+			return m_open;
+		}
+
+		/**
+		 * Appends compressed data that continues the deflate stream.
+		 * @param data The raw deflate data, ending on a byte boundary with no final block.
+		 * @param size The number of bytes in 'data'.
+		 * @param adler The adler32 of the uncompressed data.
+		 * @param rawSize The number of uncompressed bytes the data decodes to.
+		 */
+		void append( const char* data, std::size_t size, uLong adler, std::size_t rawSize ){
+			m_out->write( data, static_cast<std::streamsize>( size ) );
+			m_adler = adler32_combine( m_adler, adler, static_cast<z_off_t>( rawSize ) );
+		}
+
+		void append( const deflate_block& block ){
+			if( !block.data.empty() )
+				append( &block.data[0], block.data.size(), block.adler, block.rawSize );
+		}
+
+		/**
+		 * Appends the deflate data of an existing zlib stream without recompressing it. The stream's final block is
+		 * turned into an ordinary block by clearing its BFINAL bit, and empty blocks are added to bring the data to
+		 * a byte boundary so more blocks can follow.
+		 * @param in The stream holding the data. Its read position is changed.
+		 * @param span The location of the deflate data, from scan_zlib_stream().
+		 */
+		void append( std::istream& in, const deflate_span& span ){
+			std::vector<char> buffer( 1 << 16 );
+			in.seekg( span.begin, std::ios::beg );
+
+			unsigned char last = 0;
+			for( std::streamoff pos = span.begin; pos < span.end; ){
+				std::streamsize n = static_cast<std::streamsize>( std::min<std::streamoff>( span.end - pos, static_cast<std::streamoff>( buffer.size() ) ) );
+				in.read( &buffer[0], n );
+				if( in.gcount() != n )
+					throw std::runtime_error( "Unable to read the compressed particle data to copy." );
+
+				if( span.lastBlock >= pos && span.lastBlock < pos + n )
+					buffer[ static_cast<std::size_t>( span.lastBlock - pos ) ] &= static_cast<char>( ~span.lastMask );
+
+				//Hold back the final byte, which may need empty blocks packed into its unused bits.
+				pos += n;
+				if( pos == span.end ){
+					last = static_cast<unsigned char>( buffer[ static_cast<std::size_t>( n - 1 ) ] );
+					--n;
+				}
+				m_out->write( &buffer[0], n );
+			}
+
+			const int pos = span.unusedBits;
+			if( pos == 0 ){
+				m_out->put( static_cast<char>( last ) );
+			}else{
+				last &= static_cast<unsigned char>( ( 0x100 >> pos ) - 1 );
+				if( pos & 1 ){
+					//An odd number of bits left fits an empty stored block, whose header is padded to the next byte.
+					m_out->put( static_cast<char>( last ) );
+					if( pos == 1 )
+						m_out->put( 0 );
+					static const char stored[4] = { 0, 0, static_cast<char>( 0xff ), static_cast<char>( 0xff ) };
+					m_out->write( stored, 4 );
+				}else{
+					//An even number fills exactly with 1 to 3 empty fixed blocks of 10 bits each.
+					switch( pos ){
+					case 6:
+						m_out->put( static_cast<char>( last | 8 ) );
+						last = 0;
+						//fall through
+					case 4:
+						m_out->put( static_cast<char>( last | 0x20 ) );
+						last = 0;
+						//fall through
+					case 2:
+						m_out->put( static_cast<char>( last | 0x80 ) );
+						m_out->put( 0 );
+					}
+				}
+			}
+
+			m_adler = adler32_combine( m_adler, span.adler, static_cast<z_off_t>( span.rawSize ) );
+		}
+
+		/**
+		 * Terminates the deflate stream and writes the checksum trailer.
+		 */
+		void finish(){
+			//An empty fixed Huffman block with the final bit set.
+			static const char lastBlock[2] = { 0x03, 0x00 };
+			m_out->write( lastBlock, 2 );
+
+			const char trailer[4] = {
+				static_cast<char>( ( m_adler >> 24 ) & 0xff ), static_cast<char>( ( m_adler >> 16 ) & 0xff ),
+				static_cast<char>( ( m_adler >> 8 ) & 0xff ), static_cast<char>( m_adler & 0xff )
+			};
+			m_out->write( trailer, 4 );
+
+			m_open = false;
+		}
+	};
+
+}//namespace detail
+}//namespace prtio
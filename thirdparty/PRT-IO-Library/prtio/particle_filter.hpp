@@ -0,0 +1,327 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the per-particle predicates that can be applied to blocks of decoded particles.
+ */
+
+#pragma once
+
+#include <prtio/detail/simd.hpp>
+#include <prtio/particle_table.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class holds a set of predicates and evaluates them over a particle_table, removing the particles that fail.
+ * A particle survives only if it passes every predicate. The spatial predicates test the "Position" channel (see
+ * set_position_channel()), which is converted to float32 for the test regardless of how it is stored.
+ *
+ * Predicates are evaluated over whole columns at a time rather than per particle, so the spatial tests run four
+ * particles per SSE2 instruction where available.
+ */
+class particle_filter{
+	struct box{
+		float minimum[3], maximum[3];
+	};
+
+	struct sphere{
+		float center[3], radius;
+	};
+
+	struct range{
+		std::string channel;
+		std::size_t component;
+		double minimum, maximum;
+	};
+
+	std::string m_positionChannel;
+	std::vector<box> m_boxes;
+	std::vector<sphere> m_spheres;
+	std::vector<range> m_ranges;
+
+	std::string m_idChannel;
+	std::vector<data_types::int64_t> m_ids; //Sorted, so membership is a binary search.
+	bool m_hasIds;
+
+	//Scratch space reused between blocks, so evaluating a block does not allocate once the filter has warmed up.
+	std::vector<float> m_pos, m_x, m_y, m_z;
+	std::vector<double> m_values;
+	std::vector<data_types::int64_t> m_idValues;
+	std::vector<unsigned char> m_keep;
+
+private:
+	static void test_box( const box& b, const float* x, const float* y, const float* z, std::size_t count, unsigned char* keep ){
+		std::size_t i = 0;
+#ifdef PRTIO_USE_SSE2
+		const __m128 minX = _mm_set1_ps( b.minimum[0] ), minY = _mm_set1_ps( b.minimum[1] ), minZ = _mm_set1_ps( b.minimum[2] );
+		const __m128 maxX = _mm_set1_ps( b.maximum[0] ), maxY = _mm_set1_ps( b.maximum[1] ), maxZ = _mm_set1_ps( b.maximum[2] );
+		for( ; i + 4 <= count; i += 4 ){
+			__m128 px = _mm_loadu_ps( x + i ), py = _mm_loadu_ps( y + i ), pz = _mm_loadu_ps( z + i );
+			__m128 pass = _mm_and_ps( _mm_cmpge_ps( px, minX ), _mm_cmple_ps( px, maxX ) );
+			pass = _mm_and_ps( pass, _mm_and_ps( _mm_cmpge_ps( py, minY ), _mm_cmple_ps( py, maxY ) ) );
+			pass = _mm_and_ps( pass, _mm_and_ps( _mm_cmpge_ps( pz, minZ ), _mm_cmple_ps( pz, maxZ ) ) );
+			detail::and_mask4( pass, keep + i );
+		}
+#endif
+		for( ; i < count; ++i ){
+			bool pass = x[i] >= b.minimum[0] && x[i] <= b.maximum[0] &&
+			            y[i] >= b.minimum[1] && y[i] <= b.maximum[1] &&
+			            z[i] >= b.minimum[2] && z[i] <= b.maximum[2];
+			keep[i] &= pass ? 1 : 0;
+		}
+	}
+
+	static void test_sphere( const sphere& s, const float* x, const float* y, const float* z, std::size_t count, unsigned char* keep ){
+		const float radiusSqr = s.radius * s.radius;
+
+		std::size_t i = 0;
+#ifdef PRTIO_USE_SSE2
+		const __m128 cx = _mm_set1_ps( s.center[0] ), cy = _mm_set1_ps( s.center[1] ), cz = _mm_set1_ps( s.center[2] );
+		const __m128 r2 = _mm_set1_ps( radiusSqr );
+		for( ; i + 4 <= count; i += 4 ){
+			__m128 dx = _mm_sub_ps( _mm_loadu_ps( x + i ), cx );
+			__m128 dy = _mm_sub_ps( _mm_loadu_ps( y + i ), cy );
+			__m128 dz = _mm_sub_ps( _mm_loadu_ps( z + i ), cz );
+			__m128 d2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+			detail::and_mask4( _mm_cmple_ps( d2, r2 ), keep + i );
+		}
+#endif
+		for( ; i < count; ++i ){
+			float dx = x[i] - s.center[0], dy = y[i] - s.center[1], dz = z[i] - s.center[2];
+			keep[i] &= ( dx * dx + dy * dy + dz * dz <= radiusSqr ) ? 1 : 0;
+		}
+	}
+
+public:
+	particle_filter() : m_positionChannel( "Position" ), m_idChannel( "ID" ), m_hasIds( false )
+	{}
+
+	/**
+	 * Changes the channel tested by the box and sphere predicates. It must have arity 3.
+	 */
+	void set_position_channel( const std::string& name ){
+		m_positionChannel = name;
+	}
+
+	/**
+	 * Keeps only particles inside an axis-aligned box, boundary included.
+	 */
+	void add_box( const float minimum[3], const float maximum[3] ){
+		box b;
+		for( int i = 0; i < 3; ++i ){
+			b.minimum[i] = minimum[i];
+			b.maximum[i] = maximum[i];
+		}
+		m_boxes.push_back( b );
+	}
+
+	/**
+	 * Keeps only particles within 'radius' of 'center', boundary included.
+	 */
+	void add_sphere( const float center[3], float radius ){
+		sphere s;
+		for( int i = 0; i < 3; ++i )
+			s.center[i] = center[i];
+		s.radius = radius;
+		m_spheres.push_back( s );
+	}
+
+	/**
+	 * Keeps only particles where one component of a channel is in [minimum, maximum]. Particles from a stream without
+	 * the channel are all rejected, since the predicate can't be satisfied.
+	 * @param channel The name of the channel to test, ex. "Density".
+	 * @param component The index of the element to test, ex. 1 for the y component of a vector.
+	 */
+	void add_range( const std::string& channel, std::size_t component, double minimum, double maximum ){
+		range r;
+		r.channel = channel;
+		r.component = component;
+		r.minimum = minimum;
+		r.maximum = maximum;
+		m_ranges.push_back( r );
+	}
+
+	/**
+	 * Keeps only particles whose ID is in the given set. Calling this again replaces the set.
+	 * @param ids The IDs to keep, in any order.
+	 * @param channel The name of the integer channel holding the IDs.
+	 */
+	void set_ids( const std::vector<data_types::int64_t>& ids, const std::string& channel = "ID" ){
+		m_ids = ids;
+		std::sort( m_ids.begin(), m_ids.end() );
+		m_ids.erase( std::unique( m_ids.begin(), m_ids.end() ), m_ids.end() );
+		m_idChannel = channel;
+		m_hasIds = true;
+	}
+
+	/**
+	 * Lists the channels the predicates read, so a reader that only loads some channels can make sure it loads these.
+	 * @param names Has the channel names appended, with no duplicates.
+	 */
+	void get_channels( std::vector<std::string>& names ) const {
+		std::vector<std::string> result;
+		if( !m_boxes.empty() || !m_spheres.empty() )
+			result.push_back( m_positionChannel );
+		for( std::vector<range>::const_iterator it = m_ranges.begin(), itEnd = m_ranges.end(); it != itEnd; ++it )
+			result.push_back( it->channel );
+		if( m_hasIds )
+			result.push_back( m_idChannel );
+
+		for( std::vector<std::string>::const_iterator it = result.begin(), itEnd = result.end(); it != itEnd; ++it ){
+			if( std::find( names.begin(), names.end(), *it ) == names.end() )
+				names.push_back( *it );
+		}
+	}
+
+	/**
+	 * @return True if no predicates have been added, so every particle passes.
+	 */
+	bool empty() const {
+		return m_boxes.empty() && m_spheres.empty() && m_ranges.empty() && !m_hasIds;
+	}
+
+	/**
+	 * The result of testing a file's stored bounding box against the filter.
+	 */
+	enum bounds_result{
+		bounds_outside, //No particle in the box can pass, so the file needn't be decoded.
+		bounds_inside,  //Every particle in the box passes.
+		bounds_partial  //Particles have to be tested one by one.
+	};
+
+	/**
+	 * Tests a box known to hold every particle (ex. a "BoundBox" from prt_metadata) against the predicates, so whole
+	 * files can be rejected or accepted without decoding them. Only the box and sphere predicates can be decided this
+	 * way, so a filter with ranges or IDs never returns bounds_inside.
+	 * @param minimum The minimum corner of the particle positions.
+	 * @param maximum The maximum corner. If it is less than 'minimum' the file is empty, and bounds_outside is returned.
+	 */
+	bounds_result test_bounds( const float minimum[3], const float maximum[3] ) const {
+		for( int i = 0; i < 3; ++i ){
+			if( !( minimum[i] <= maximum[i] ) )
+				return bounds_outside;
+		}
+
+		bool inside = m_ranges.empty() && !m_hasIds;
+
+		for( std::vector<box>::const_iterator it = m_boxes.begin(), itEnd = m_boxes.end(); it != itEnd; ++it ){
+			for( int i = 0; i < 3; ++i ){
+				if( maximum[i] < it->minimum[i] || minimum[i] > it->maximum[i] )
+					return bounds_outside;
+				if( minimum[i] < it->minimum[i] || maximum[i] > it->maximum[i] )
+					inside = false;
+			}
+		}
+
+		for( std::vector<sphere>::const_iterator it = m_spheres.begin(), itEnd = m_spheres.end(); it != itEnd; ++it ){
+			//Compare the nearest and farthest points of the box to the radius.
+			float nearSqr = 0, farSqr = 0;
+			for( int i = 0; i < 3; ++i ){
+				float toMin = it->center[i] - minimum[i], toMax = maximum[i] - it->center[i];
+				float nearDist = std::max( 0.f, std::max( -toMin, -toMax ) );
+				float farDist = std::max( std::fabs( toMin ), std::fabs( toMax ) );
+				nearSqr += nearDist * nearDist;
+				farSqr += farDist * farDist;
+			}
+
+			const float radiusSqr = it->radius * it->radius;
+			if( nearSqr > radiusSqr )
+				return bounds_outside;
+			if( farSqr > radiusSqr )
+				inside = false;
+		}
+
+		return inside ? bounds_inside : bounds_partial;
+	}
+
+	/**
+	 * Evaluates the predicates for every particle in a table.
+	 * @param table The particles to test.
+	 * @param keep Receives one entry per particle, non-zero for particles that pass.
+	 */
+	void evaluate( const particle_table& table, std::vector<unsigned char>& keep ){
+		const std::size_t count = table.size();
+		keep.assign( count, 1 );
+		if( count == 0 )
+			return;
+
+		if( !m_boxes.empty() || !m_spheres.empty() ){
+			if( table.get_layout().get_channel( m_positionChannel ).arity != 3 )
+				throw std::runtime_error( "The position channel \"" + m_positionChannel + "\" must have an arity of 3 for a spatial filter" );
+
+			m_pos.resize( 3 * count );
+			m_x.resize( count );
+			m_y.resize( count );
+			m_z.resize( count );
+
+			table.copy_channel( m_positionChannel, &m_pos[0], 0, count );
+			detail::deinterleave3( &m_pos[0], count, &m_x[0], &m_y[0], &m_z[0] );
+
+			for( std::vector<box>::const_iterator it = m_boxes.begin(), itEnd = m_boxes.end(); it != itEnd; ++it )
+				test_box( *it, &m_x[0], &m_y[0], &m_z[0], count, &keep[0] );
+			for( std::vector<sphere>::const_iterator it = m_spheres.begin(), itEnd = m_spheres.end(); it != itEnd; ++it )
+				test_sphere( *it, &m_x[0], &m_y[0], &m_z[0], count, &keep[0] );
+		}
+
+		for( std::vector<range>::const_iterator it = m_ranges.begin(), itEnd = m_ranges.end(); it != itEnd; ++it ){
+			if( !table.has_channel( it->channel ) || it->component >= table.get_layout().get_channel( it->channel ).arity ){
+				keep.assign( count, 0 );
+				return;
+			}
+
+			const std::size_t arity = table.get_layout().get_channel( it->channel ).arity;
+			m_values.resize( arity * count );
+			table.copy_channel( it->channel, &m_values[0], 0, count );
+
+			const double* values = &m_values[it->component];
+			const double lo = it->minimum, hi = it->maximum;
+			for( std::size_t i = 0; i < count; ++i, values += arity )
+				keep[i] &= static_cast<unsigned char>( ( *values >= lo ) & ( *values <= hi ) );
+		}
+
+		if( m_hasIds ){
+			if( !table.has_channel( m_idChannel ) || table.get_layout().get_channel( m_idChannel ).arity != 1 ){
+				keep.assign( count, 0 );
+				return;
+			}
+
+			m_idValues.resize( count );
+			table.copy_channel( m_idChannel, &m_idValues[0], 0, count );
+
+			for( std::size_t i = 0; i < count; ++i ){
+				if( keep[i] )
+					keep[i] = std::binary_search( m_ids.begin(), m_ids.end(), m_idValues[i] ) ? 1 : 0;
+			}
+		}
+	}
+
+	/**
+	 * Evaluates the predicates for every particle in a table and removes the ones that fail, preserving order.
+	 * @return The number of particles left in the table.
+	 */
+	std::size_t apply( particle_table& table ){
+		if( empty() )
+			return table.size();
+
+		evaluate( table, m_keep );
+		return table.filter( m_keep );
+	}
+};
+
+}//namespace prtio
@@ -0,0 +1,589 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains a columnar, in-memory container for particles of any prt_layout.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/data_types.hpp>
+#include <prtio/prt_istream.hpp>
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_ostream.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <new>
+#include <string>
+#include <sstream>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class stores particles as one contiguous column per channel, with every column carved out of a single arena
+ * allocation. Each column starts on a cache line boundary so loops over a column vectorize cleanly. Growing the table
+ * reallocates the arena once for all channels, so there is never any per-particle or per-channel heap traffic.
+ *
+ * The table's prt_layout describes a particle as it appears interleaved in a stream, which lets the table load from
+ * any prt_istream and save to any prt_ostream in bulk.
+ */
+class particle_table{
+	/**
+	 * This internal class records where a channel's column lives in the arena.
+	 */
+	struct column{
+		std::size_t offset; //The byte offset of the column from the start of the arena.
+		std::size_t stride; //The size in bytes of a single particle's entry in the column.
+	};
+
+	prt_layout m_layout;           //The layout of a single particle, as it appears interleaved in a stream.
+	std::vector<column> m_columns; //The columns, indexed the same way as the channels in 'm_layout'.
+
+	char* m_arenaAlloc; //The unaligned pointer returned by the allocator.
+	char* m_arena;      //The aligned start of the arena.
+
+	std::size_t m_size;     //The number of particles in the table.
+	std::size_t m_capacity; //The number of particles the arena has room for.
+
+private:
+	//The alignment in bytes of each column in the arena.
+	static std::size_t column_alignment(){
+		return 64;
+	}
+
+	//The number of particles converted between the interleaved and columnar representations at once when streaming.
+	static std::size_t block_size(){
+		return 4096;
+	}
+
+	static std::size_t align_up( std::size_t bytes ){
+		return ( bytes + column_alignment() - 1 ) & ~( column_alignment() - 1 );
+	}
+
+	/**
+	 * Reallocates the arena to hold 'capacity' particles of every column in 'm_layout', preserving existing data. New space is zeroed.
+	 * @param capacity The number of particles to make room for. Must be at least m_size.
+	 */
+	void reallocate( std::size_t capacity ){
+		std::vector<column> newColumns( m_layout.num_channels() );
+
+		std::size_t arenaSize = 0;
+		for( std::size_t i = 0, iEnd = newColumns.size(); i < iEnd; ++i ){
+			const detail::prt_channel& ch = m_layout.get_channel( m_layout.get_channel_name( i ) );
+
+			newColumns[i].offset = arenaSize;
+			newColumns[i].stride = data_types::sizes[ ch.type ] * ch.arity;
+
+			arenaSize += align_up( newColumns[i].stride * capacity );
+		}
+
+		char* newAlloc = NULL;
+		char* newArena = NULL;
+		if( arenaSize > 0 ){
+			newAlloc = static_cast<char*>( std::calloc( arenaSize + column_alignment(), 1 ) );
+			if( !newAlloc )
+				throw std::bad_alloc();
+			newArena = reinterpret_cast<char*>( align_up( reinterpret_cast<std::size_t>( newAlloc ) ) );
+		}
+
+		//Columns that existed before keep their data. A freshly added channel is at the end and has no old column.
+		for( std::size_t i = 0, iEnd = std::min( m_columns.size(), newColumns.size() ); i < iEnd; ++i )
+			memcpy( newArena + newColumns[i].offset, m_arena + m_columns[i].offset, m_columns[i].stride * m_size );
+
+		std::free( m_arenaAlloc );
+
+		m_arenaAlloc = newAlloc;
+		m_arena = newArena;
+		m_columns.swap( newColumns );
+		m_capacity = capacity;
+	}
+
+	/**
+	 * Makes sure there is room for 'count' more particles, growing the arena geometrically.
+	 */
+	void grow_for( std::size_t count ){
+		if( m_size + count > m_capacity )
+			reallocate( std::max( m_size + count, m_capacity + m_capacity / 2 ) );
+	}
+
+	/**
+	 * Throws if 'other' does not have exactly the same channels (by name, type and arity) as this table.
+	 * @param allowExtra If true, 'other' may have channels this table doesn't, which are ignored.
+	 * @return The index in 'other' of each of this table's channels.
+	 */
+	std::vector<std::size_t> match_channels( const prt_layout& other, bool allowExtra = false ) const {
+		if( allowExtra ? other.num_channels() < m_layout.num_channels() : other.num_channels() != m_layout.num_channels() )
+			throw std::runtime_error( "The particle layouts have a different number of channels" );
+
+		std::vector<std::size_t> result( m_layout.num_channels() );
+		for( std::size_t i = 0, iEnd = result.size(); i < iEnd; ++i ){
+			const std::string& name = m_layout.get_channel_name( i );
+			const detail::prt_channel& ch = m_layout.get_channel( name );
+
+			if( !other.has_channel( name ) )
+				throw std::runtime_error( "The particle layouts differ, channel \"" + name + "\" is missing" );
+
+			const detail::prt_channel& otherCh = other.get_channel( name );
+			if( otherCh.type != ch.type || otherCh.arity != ch.arity )
+				throw std::runtime_error( "The particle layouts differ in the type of channel \"" + name + "\"" );
+
+			for( std::size_t j = 0, jEnd = other.num_channels(); j < jEnd; ++j ){
+				if( other.get_channel_name( j ) == name )
+					result[i] = j;
+			}
+		}
+
+		return result;
+	}
+
+public:
+	/**
+	 * Creates an empty table with no channels. Channels are added with add_channel(), or adopted from the first
+	 * stream passed to load().
+	 */
+	particle_table() : m_arenaAlloc( NULL ), m_arena( NULL ), m_size( 0 ), m_capacity( 0 )
+	{}
+
+	/**
+	 * Creates an empty table with the channels of an existing layout. The table keeps the layout's channel offsets, so
+	 * particles interleaved in that layout can be appended directly.
+	 * @param layout The layout to copy, for example prt_istream::get_layout().
+	 */
+	explicit particle_table( const prt_layout& layout ) : m_layout( layout ), m_arenaAlloc( NULL ), m_arena( NULL ), m_size( 0 ), m_capacity( 0 ) {
+		m_columns.resize( m_layout.num_channels() );
+	}
+
+	particle_table( const particle_table& rhs ) : m_layout( rhs.m_layout ), m_arenaAlloc( NULL ), m_arena( NULL ), m_size( 0 ), m_capacity( 0 ) {
+		m_columns.resize( m_layout.num_channels() );
+		reallocate( rhs.m_size );
+
+		for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i )
+			memcpy( m_arena + m_columns[i].offset, rhs.m_arena + rhs.m_columns[i].offset, m_columns[i].stride * rhs.m_size );
+		m_size = rhs.m_size;
+	}
+
+	~particle_table(){
+		std::free( m_arenaAlloc );
+	}
+
+	particle_table& operator=( const particle_table& rhs ){
+		if( this != &rhs ){
+			particle_table temp( rhs );
+			swap( temp );
+		}
+		return *this;
+	}
+
+	void swap( particle_table& rhs ){
+		std::swap( m_layout, rhs.m_layout );
+		m_columns.swap( rhs.m_columns );
+		std::swap( m_arenaAlloc, rhs.m_arenaAlloc );
+		std::swap( m_arena, rhs.m_arena );
+		std::swap( m_size, rhs.m_size );
+		std::swap( m_capacity, rhs.m_capacity );
+	}
+
+	/**
+	 * Adds a new channel to the table. If the table already holds particles, their values for the new channel are zero.
+	 * @param name The name of the channel to add
+	 * @param type The data type of the channel
+	 * @param arity The number of grouped elements used by this channel.
+	 */
+	void add_channel( const std::string& name, data_types::enum_t type, std::size_t arity ){
+		m_layout.add_channel( name, type, arity, m_layout.size() );
+		m_columns.resize( m_layout.num_channels() );
+
+		reallocate( m_capacity );
+	}
+
+	/**
+	 * @return The layout of a single particle in the table.
+	 */
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	bool has_channel( const std::string& name ) const {
+		return m_layout.has_channel( name );
+	}
+
+	/**
+	 * @return The index of the named channel, for use with get_column(). Throws std::out_of_range if there is no such channel.
+	 */
+	std::size_t channel_index( const std::string& name ) const {
+		for( std::size_t i = 0, iEnd = m_layout.num_channels(); i < iEnd; ++i ){
+			if( m_layout.get_channel_name( i ) == name )
+				return i;
+		}
+		throw std::out_of_range( "There is no channel named \"" + name + "\"" );
+	}
+
+	std::size_t num_channels() const {
+		return m_layout.num_channels();
+	}
+
+	/**
+	 * @return The number of particles in the table.
+	 */
+	std::size_t size() const {
+		return m_size;
+	}
+
+	bool empty() const {
+		return m_size == 0;
+	}
+
+	std::size_t capacity() const {
+		return m_capacity;
+	}
+
+	/**
+	 * Makes room for at least 'count' particles without changing the size.
+	 */
+	void reserve( std::size_t count ){
+		if( count > m_capacity )
+			reallocate( count );
+	}
+
+	/**
+	 * Changes the number of particles in the table. Particles added by growing the table are zeroed.
+	 */
+	void resize( std::size_t count ){
+		reserve( count );
+		if( count > m_size ){
+			for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i )
+				memset( m_arena + m_columns[i].offset + m_columns[i].stride * m_size, 0, m_columns[i].stride * ( count - m_size ) );
+		}
+		m_size = count;
+	}
+
+	/**
+	 * Removes all particles but keeps the channels and the arena, so the table can be refilled without allocating.
+	 */
+	void clear(){
+		m_size = 0;
+	}
+
+	/**
+	 * @param index The index of the channel, in the order of get_layout().get_channel_name().
+	 * @return A pointer to the start of the channel's column. Particle i's data is at column + i * arity elements.
+	 */
+	void* get_column( std::size_t index ){
+		return m_arena + m_columns[index].offset;
+	}
+
+	const void* get_column( std::size_t index ) const {
+		return m_arena + m_columns[index].offset;
+	}
+
+	/**
+	 * This template function returns a typed pointer to a channel's column. It does not convert, so T must match the channel's type.
+	 * @tparam T The type stored in the column.
+	 * @param name The name of the channel.
+	 * @return A pointer to the start of the column. Particle i's data is at [i * arity, (i + 1) * arity).
+	 */
+	template <typename T>
+	T* get_column( const std::string& name ){
+		const detail::prt_channel& ch = m_layout.get_channel( name );
+		if( ch.type != data_types::traits<T>::data_type() )
+			throw std::runtime_error( "The channel \"" + name + "\" is stored as " + data_types::names[ ch.type ] + ", not " + data_types::names[ data_types::traits<T>::data_type() ] );
+		return static_cast<T*>( get_column( channel_index( name ) ) );
+	}
+
+	template <typename T>
+	const T* get_column( const std::string& name ) const {
+		return const_cast<particle_table*>( this )->get_column<T>( name );
+	}
+
+	/**
+	 * This template function copies part of a channel's column into a user array, converting the type if needed.
+	 * @tparam T The type to convert to.
+	 * @param name The name of the channel.
+	 * @param dest The destination, which must have room for count * arity elements.
+	 * @param first The index of the first particle to copy.
+	 * @param count The number of particles to copy.
+	 */
+	template <typename T>
+	void copy_channel( const std::string& name, T* dest, std::size_t first, std::size_t count ) const {
+		const detail::prt_channel& ch = m_layout.get_channel( name );
+
+		detail::convert_fn_t copyFn = detail::get_read_converter<T>( ch.type );
+		if( !copyFn )
+			throw std::logic_error( "The channel \"" + name + "\" had an unsupported type: \"" + data_types::names[ ch.type ] + "\"" );
+
+		std::size_t index = channel_index( name );
+
+		//A column is contiguous, so the whole range converts in one call.
+		copyFn( dest, m_arena + m_columns[index].offset + m_columns[index].stride * first, ch.arity * count );
+	}
+
+	/**
+	 * Appends particles that are interleaved in this table's layout, scattering each channel into its column.
+	 * @param src A pointer to count * get_layout().size() bytes.
+	 * @param count The number of particles to append.
+	 */
+	void append_particles( const char* src, std::size_t count ){
+		grow_for( count );
+
+		std::size_t particleSize = m_layout.size();
+		for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i ){
+			const detail::prt_channel& ch = m_layout.get_channel( m_layout.get_channel_name( i ) );
+			const std::size_t stride = m_columns[i].stride;
+
+			char* dest = m_arena + m_columns[i].offset + stride * m_size;
+			const char* it = src + ch.offset;
+			for( std::size_t j = 0; j < count; ++j, it += particleSize, dest += stride )
+				memcpy( dest, it, stride );
+		}
+
+		m_size += count;
+	}
+
+	/**
+	 * Appends particles that are interleaved in some other layout, which must have all of this table's channels with
+	 * the same types. Channels only in 'srcLayout' are skipped.
+	 * @param src A pointer to count * srcLayout.size() bytes.
+	 * @param count The number of particles to append.
+	 * @param srcLayout The layout of 'src'.
+	 */
+	void append_particles( const char* src, std::size_t count, const prt_layout& srcLayout ){
+		grow_for( count );
+
+		std::size_t particleSize = srcLayout.size();
+		for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i ){
+			const detail::prt_channel& ch = srcLayout.get_channel( m_layout.get_channel_name( i ) );
+			const std::size_t stride = m_columns[i].stride;
+
+			char* dest = m_arena + m_columns[i].offset + stride * m_size;
+			const char* it = src + ch.offset;
+			for( std::size_t j = 0; j < count; ++j, it += particleSize, dest += stride )
+				memcpy( dest, it, stride );
+		}
+
+		m_size += count;
+	}
+
+	/**
+	 * Appends every particle from another table. Both tables must have the same channels, though not necessarily in the same order.
+	 */
+	void append( const particle_table& other ){
+		std::vector<std::size_t> otherIndex = match_channels( other.m_layout );
+
+		grow_for( other.m_size );
+
+		for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i )
+			memcpy( m_arena + m_columns[i].offset + m_columns[i].stride * m_size, other.m_arena + other.m_columns[ otherIndex[i] ].offset, m_columns[i].stride * other.m_size );
+
+		m_size += other.m_size;
+	}
+
+	/**
+	 * Reads particles from a stream and appends them to the table. If the table has no channels yet it adopts the
+	 * stream's layout, otherwise the stream must have all of the table's channels. Channels the table doesn't have
+	 * are skipped, which is how a reader avoids storing channels it doesn't need.
+	 * @param in The stream to read from.
+	 * @param maxCount The maximum number of particles to read. By default the stream is read until EOF.
+	 * @return The number of particles read.
+	 */
+	std::size_t load( prt_istream& in, std::size_t maxCount = std::numeric_limits<std::size_t>::max() ){
+		if( m_layout.num_channels() == 0 ){
+			m_layout = in.get_layout();
+			m_columns.resize( m_layout.num_channels() );
+			reallocate( m_capacity );
+		}
+
+		//Channels may be in a different order in the stream, or the table may hold only some of them, in which case
+		//each channel is picked out of the stream's layout.
+		const prt_layout& inLayout = in.get_layout();
+		std::vector<std::size_t> inIndex = match_channels( inLayout, true );
+
+		bool sameOffsets = ( inLayout.size() == m_layout.size() && inLayout.num_channels() == m_layout.num_channels() );
+		for( std::size_t i = 0, iEnd = inIndex.size(); i < iEnd && sameOffsets; ++i )
+			sameOffsets = ( inLayout.get_channel( m_layout.get_channel_name( i ) ).offset == m_layout.get_channel( m_layout.get_channel_name( i ) ).offset );
+
+		data_types::int64_t remaining = in.particles_remaining();
+		if( remaining > 0 )
+			reserve( m_size + ( static_cast<data_types::uint64_t>( remaining ) < maxCount ? static_cast<std::size_t>( remaining ) : maxCount ) );
+
+		std::vector<char> buffer( block_size() * inLayout.size() );
+
+		std::size_t result = 0;
+		while( result < maxCount ){
+			std::size_t count = in.read_particle_block( &buffer[0], std::min( block_size(), maxCount - result ) );
+			if( count == 0 )
+				break;
+
+			detail::stats_timer timer( in.convert_timer() );
+			if( sameOffsets )
+				append_particles( &buffer[0], count );
+			else
+				append_particles( &buffer[0], count, inLayout );
+
+			result += count;
+		}
+
+		return result;
+	}
+
+	/**
+	 * Writes every particle in the table to a stream. Channels that the stream has not declared yet are added with the
+	 * table's type and arity; channels the stream already declared must match. The stream must not be opened yet if it
+	 * needs its layout before opening (ex. prt_ofstream), so call declare_channels() first in that case.
+	 * @param out The stream to write to.
+	 */
+	void save( prt_ostream& out ) const {
+		declare_channels( out );
+
+		const prt_layout& outLayout = out.get_layout();
+		std::size_t particleSize = outLayout.size();
+
+		std::vector<char> buffer( block_size() * particleSize );
+
+		for( std::size_t first = 0; first < m_size; first += block_size() ){
+			std::size_t count = std::min( block_size(), m_size - first );
+
+			{
+				detail::stats_timer timer( out.convert_timer() );
+
+				//Channels in the stream that the table doesn't have are written as zeros.
+				if( outLayout.num_channels() != m_layout.num_channels() )
+					memset( &buffer[0], 0, count * particleSize );
+
+				for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i ){
+					const std::size_t stride = m_columns[i].stride;
+
+					const char* src = m_arena + m_columns[i].offset + stride * first;
+					char* it = &buffer[0] + outLayout.get_channel( m_layout.get_channel_name( i ) ).offset;
+					for( std::size_t j = 0; j < count; ++j, src += stride, it += particleSize )
+						memcpy( it, src, stride );
+				}
+			}
+
+			out.write_particle_block( &buffer[0], count );
+		}
+	}
+
+	/**
+	 * Adds any of the table's channels that are missing from a stream's layout, so the stream can be opened before save() is called.
+	 * @param out The stream to declare channels on.
+	 */
+	void declare_channels( prt_ostream& out ) const {
+		for( std::size_t i = 0, iEnd = m_layout.num_channels(); i < iEnd; ++i ){
+			const std::string& name = m_layout.get_channel_name( i );
+			const detail::prt_channel& ch = m_layout.get_channel( name );
+
+			if( !out.get_layout().has_channel( name ) ){
+				out.add_channel( name, ch.type, ch.arity );
+			}else{
+				const detail::prt_channel& outCh = out.get_layout().get_channel( name );
+				if( outCh.type != ch.type || outCh.arity != ch.arity ){
+					std::stringstream ss;
+					ss << "The output stream declares channel \"" << name << "\" as " << data_types::names[ outCh.type ] << "[" << outCh.arity << "]";
+					ss << " but the table stores " << data_types::names[ ch.type ] << "[" << ch.arity << "]";
+
+					throw std::runtime_error( ss.str() );
+				}
+			}
+		}
+	}
+
+	/**
+	 * Copies the selected particles into another table, in the order given. 'result' takes this table's channels and
+	 * any particles it held are discarded.
+	 * @param indices The indices of the particles to copy. Indices may repeat.
+	 * @param result The table to fill.
+	 */
+	void gather( const std::vector<std::size_t>& indices, particle_table& result ) const {
+		if( &result == this ){
+			particle_table temp;
+			gather( indices, temp );
+			result.swap( temp );
+			return;
+		}
+
+		result.m_layout = m_layout;
+		result.m_columns.resize( m_layout.num_channels() );
+		result.m_size = 0;
+		result.reallocate( std::max( indices.size(), result.m_capacity ) );
+
+		for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i ){
+			const std::size_t stride = m_columns[i].stride;
+
+			const char* src = m_arena + m_columns[i].offset;
+			char* dest = result.m_arena + result.m_columns[i].offset;
+			for( std::vector<std::size_t>::const_iterator it = indices.begin(), itEnd = indices.end(); it != itEnd; ++it, dest += stride ){
+				if( *it >= m_size )
+					throw std::out_of_range( "The particle index is outside of the table" );
+				memcpy( dest, src + stride * (*it), stride );
+			}
+		}
+
+		result.m_size = indices.size();
+	}
+
+	/**
+	 * Removes every particle whose entry in 'keep' is zero, preserving the order of the rest.
+	 * @param keep One entry per particle in the table.
+	 * @return The number of particles left in the table.
+	 */
+	std::size_t filter( const std::vector<unsigned char>& keep ){
+		if( keep.size() != m_size )
+			throw std::runtime_error( "The filter mask does not have an entry for every particle" );
+
+		//Skip the particles that stay where they are.
+		std::size_t first = 0;
+		for( ; first < m_size && keep[first]; ++first )
+			;
+
+		std::size_t newSize = first;
+		for( std::size_t j = first; j < m_size; ++j )
+			newSize += keep[j] ? 1 : 0;
+
+		for( std::size_t i = 0, iEnd = m_columns.size(); i < iEnd; ++i ){
+			const std::size_t stride = m_columns[i].stride;
+
+			char* column = m_arena + m_columns[i].offset;
+			char* dest = column + stride * first;
+			for( std::size_t j = first; j < m_size; ++j ){
+				if( keep[j] ){
+					memcpy( dest, column + stride * j, stride );
+					dest += stride;
+				}
+			}
+		}
+
+		m_size = newSize;
+
+		return m_size;
+	}
+
+	/**
+	 * This template function removes every particle for which 'pred' returns false.
+	 * @tparam Pred A callable as bool pred( const particle_table& table, std::size_t index ).
+	 * @return The number of particles left in the table.
+	 */
+	template <class Pred>
+	std::size_t filter_if( Pred pred ){
+		std::vector<unsigned char> keep( m_size );
+		for( std::size_t i = 0; i < m_size; ++i )
+			keep[i] = pred( *this, i ) ? 1 : 0;
+		return filter( keep );
+	}
+};
+
+}//namespace prtio
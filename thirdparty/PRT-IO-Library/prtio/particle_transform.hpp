@@ -0,0 +1,308 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the transform stage that can be applied to blocks of decoded particles.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/simd.hpp>
+#include <prtio/particle_table.hpp>
+
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class re-orients particles in a particle_table. A 4x4 matrix is applied to the position channel, its upper 3x3
+ * to vector channels (ex. Velocity), and its inverse transpose to normal channels, which are renormalized. Scalar
+ * channels can be given an independent scale (ex. Density after a unit change).
+ *
+ * Matrices follow Houdini's row vector convention: a point p becomes p * M, so the translation is in the last row.
+ *
+ * Each channel is processed in cache sized chunks that are converted to float32, transformed four particles per SSE2
+ * instruction, and converted back to the channel's own type before moving on. The conversion and the transform share
+ * one pass over the column, so the stage costs no more memory traffic than converting the channel would. float64
+ * channels are instead transformed in place in double precision, so they keep the precision they were stored with.
+ */
+class particle_transform{
+	float m_matrix[16];
+	float m_normalMatrix[9];
+	double m_doubleMatrix[16];      //The same matrices in double precision, for float64 channels.
+	double m_doubleNormalMatrix[9];
+	bool m_hasMatrix;
+
+	std::string m_positionChannel;
+	std::vector<std::string> m_vectorChannels;
+	std::vector<std::string> m_normalChannels;
+	std::vector< std::pair<std::string, double> > m_scales;
+
+	std::vector<float> m_aos, m_x, m_y, m_z;
+
+private:
+	//The number of particles transformed per chunk. Small enough that every scratch array stays in L1/L2.
+	static std::size_t chunk_size(){
+		return 1024;
+	}
+
+	/**
+	 * Computes (x,y,z,w) * M in place, using rows 0-2 of 'm' for the linear part and, if 'w' is non-zero, row 3 for the translation.
+	 * @param m A row-major 4x4 matrix, or a 3x3 matrix when 'stride' is 3.
+	 */
+	static void transform_soa( const float* m, std::size_t stride, bool translate, float* x, float* y, float* z, std::size_t count ){
+		const float m00 = m[0], m01 = m[1], m02 = m[2];
+		const float m10 = m[stride], m11 = m[stride+1], m12 = m[stride+2];
+		const float m20 = m[2*stride], m21 = m[2*stride+1], m22 = m[2*stride+2];
+		const float t0 = translate ? m[12] : 0.f, t1 = translate ? m[13] : 0.f, t2 = translate ? m[14] : 0.f;
+
+		std::size_t i = 0;
+#ifdef PRTIO_USE_SSE2
+		const __m128 a00 = _mm_set1_ps( m00 ), a01 = _mm_set1_ps( m01 ), a02 = _mm_set1_ps( m02 );
+		const __m128 a10 = _mm_set1_ps( m10 ), a11 = _mm_set1_ps( m11 ), a12 = _mm_set1_ps( m12 );
+		const __m128 a20 = _mm_set1_ps( m20 ), a21 = _mm_set1_ps( m21 ), a22 = _mm_set1_ps( m22 );
+		const __m128 b0 = _mm_set1_ps( t0 ), b1 = _mm_set1_ps( t1 ), b2 = _mm_set1_ps( t2 );
+		for( ; i + 4 <= count; i += 4 ){
+			__m128 px = _mm_loadu_ps( x + i ), py = _mm_loadu_ps( y + i ), pz = _mm_loadu_ps( z + i );
+			__m128 rx = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, a00 ), _mm_mul_ps( py, a10 ) ), _mm_add_ps( _mm_mul_ps( pz, a20 ), b0 ) );
+			__m128 ry = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, a01 ), _mm_mul_ps( py, a11 ) ), _mm_add_ps( _mm_mul_ps( pz, a21 ), b1 ) );
+			__m128 rz = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, a02 ), _mm_mul_ps( py, a12 ) ), _mm_add_ps( _mm_mul_ps( pz, a22 ), b2 ) );
+			_mm_storeu_ps( x + i, rx );
+			_mm_storeu_ps( y + i, ry );
+			_mm_storeu_ps( z + i, rz );
+		}
+#endif
+		for( ; i < count; ++i ){
+			float px = x[i], py = y[i], pz = z[i];
+			x[i] = px * m00 + py * m10 + pz * m20 + t0;
+			y[i] = px * m01 + py * m11 + pz * m21 + t1;
+			z[i] = px * m02 + py * m12 + pz * m22 + t2;
+		}
+	}
+
+	static void normalize_soa( float* x, float* y, float* z, std::size_t count ){
+		for( std::size_t i = 0; i < count; ++i ){
+			float len = std::sqrt( x[i] * x[i] + y[i] * y[i] + z[i] * z[i] );
+			float scale = len > 0.f ? 1.f / len : 0.f;
+			x[i] *= scale;
+			y[i] *= scale;
+			z[i] *= scale;
+		}
+	}
+
+	static void scale_aos( float* values, std::size_t count, float scale ){
+		std::size_t i = 0;
+#ifdef PRTIO_USE_SSE2
+		const __m128 s = _mm_set1_ps( scale );
+		for( ; i + 4 <= count; i += 4 )
+			_mm_storeu_ps( values + i, _mm_mul_ps( _mm_loadu_ps( values + i ), s ) );
+#endif
+		for( ; i < count; ++i )
+			values[i] *= scale;
+	}
+
+	enum kind_t{ kind_point, kind_vector, kind_normal, kind_scale };
+
+	/**
+	 * Transforms a float64 channel in place, in double precision.
+	 */
+	void apply_channel_double( particle_table& table, const std::string& name, kind_t kind, double scale ){
+		const std::size_t arity = table.get_layout().get_channel( name ).arity;
+		double* values = static_cast<double*>( table.get_column( table.channel_index( name ) ) );
+		const std::size_t size = table.size();
+
+		if( kind == kind_scale ){
+			for( std::size_t i = 0, iEnd = size * arity; i < iEnd; ++i )
+				values[i] *= scale;
+			return;
+		}
+
+		const double* m = ( kind == kind_normal ) ? m_doubleNormalMatrix : m_doubleMatrix;
+		const std::size_t stride = ( kind == kind_normal ) ? 3 : 4;
+		const double t0 = ( kind == kind_point ) ? m[12] : 0.0, t1 = ( kind == kind_point ) ? m[13] : 0.0, t2 = ( kind == kind_point ) ? m[14] : 0.0;
+
+		for( std::size_t i = 0; i < size; ++i, values += 3 ){
+			const double px = values[0], py = values[1], pz = values[2];
+			double x = px * m[0] + py * m[stride] + pz * m[2*stride] + t0;
+			double y = px * m[1] + py * m[stride+1] + pz * m[2*stride+1] + t1;
+			double z = px * m[2] + py * m[stride+2] + pz * m[2*stride+2] + t2;
+
+			if( kind == kind_normal ){
+				const double len = std::sqrt( x * x + y * y + z * z );
+				const double s = len > 0.0 ? 1.0 / len : 0.0;
+				x *= s;
+				y *= s;
+				z *= s;
+			}
+
+			values[0] = x;
+			values[1] = y;
+			values[2] = z;
+		}
+	}
+
+	/**
+	 * Runs one channel of the table through the convert-transform-convert pipeline, a chunk at a time.
+	 */
+	void apply_channel( particle_table& table, const std::string& name, kind_t kind, double scale ){
+		const detail::prt_channel& ch = table.get_layout().get_channel( name );
+		if( !detail::is_float( ch.type ) )
+			throw std::runtime_error( "Cannot transform the channel \"" + name + "\" since it is stored as " + data_types::names[ ch.type ] );
+		if( kind != kind_scale && ch.arity != 3 )
+			throw std::runtime_error( "Cannot transform the channel \"" + name + "\" since it is not a 3-vector" );
+
+		if( ch.type == data_types::type_float64 ){
+			apply_channel_double( table, name, kind, scale );
+			return;
+		}
+
+		detail::convert_fn_t storeFn = detail::get_write_converter<float>( ch.type );
+		const std::size_t stride = data_types::sizes[ ch.type ] * ch.arity;
+		char* column = static_cast<char*>( table.get_column( table.channel_index( name ) ) );
+
+		const std::size_t chunk = chunk_size();
+		m_aos.resize( chunk * ch.arity );
+		m_x.resize( chunk );
+		m_y.resize( chunk );
+		m_z.resize( chunk );
+
+		for( std::size_t first = 0, size = table.size(); first < size; first += chunk ){
+			const std::size_t count = std::min( chunk, size - first );
+
+			table.copy_channel( name, &m_aos[0], first, count );
+
+			if( kind == kind_scale ){
+				scale_aos( &m_aos[0], count * ch.arity, static_cast<float>( scale ) );
+			}else{
+				detail::deinterleave3( &m_aos[0], count, &m_x[0], &m_y[0], &m_z[0] );
+				if( kind == kind_normal ){
+					transform_soa( m_normalMatrix, 3, false, &m_x[0], &m_y[0], &m_z[0], count );
+					normalize_soa( &m_x[0], &m_y[0], &m_z[0], count );
+				}else{
+					transform_soa( m_matrix, 4, kind == kind_point, &m_x[0], &m_y[0], &m_z[0], count );
+				}
+				detail::interleave3( &m_x[0], &m_y[0], &m_z[0], count, &m_aos[0] );
+			}
+
+			storeFn( column + stride * first, &m_aos[0], count * ch.arity );
+		}
+	}
+
+public:
+	/**
+	 * Creates an identity transform. Velocity is treated as a vector channel and Normal as a normal channel by default.
+	 */
+	particle_transform() : m_hasMatrix( false ), m_positionChannel( "Position" ){
+		for( int i = 0; i < 16; ++i ){
+			m_matrix[i] = ( i % 5 == 0 ) ? 1.f : 0.f;
+			m_doubleMatrix[i] = m_matrix[i];
+		}
+		for( int i = 0; i < 9; ++i ){
+			m_normalMatrix[i] = ( i % 4 == 0 ) ? 1.f : 0.f;
+			m_doubleNormalMatrix[i] = m_normalMatrix[i];
+		}
+
+		m_vectorChannels.push_back( "Velocity" );
+		m_normalChannels.push_back( "Normal" );
+	}
+
+	/**
+	 * Sets the matrix applied to positions, vectors and normals.
+	 * @param m A row-major 4x4 matrix in the row vector convention, with the translation in m[12], m[13], m[14].
+	 */
+	void set_matrix( const double m[16] ){
+		for( int i = 0; i < 16; ++i ){
+			m_doubleMatrix[i] = m[i];
+			m_matrix[i] = static_cast<float>( m[i] );
+		}
+
+		//Normals use the inverse transpose of the upper 3x3, computed from its cofactors. The determinant only
+		//scales the result, which the renormalization removes, but its sign must be kept so mirroring flips normals.
+		const double a = m[0], b = m[1], c = m[2], d = m[4], e = m[5], f = m[6], g = m[8], h = m[9], k = m[10];
+		const double cof[9] = {
+			e * k - f * h, f * g - d * k, d * h - e * g,
+			c * h - b * k, a * k - c * g, b * g - a * h,
+			b * f - c * e, c * d - a * f, a * e - b * d
+		};
+		const double det = a * cof[0] + b * cof[1] + c * cof[2];
+		for( int i = 0; i < 9; ++i ){
+			m_doubleNormalMatrix[i] = det < 0 ? -cof[i] : cof[i];
+			m_normalMatrix[i] = static_cast<float>( m_doubleNormalMatrix[i] );
+		}
+
+		m_hasMatrix = true;
+	}
+
+	void set_position_channel( const std::string& name ){
+		m_positionChannel = name;
+	}
+
+	/**
+	 * Adds a channel that receives only the rotation/scale part of the matrix, like Velocity.
+	 */
+	void add_vector_channel( const std::string& name ){
+		m_vectorChannels.push_back( name );
+	}
+
+	/**
+	 * Adds a channel that is transformed as a surface normal and renormalized.
+	 */
+	void add_normal_channel( const std::string& name ){
+		m_normalChannels.push_back( name );
+	}
+
+	/**
+	 * Multiplies every element of a floating point channel by 'scale', independent of the matrix.
+	 */
+	void add_scale( const std::string& name, double scale ){
+		m_scales.push_back( std::make_pair( name, scale ) );
+	}
+
+	/**
+	 * @return True if the transform would leave every particle unchanged.
+	 */
+	bool empty() const {
+		return !m_hasMatrix && m_scales.empty();
+	}
+
+	/**
+	 * Transforms every particle in the table in place. Channels that the table doesn't have are skipped.
+	 */
+	void apply( particle_table& table ){
+		if( table.empty() )
+			return;
+
+		if( m_hasMatrix ){
+			if( table.has_channel( m_positionChannel ) )
+				apply_channel( table, m_positionChannel, kind_point, 1.0 );
+			for( std::vector<std::string>::const_iterator it = m_vectorChannels.begin(), itEnd = m_vectorChannels.end(); it != itEnd; ++it ){
+				if( table.has_channel( *it ) )
+					apply_channel( table, *it, kind_vector, 1.0 );
+			}
+			for( std::vector<std::string>::const_iterator it = m_normalChannels.begin(), itEnd = m_normalChannels.end(); it != itEnd; ++it ){
+				if( table.has_channel( *it ) )
+					apply_channel( table, *it, kind_normal, 1.0 );
+			}
+		}
+
+		for( std::vector< std::pair<std::string, double> >::const_iterator it = m_scales.begin(), itEnd = m_scales.end(); it != itEnd; ++it ){
+			if( table.has_channel( it->first ) )
+				apply_channel( table, it->first, kind_scale, it->second );
+		}
+	}
+};
+
+}//namespace prtio
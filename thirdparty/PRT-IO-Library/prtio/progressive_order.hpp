@@ -0,0 +1,149 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains functions for reordering particles so that any prefix of the stream is a spatially uniform
+ * subsample of the whole, which lets previews stop decoding early.
+ */
+
+#pragma once
+
+#include <prtio/particle_table.hpp>
+#include <prtio/prt_ostream.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace prtio{
+
+namespace detail{
+	/**
+	 * Spreads the low 21 bits of 'v' so there are two zero bits between each, for interleaving into a Morton code.
+	 */
+	inline data_types::uint64_t spread_bits3( data_types::uint64_t v ){
+		v &= 0x1fffff;
+		v = ( v | ( v << 32 ) ) & 0x1f00000000ffffULL;
+		v = ( v | ( v << 16 ) ) & 0x1f0000ff0000ffULL;
+		v = ( v | ( v << 8 ) ) & 0x100f00f00f00f00fULL;
+		v = ( v | ( v << 4 ) ) & 0x10c30c30c30c30c3ULL;
+		v = ( v | ( v << 2 ) ) & 0x1249249249249249ULL;
+		return v;
+	}
+
+	/**
+	 * Reverses the order of the low 'bits' bits of 'v'.
+	 */
+	inline data_types::uint64_t reverse_bits( data_types::uint64_t v, int bits ){
+		data_types::uint64_t result = 0;
+		for( int i = 0; i < bits; ++i, v >>= 1 )
+			result = ( result << 1 ) | ( v & 1 );
+		return result;
+	}
+}//namespace detail
+
+/**
+ * Computes a progressive order for the particles of a table. The particles are first sorted along a Morton (Z-order)
+ * curve through their bounding box, which places spatial neighbours next to each other. They are then emitted in
+ * bit-reversed order of their rank along that curve: the first particle comes from the start of the curve, the next
+ * from the middle, then the quarter points, and so on. This is a hierarchical stratification of the curve, so the
+ * first K particles take one particle from each of K equal runs of the curve and cover the bounding box uniformly.
+ * @param table The particles to order.
+ * @param order Receives a permutation of [0, table.size()), for use with particle_table::gather().
+ * @param positionChannel The name of the 3-vector channel that gives each particle's location.
+ */
+inline void progressive_order( const particle_table& table, std::vector<std::size_t>& order, const std::string& positionChannel = "Position" ){
+	const std::size_t count = table.size();
+
+	order.clear();
+	if( count == 0 )
+		return;
+
+	if( table.get_layout().get_channel( positionChannel ).arity != 3 )
+		throw std::runtime_error( "The position channel \"" + positionChannel + "\" must have an arity of 3 for a progressive order" );
+
+	std::vector<float> pos( 3 * count );
+	table.copy_channel( positionChannel, &pos[0], 0, count );
+
+	float minimum[3], maximum[3];
+	for( int axis = 0; axis < 3; ++axis ){
+		minimum[axis] = std::numeric_limits<float>::max();
+		maximum[axis] = -std::numeric_limits<float>::max();
+	}
+	for( std::size_t i = 0; i < count; ++i ){
+		for( int axis = 0; axis < 3; ++axis ){
+			minimum[axis] = std::min( minimum[axis], pos[3*i+axis] );
+			maximum[axis] = std::max( maximum[axis], pos[3*i+axis] );
+		}
+	}
+
+	//Quantize to a 2^21 grid per axis, which fills a 63 bit Morton code.
+	double scale[3];
+	for( int axis = 0; axis < 3; ++axis ){
+		double extent = static_cast<double>( maximum[axis] ) - static_cast<double>( minimum[axis] );
+		scale[axis] = extent > 0 ? 2097151.0 / extent : 0.0;
+	}
+
+	std::vector< std::pair<data_types::uint64_t, std::size_t> > curve( count );
+	for( std::size_t i = 0; i < count; ++i ){
+		data_types::uint64_t code = 0;
+		for( int axis = 0; axis < 3; ++axis ){
+			double cell = ( static_cast<double>( pos[3*i+axis] ) - minimum[axis] ) * scale[axis];
+			//NaN positions compare false everywhere, so they land in cell 0 rather than producing undefined casts.
+			data_types::uint64_t q = ( cell > 0 ) ? static_cast<data_types::uint64_t>( std::min( cell, 2097151.0 ) ) : 0;
+			code |= detail::spread_bits3( q ) << axis;
+		}
+		curve[i] = std::make_pair( code, i );
+	}
+	std::sort( curve.begin(), curve.end() );
+
+	int bits = 0;
+	while( ( static_cast<data_types::uint64_t>( 1 ) << bits ) < count )
+		++bits;
+
+	order.reserve( count );
+	for( data_types::uint64_t k = 0, kEnd = static_cast<data_types::uint64_t>( 1 ) << bits; k < kEnd; ++k ){
+		data_types::uint64_t rank = detail::reverse_bits( k, bits );
+		if( rank < count )
+			order.push_back( curve[ static_cast<std::size_t>( rank ) ].second );
+	}
+}
+
+/**
+ * Reorders a table in place into progressive order. See progressive_order().
+ */
+inline void make_progressive( particle_table& table, const std::string& positionChannel = "Position" ){
+	std::vector<std::size_t> order;
+	progressive_order( table, order, positionChannel );
+	table.gather( order, table );
+}
+
+/**
+ * Writes a table to a stream in progressive order, leaving the table unchanged. The result is an ordinary PRT stream;
+ * readers that stop after the first K particles get a uniform subsample.
+ * @param table The particles to write.
+ * @param out The stream to write to. As with particle_table::save(), a prt_ofstream must have had
+ *            particle_table::declare_channels() called before it was opened.
+ */
+inline void write_progressive( const particle_table& table, prt_ostream& out, const std::string& positionChannel = "Position" ){
+	std::vector<std::size_t> order;
+	progressive_order( table, order, positionChannel );
+
+	particle_table reordered;
+	table.gather( order, reordered );
+	reordered.save( out );
+}
+
+}//namespace prtio
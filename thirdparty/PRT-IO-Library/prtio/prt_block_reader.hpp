@@ -0,0 +1,112 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the block-at-a-time read path, which decodes particles into a particle_table and runs the
+ * optional processing stages over each block before the caller extracts it.
+ */
+
+#pragma once
+
+#include <prtio/particle_filter.hpp>
+#include <prtio/particle_table.hpp>
+#include <prtio/particle_transform.hpp>
+#include <prtio/prt_istream.hpp>
+
+namespace prtio{
+
+/**
+ * This class reads a prt_istream one block at a time. Each block is decoded into a particle_table, then any particles
+ * rejected by the filter stage are compacted away, so the caller only ever extracts the survivors. The transform stage
+ * runs last, so filter predicates are expressed in the file's space and only survivors are transformed.
+ */
+class prt_block_reader{
+	prt_istream* m_stream;
+	std::size_t m_blockSize;
+
+	particle_filter* m_filter;
+	particle_transform* m_transform;
+
+	data_types::int64_t m_decoded;      //The number of particles decoded from the stream so far, before filtering.
+	data_types::int64_t m_maxParticles; //The number of particles to decode before stopping, or -1 to read the whole stream.
+
+public:
+	/**
+	 * @param stream The stream to read from. It must remain open for the lifetime of the reader.
+	 * @param blockSize The number of particles decoded per block.
+	 */
+	explicit prt_block_reader( prt_istream& stream, std::size_t blockSize = 65536 )
+		: m_stream( &stream ), m_blockSize( blockSize ), m_filter( NULL ), m_transform( NULL ), m_decoded( 0 ), m_maxParticles( -1 )
+	{}
+
+	/**
+	 * Sets the filter stage, which removes particles from each block before it is returned. Pass NULL to disable it.
+	 * The filter must remain valid for the lifetime of the reader.
+	 */
+	void set_filter( particle_filter* filter ){
+		m_filter = filter;
+	}
+
+	/**
+	 * Sets the transform stage, which re-orients the particles of each block after filtering. Pass NULL to disable it.
+	 * The transform must remain valid for the lifetime of the reader.
+	 */
+	void set_transform( particle_transform* transform ){
+		m_transform = transform;
+	}
+
+	/**
+	 * Stops decoding after 'count' particles, as if the stream ended there. Nothing past that point is decompressed,
+	 * so reading a prefix of a progressively ordered file (see progressive_order.hpp) costs time proportional to the prefix.
+	 * @param count The number of particles to decode, or -1 to read the whole stream.
+	 */
+	void set_max_particles( data_types::int64_t count ){
+		m_maxParticles = count;
+	}
+
+	/**
+	 * @return The number of particles decoded from the stream so far, including those removed by the filter.
+	 */
+	data_types::int64_t particles_decoded() const {
+		return m_decoded;
+	}
+
+	/**
+	 * Decodes the next block of particles and runs the processing stages over it. The block may come back empty if
+	 * every particle in it was filtered out, so use the return value to detect the end of the stream.
+	 * @param block The table to fill. Any particles it held are discarded, but its arena is reused.
+	 * @return False if the stream had no more particles, true otherwise.
+	 */
+	bool read_next_block( particle_table& block ){
+		block.clear();
+
+		std::size_t toRead = m_blockSize;
+		if( m_maxParticles >= 0 && static_cast<data_types::int64_t>( toRead ) > m_maxParticles - m_decoded )
+			toRead = static_cast<std::size_t>( m_maxParticles - m_decoded );
+
+		std::size_t count = ( toRead > 0 ) ? block.load( *m_stream, toRead ) : 0;
+		if( count == 0 )
+			return false;
+
+		m_decoded += static_cast<data_types::int64_t>( count );
+
+		if( m_filter )
+			m_filter->apply( block );
+
+		if( m_transform )
+			m_transform->apply( block );
+
+		return true;
+	}
+};
+
+}//namespace prtio
@@ -0,0 +1,602 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a class for summarizing many PRT files, with a persistent cache of the results.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/quantize.hpp>
+#include <prtio/detail/simd.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This struct holds what prt_catalog learned about one file.
+ */
+struct prt_file_info{
+	std::string path;
+	data_types::uint64_t fileSize;
+	data_types::int64_t modifiedTime;        //Seconds since the epoch.
+	data_types::int64_t modifiedNanoseconds; //The fraction of the second, where the file system records it.
+
+	data_types::int64_t particleCount;
+	prt_layout layout;
+
+	//The range of every component of every channel, indexed by the channel's position in 'layout'. Only filled in
+	//when 'hasStats' is true.
+	bool hasStats;
+	std::vector< std::vector<double> > minimum, maximum;
+
+	bool cached;       //True if this came from the cache rather than the file.
+	std::string error; //Non-empty if the file couldn't be read, in which case the fields above are unset.
+
+	prt_file_info() : fileSize( 0 ), modifiedTime( 0 ), modifiedNanoseconds( 0 ), particleCount( 0 ), hasStats( false ), cached( false )
+	{}
+};
+
+/**
+ * This class gathers particle counts, channel lists and optionally per-channel ranges for a list of PRT files.
+ *
+ * Only the uncompressed header of each file is read, without setting up a decompressor, and the files are read on a
+ * thread pool. Channel ranges need every particle decoded, so they are only computed on request, in one pass per file
+ * that takes the min/max of four floats per SSE instruction (see detail::minmax_interleaved()).
+ *
+ * Results can be kept in a cache file keyed by each file's absolute path (with symbolic links resolved, so a file
+ * named two ways has one entry), size and modification time to the nanosecond. Cached entries are served without
+ * opening the file, and ranges computed once are reused by later runs. The cache is a plain text file; it is rewritten
+ * to a temporary name and renamed into place, and entries written concurrently by another process are merged rather
+ * than lost. The merge holds an flock() on a ".lock" file next to the cache, so processes on one host (or sharing a
+ * file system whose locks work across hosts) don't overwrite each other's entries. The lock file is left in place:
+ * deleting it while another process waits on it would let a third process lock a new file at the same path. On
+ * Windows the merge isn't locked.
+ */
+class prt_catalog{
+	std::string m_cacheFile;
+	std::map<std::string, prt_file_info> m_cache;
+	bool m_cacheDirty;
+
+	unsigned m_threads;
+	bool m_computeStats;
+
+private:
+	static const char* cache_signature(){
+		return "prtio-catalog 2";
+	}
+
+	/**
+	 * @return The absolute path of a file with symbolic links resolved, or 'path' itself if it doesn't exist.
+	 */
+	static std::string canonical_path( const std::string& path ){
+#ifndef _WIN32
+		char* resolved = realpath( path.c_str(), NULL );
+#else
+		char* resolved = _fullpath( NULL, path.c_str(), 0 );
+#endif
+		if( !resolved )
+			return path;
+
+		std::string result( resolved );
+		std::free( resolved );
+		return result;
+	}
+
+	/**
+	 * @return The nanoseconds part of a file's modification time, or 0 where stat() only has whole seconds.
+	 */
+	static data_types::int64_t modified_nanoseconds( const struct stat& st ){
+#if defined( __APPLE__ )
+		return static_cast<data_types::int64_t>( st.st_mtimespec.tv_nsec );
+#elif defined( _WIN32 )
+		(void)st;
+		return 0;
+#else
+		return static_cast<data_types::int64_t>( st.st_mtim.tv_nsec );
+#endif
+	}
+
+	/**
+	 * @return True if 'a' was modified before 'b'.
+	 */
+	static bool modified_before( const prt_file_info& a, const prt_file_info& b ){
+		if( a.modifiedTime != b.modifiedTime )
+			return a.modifiedTime < b.modifiedTime;
+		return a.modifiedNanoseconds < b.modifiedNanoseconds;
+	}
+
+	/**
+	 * Holds an exclusive lock on the cache's lock file while in scope.
+	 */
+	class cache_lock{
+		int m_fd;
+
+		cache_lock( const cache_lock& );
+		cache_lock& operator=( const cache_lock& );
+
+	public:
+		explicit cache_lock( const std::string& cacheFile ) : m_fd( -1 ) {
+#ifndef _WIN32
+			std::string lockFile = cacheFile + ".lock";
+			m_fd = ::open( lockFile.c_str(), O_RDWR | O_CREAT, 0666 );
+			if( m_fd < 0 )
+				throw std::ios_base::failure( "Failed to open the lock file \"" + lockFile + "\"" );
+			while( flock( m_fd, LOCK_EX ) != 0 ){
+				if( errno != EINTR ){
+					::close( m_fd );
+					throw std::ios_base::failure( "Failed to lock the cache file \"" + cacheFile + "\"" );
+				}
+			}
+#endif
+		}
+
+		~cache_lock(){
+#ifndef _WIN32
+			flock( m_fd, LOCK_UN );
+			::close( m_fd );
+#endif
+		}
+	};
+
+	/**
+	 * Reads a range from a cache line. An empty file's range is infinite, which operator>> doesn't parse, so the
+	 * value is read as a word and converted with strtod().
+	 */
+	static bool read_cache_number( std::istream& in, double& value ){
+		std::string word;
+		if( !( in >> word ) )
+			return false;
+
+		char* end;
+		value = std::strtod( word.c_str(), &end );
+		if( word.empty() || *end != '\0' ){
+			in.setstate( std::ios::failbit );
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Writes a range to a cache line, spelling out infinity and NaN the way read_cache_number() parses them rather
+	 * than however the standard library prints them.
+	 */
+	static void write_cache_number( std::ostream& out, double value ){
+		if( value != value )
+			out << "nan";
+		else if( value > std::numeric_limits<double>::max() )
+			out << "inf";
+		else if( value < -std::numeric_limits<double>::max() )
+			out << "-inf";
+		else
+			out << value;
+	}
+
+	/**
+	 * Reads the entries of a cache file into 'cache', keyed by their canonical paths. A missing or unrecognized file
+	 * (including one from an older version) is treated as empty.
+	 */
+	static void read_cache( const std::string& file, std::map<std::string, prt_file_info>& cache ){
+		std::ifstream fin( file.c_str() );
+		std::string line;
+		if( !std::getline( fin, line ) || line != cache_signature() )
+			return;
+
+		//Each line is the path, a tab, then space separated fields.
+		while( std::getline( fin, line ) ){
+			std::string::size_type tab = line.find( '\t' );
+			if( tab == std::string::npos )
+				continue;
+
+			prt_file_info info;
+			info.path = line.substr( 0, tab );
+			info.cached = true;
+
+			std::istringstream ss( line.substr( tab + 1 ) );
+			std::size_t channelCount = 0;
+			int hasStats = 0;
+			ss >> info.fileSize >> info.modifiedTime >> info.modifiedNanoseconds >> info.particleCount >> hasStats >> channelCount;
+
+			for( std::size_t i = 0; i < channelCount && ss; ++i ){
+				std::string name;
+				int type;
+				std::size_t arity, offset;
+				ss >> name >> type >> arity >> offset;
+				if( ss && type >= 0 && type < data_types::type_count )
+					info.layout.add_channel( name, static_cast<data_types::enum_t>( type ), arity, offset );
+			}
+
+			if( hasStats ){
+				info.minimum.resize( channelCount );
+				info.maximum.resize( channelCount );
+				for( std::size_t i = 0; i < channelCount && ss; ++i ){
+					std::size_t arity = info.layout.get_channel( info.layout.get_channel_name( i ) ).arity;
+					info.minimum[i].resize( arity );
+					info.maximum[i].resize( arity );
+					for( std::size_t j = 0; j < arity; ++j ){
+						read_cache_number( ss, info.minimum[i][j] );
+						read_cache_number( ss, info.maximum[i][j] );
+					}
+				}
+				info.hasStats = true;
+			}
+
+			//Skip lines that were cut short, ex. by a full disk.
+			if( ss && info.layout.num_channels() == channelCount )
+				cache[info.path] = info;
+		}
+	}
+
+	static void write_cache_entry( std::ostream& out, const prt_file_info& info ){
+		out << info.path << '\t' << info.fileSize << ' ' << info.modifiedTime << ' ' << info.modifiedNanoseconds << ' ' << info.particleCount << ' '
+		    << ( info.hasStats ? 1 : 0 ) << ' ' << info.layout.num_channels();
+
+		for( std::size_t i = 0, iEnd = info.layout.num_channels(); i < iEnd; ++i ){
+			const std::string& name = info.layout.get_channel_name( i );
+			const detail::prt_channel& ch = info.layout.get_channel( name );
+			out << ' ' << name << ' ' << static_cast<int>( ch.type ) << ' ' << ch.arity << ' ' << ch.offset;
+		}
+
+		if( info.hasStats ){
+			for( std::size_t i = 0, iEnd = info.minimum.size(); i < iEnd; ++i ){
+				for( std::size_t j = 0, jEnd = info.minimum[i].size(); j < jEnd; ++j ){
+					out << ' ';
+					write_cache_number( out, info.minimum[i][j] );
+					out << ' ';
+					write_cache_number( out, info.maximum[i][j] );
+				}
+			}
+		}
+
+		out << '\n';
+	}
+
+	/**
+	 * Reads a file's header, and its channel ranges if requested, into 'info'. Errors are recorded in 'info'.
+	 */
+	void read_file( prt_file_info& info ) const {
+		try{
+			{
+				std::ifstream fin( info.path.c_str(), std::ios::in | std::ios::binary );
+				if( fin.fail() )
+					throw std::ios_base::failure( "Unable to open file \"" + info.path + "\"" );
+				prt_metadata metadata;
+				info.particleCount = detail::read_prt_header( fin, info.path, info.layout, &metadata );
+				if( !fin )
+					throw std::runtime_error( "The input stream \"" + info.path + "\" has a truncated header." );
+
+				//Fixed point channels are listed as the floats that prt_ifstream reads them back as.
+				detail::particle_quantizer quantizer;
+				quantizer.init_read( info.layout, metadata, info.path );
+			}
+
+			if( m_computeStats )
+				compute_stats( info );
+		}catch( const std::exception& e ){
+			info.error = e.what();
+		}
+	}
+
+	/**
+	 * @return True if a channel's range is found in float32 by the SIMD kernel, which is exact for float16 and float32.
+	 */
+	static bool is_simd_channel( data_types::enum_t type ){
+		return type == data_types::type_float16 || type == data_types::type_float32;
+	}
+
+	static void compute_stats( prt_file_info& info ){
+		prt_ifstream in( info.path );
+		const prt_layout& layout = in.get_layout();
+		const std::size_t particleSize = layout.size();
+		const std::size_t numChannels = layout.num_channels();
+
+		//float16 and float32 channels are converted to float32 for the SIMD kernel. float64 and integer channels are
+		//kept exact in double, and tracked with scalar code since they are rarely more than an ID or a time.
+		std::vector< std::vector<float> > floatMin( numChannels ), floatMax( numChannels );
+		info.minimum.assign( numChannels, std::vector<double>() );
+		info.maximum.assign( numChannels, std::vector<double>() );
+		for( std::size_t i = 0; i < numChannels; ++i ){
+			const detail::prt_channel& ch = layout.get_channel( layout.get_channel_name( i ) );
+			floatMin[i].assign( ch.arity, std::numeric_limits<float>::infinity() );
+			floatMax[i].assign( ch.arity, -std::numeric_limits<float>::infinity() );
+			info.minimum[i].assign( ch.arity, std::numeric_limits<double>::infinity() );
+			info.maximum[i].assign( ch.arity, -std::numeric_limits<double>::infinity() );
+		}
+
+		const std::size_t blockCount = 4096;
+		std::vector<char> buffer( blockCount * particleSize );
+		std::vector<float> floats;
+		std::vector<double> doubles;
+
+		for( std::size_t count; ( count = in.read_particle_block( &buffer[0], blockCount ) ) > 0; ){
+			for( std::size_t i = 0; i < numChannels; ++i ){
+				const detail::prt_channel& ch = layout.get_channel( layout.get_channel_name( i ) );
+				const char* src = &buffer[0] + ch.offset;
+
+				if( is_simd_channel( ch.type ) ){
+					detail::convert_fn_t fn = detail::get_read_converter<float>( ch.type );
+					floats.resize( count * ch.arity );
+					for( std::size_t j = 0; j < count; ++j, src += particleSize )
+						fn( &floats[j * ch.arity], src, ch.arity );
+					detail::minmax_interleaved( &floats[0], count, ch.arity, &floatMin[i][0], &floatMax[i][0] );
+				}else{
+					detail::convert_fn_t fn = detail::get_read_converter<double>( ch.type );
+					doubles.resize( ch.arity );
+					for( std::size_t j = 0; j < count; ++j, src += particleSize ){
+						fn( &doubles[0], src, ch.arity );
+						for( std::size_t k = 0; k < ch.arity; ++k ){
+							info.minimum[i][k] = std::min( info.minimum[i][k], doubles[k] );
+							info.maximum[i][k] = std::max( info.maximum[i][k], doubles[k] );
+						}
+					}
+				}
+			}
+		}
+
+		for( std::size_t i = 0; i < numChannels; ++i ){
+			if( is_simd_channel( layout.get_channel( layout.get_channel_name( i ) ).type ) ){
+				for( std::size_t k = 0, kEnd = floatMin[i].size(); k < kEnd; ++k ){
+					info.minimum[i][k] = floatMin[i][k];
+					info.maximum[i][k] = floatMax[i][k];
+				}
+			}
+		}
+
+		info.hasStats = true;
+	}
+
+	static void write_json_string( std::ostream& out, const std::string& s ){
+		out << '"';
+		for( std::string::const_iterator it = s.begin(), itEnd = s.end(); it != itEnd; ++it ){
+			unsigned char c = static_cast<unsigned char>( *it );
+			if( c == '"' || c == '\\' ){
+				out << '\\' << *it;
+			}else if( c < 0x20 ){
+				char escaped[8];
+				sprintf( escaped, "\\u%04x", c );
+				out << escaped;
+			}else{
+				out << *it;
+			}
+		}
+		out << '"';
+	}
+
+	//JSON has no representation for infinity or NaN, which an empty file or a bad particle can produce.
+	static void write_json_number( std::ostream& out, double value ){
+		if( value == value && std::fabs( value ) <= std::numeric_limits<double>::max() ){
+			char buffer[32];
+			sprintf( buffer, "%.9g", value );
+			out << buffer;
+		}else{
+			out << "null";
+		}
+	}
+
+	static void write_json_array( std::ostream& out, const std::vector<double>& values ){
+		out << '[';
+		for( std::size_t i = 0, iEnd = values.size(); i < iEnd; ++i ){
+			if( i > 0 )
+				out << ',';
+			write_json_number( out, values[i] );
+		}
+		out << ']';
+	}
+
+public:
+	prt_catalog() : m_cacheDirty( false ), m_threads( 0 ), m_computeStats( false )
+	{}
+
+	/**
+	 * Sets the maximum number of threads to use, or 0 for one per core.
+	 */
+	void set_threads( unsigned threads ){
+		m_threads = threads;
+	}
+
+	/**
+	 * Requests the range of every channel. This decodes every particle of files whose ranges aren't cached yet.
+	 */
+	void set_compute_stats( bool computeStats ){
+		m_computeStats = computeStats;
+	}
+
+	/**
+	 * Uses a cache file, loading any entries it already has. It is created by save_cache() if it doesn't exist.
+	 */
+	void set_cache_file( const std::string& file ){
+		m_cacheFile = file;
+		m_cache.clear();
+		read_cache( file, m_cache );
+		m_cacheDirty = false;
+	}
+
+	/**
+	 * Gathers information about a list of files. Entries whose canonical path, size and modification time match the
+	 * cache are taken from it; everything else is read from disk and added to the cache.
+	 * @param paths The files to summarize.
+	 * @param result Receives one entry per path, in the same order and with 'path' as given. Files that can't be read
+	 *               have 'error' set.
+	 */
+	void scan( const std::vector<std::string>& paths, std::vector<prt_file_info>& result ){
+		result.assign( paths.size(), prt_file_info() );
+		std::vector<std::string> keys( paths.size() );
+
+		detail::parallel_for( paths.size(), [&]( std::size_t i ){
+			prt_file_info& info = result[i];
+			info.path = paths[i];
+			keys[i] = canonical_path( paths[i] );
+
+			struct stat st;
+			if( stat( info.path.c_str(), &st ) != 0 ){
+				info.error = "Unable to open file \"" + info.path + "\"";
+				return;
+			}
+			info.fileSize = static_cast<data_types::uint64_t>( st.st_size );
+			info.modifiedTime = static_cast<data_types::int64_t>( st.st_mtime );
+			info.modifiedNanoseconds = modified_nanoseconds( st );
+
+			std::map<std::string, prt_file_info>::const_iterator it = m_cache.find( keys[i] );
+			if( it != m_cache.end() && it->second.fileSize == info.fileSize && it->second.modifiedTime == info.modifiedTime &&
+			    it->second.modifiedNanoseconds == info.modifiedNanoseconds && ( it->second.hasStats || !m_computeStats ) ){
+				info = it->second;
+				info.path = paths[i];
+				return;
+			}
+
+			read_file( info );
+		}, m_threads );
+
+		for( std::size_t i = 0, iEnd = result.size(); i < iEnd; ++i ){
+			if( !result[i].cached && result[i].error.empty() ){
+				prt_file_info& entry = m_cache[keys[i]];
+				entry = result[i];
+				entry.path = keys[i];
+				entry.cached = true;
+				m_cacheDirty = true;
+			}
+		}
+	}
+
+	/**
+	 * Writes the cache file if anything was added to it. Entries that another process wrote since the cache was loaded
+	 * are kept, unless this process has a newer entry for the same path. The merge is done under the cache's lock file.
+	 */
+	void save_cache(){
+		if( m_cacheFile.empty() || !m_cacheDirty )
+			return;
+
+		//Another process could replace the cache between reading it and renaming over it, losing its entries.
+		cache_lock lock( m_cacheFile );
+
+		std::map<std::string, prt_file_info> merged;
+		read_cache( m_cacheFile, merged );
+		for( std::map<std::string, prt_file_info>::const_iterator it = m_cache.begin(), itEnd = m_cache.end(); it != itEnd; ++it ){
+			std::map<std::string, prt_file_info>::iterator dest = merged.find( it->first );
+			if( dest == merged.end() || !modified_before( it->second, dest->second ) )
+				merged[it->first] = it->second;
+		}
+
+		std::ostringstream tempName;
+		tempName << m_cacheFile << ".tmp" << static_cast<const void*>( this ) << std::time( NULL );
+
+		{
+			std::ofstream fout( tempName.str().c_str() );
+			if( fout.fail() )
+				throw std::ios_base::failure( "Failed to open file \"" + tempName.str() + "\" for writing" );
+			fout.precision( 17 );
+
+			fout << cache_signature() << '\n';
+			for( std::map<std::string, prt_file_info>::const_iterator it = merged.begin(), itEnd = merged.end(); it != itEnd; ++it )
+				write_cache_entry( fout, it->second );
+
+			fout.close();
+			if( fout.fail() ){
+				std::remove( tempName.str().c_str() );
+				throw std::ios_base::failure( "Failed to write the cache file \"" + m_cacheFile + "\"" );
+			}
+		}
+
+		//rename() replaces the destination atomically on POSIX, but fails on Windows if it exists.
+		if( std::rename( tempName.str().c_str(), m_cacheFile.c_str() ) != 0 ){
+			std::remove( m_cacheFile.c_str() );
+			if( std::rename( tempName.str().c_str(), m_cacheFile.c_str() ) != 0 ){
+				std::remove( tempName.str().c_str() );
+				throw std::ios_base::failure( "Failed to replace the cache file \"" + m_cacheFile + "\"" );
+			}
+		}
+
+		m_cache.swap( merged );
+		m_cacheDirty = false;
+	}
+
+	/**
+	 * Writes a list of results as a JSON array with one object per file.
+	 */
+	static void write_json( std::ostream& out, const std::vector<prt_file_info>& infos ){
+		out << "[\n";
+		for( std::size_t n = 0, nEnd = infos.size(); n < nEnd; ++n ){
+			const prt_file_info& info = infos[n];
+
+			out << "  {\"path\": ";
+			write_json_string( out, info.path );
+
+			if( !info.error.empty() ){
+				out << ", \"error\": ";
+				write_json_string( out, info.error );
+			}else{
+				out << ", \"size\": " << info.fileSize << ", \"mtime\": " << info.modifiedTime << ", \"particles\": " << info.particleCount;
+
+				out << ", \"channels\": [";
+				for( std::size_t i = 0, iEnd = info.layout.num_channels(); i < iEnd; ++i ){
+					const std::string& name = info.layout.get_channel_name( i );
+					const detail::prt_channel& ch = info.layout.get_channel( name );
+
+					out << ( i > 0 ? ", " : "" ) << "{\"name\": ";
+					write_json_string( out, name );
+					out << ", \"type\": \"" << data_types::names[ch.type] << "\", \"arity\": " << ch.arity << ", \"offset\": " << ch.offset;
+
+					if( info.hasStats ){
+						out << ", \"min\": ";
+						write_json_array( out, info.minimum[i] );
+						out << ", \"max\": ";
+						write_json_array( out, info.maximum[i] );
+					}
+					out << "}";
+				}
+				out << "]";
+
+				//The range of Position is the bounding box, which is what most callers are after.
+				for( std::size_t i = 0, iEnd = info.layout.num_channels(); i < iEnd && info.hasStats; ++i ){
+					if( info.layout.get_channel_name( i ) == "Position" ){
+						out << ", \"bounds\": {\"min\": ";
+						write_json_array( out, info.minimum[i] );
+						out << ", \"max\": ";
+						write_json_array( out, info.maximum[i] );
+						out << "}";
+					}
+				}
+			}
+
+			out << "}" << ( n + 1 < nEnd ? "," : "" ) << "\n";
+		}
+		out << "]\n";
+	}
+};
+
+}//namespace prtio
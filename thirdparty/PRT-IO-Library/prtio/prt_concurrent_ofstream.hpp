@@ -0,0 +1,241 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a PRT file writer that many threads can write particles to at once.
+ */
+
+#pragma once
+
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/zlib_blocks.hpp>
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_ostream.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+
+/**
+ * This class writes a single PRT file from many producer threads. Each thread creates its own
+ * prt_concurrent_ofstream::producer, which is an ordinary prt_ostream. A producer buffers particles privately and
+ * compresses each full block on its own thread as an independent deflate stream, then hands the compressed block to
+ * the file's sequencer. The sequencer appends blocks to the file in the order they arrive and stitches them into one
+ * valid zlib stream, so the only work done under the lock is the file write itself.
+ *
+ * Particles from different producers are interleaved a block at a time, so the order of particles in the file is
+ * only preserved within a block.
+ *
+ * Usage:
+ *   prt_concurrent_ofstream out;
+ *   out.add_channel( "Position", data_types::type_float32, 3 );
+ *   out.open( "particles.prt" );
+ *   //On each thread:
+ *   {
+ *     prt_concurrent_ofstream::producer p( out );
+ *     p.bind( "Position", pos, 3 );
+ *     ... p.write_next_particle(); ...
+ *     p.flush();
+ *   }
+ *   out.close(); //After every producer has flushed.
+ */
+class prt_concurrent_ofstream{
+	std::string m_filePath;
+	std::ofstream m_fout;
+	prt_layout m_layout;
+
+	int m_level;              //The zlib compression level used by the producers.
+	std::size_t m_blockBytes; //The amount of uncompressed data each producer buffers before compressing it.
+
+	std::mutex m_mutex; //Guards everything below, which is the sequencer's state.
+	detail::zlib_stitcher m_stitcher;
+	detail::prt_int64 m_particleCount;
+	std::ostream::pos_type m_countLocation;
+
+	/**
+	 * Appends a compressed block to the file. Called by producers from any thread.
+	 */
+	void submit( const detail::deflate_block& block ){
+		std::lock_guard<std::mutex> lock( m_mutex );
+
+		if( !m_stitcher.is_open() )
+			throw std::logic_error( "A particle block was written to the closed file \"" + m_filePath + "\"" );
+
+		m_stitcher.append( block );
+		m_particleCount += static_cast<detail::prt_int64>( block.particles );
+	}
+
+public:
+	/**
+	 * This class is the per-thread front end of a prt_concurrent_ofstream. It must only be used by one thread at a time.
+	 */
+	class producer : public prt_ostream{
+		prt_concurrent_ofstream* m_owner;
+		std::vector<char> m_buffer;   //Uncompressed particles waiting to be compressed.
+		std::size_t m_bufferCount;    //The number of particles in 'm_buffer'.
+		detail::deflate_block m_block;
+
+		void compress_and_submit(){
+			if( m_bufferCount == 0 )
+				return;
+
+			detail::compress_block( &m_buffer[0], m_buffer.size(), m_owner->m_level, m_block );
+			m_block.particles = m_bufferCount;
+
+			m_owner->submit( m_block );
+
+			m_buffer.clear();
+			m_bufferCount = 0;
+		}
+
+	protected:
+		virtual void write_impl( const char* src ){
+			m_buffer.insert( m_buffer.end(), src, src + m_layout.size() );
+			++m_bufferCount;
+
+			if( m_buffer.size() >= m_owner->m_blockBytes )
+				compress_and_submit();
+		}
+
+		virtual void write_block_impl( const char* src, std::size_t count ){
+			const std::size_t particleSize = m_layout.size();
+
+			while( count > 0 ){
+				//Top the buffer up to the block size, then compress it.
+				std::size_t room = ( m_owner->m_blockBytes > m_buffer.size() ) ? ( m_owner->m_blockBytes - m_buffer.size() + particleSize - 1 ) / particleSize : 1;
+				std::size_t n = std::min( count, room );
+
+				m_buffer.insert( m_buffer.end(), src, src + n * particleSize );
+				m_bufferCount += n;
+				src += n * particleSize;
+				count -= n;
+
+				if( m_buffer.size() >= m_owner->m_blockBytes )
+					compress_and_submit();
+			}
+		}
+
+	public:
+		/**
+		 * Creates a producer for an open file. The producer starts with the file's layout, so bind() attaches variables
+		 * to the declared channels rather than adding new ones.
+		 */
+		explicit producer( prt_concurrent_ofstream& owner ) : m_owner( &owner ), m_bufferCount( 0 ) {
+			m_layout = owner.m_layout;
+			m_buffer.reserve( owner.m_blockBytes + m_layout.size() );
+		}
+
+		/**
+		 * Flushes any buffered particles. Errors can't be reported from a destructor, so call flush() explicitly.
+		 */
+		virtual ~producer(){
+			try{
+				flush();
+			}catch( ... ){
+			}
+		}
+
+		/**
+		 * Compresses any buffered particles and hands them to the file. Must be called before the file is closed.
+		 */
+		void flush(){
+			compress_and_submit();
+		}
+	};
+
+	prt_concurrent_ofstream() : m_level( Z_DEFAULT_COMPRESSION ), m_blockBytes( 1 << 20 ), m_particleCount( 0 ), m_countLocation( 0 )
+	{}
+
+	virtual ~prt_concurrent_ofstream(){
+		try{
+			close();
+		}catch( ... ){
+		}
+	}
+
+	/**
+	 * Declares a channel of the particles in the file. All channels must be declared before open().
+	 */
+	void add_channel( const std::string& name, data_types::enum_t type, std::size_t arity ){
+		if( m_fout.is_open() )
+			throw std::logic_error( "Channel \"" + name + "\" was added after the file was opened" );
+
+		m_layout.add_channel( name, type, arity, m_layout.size() );
+	}
+
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	/**
+	 * Sets how much uncompressed data each producer buffers before compressing it as an independent block. Larger
+	 * blocks compress slightly better and reduce lock traffic; smaller blocks use less memory per producer.
+	 */
+	void set_block_size( std::size_t bytes ){
+		m_blockBytes = bytes;
+	}
+
+	void set_compression_level( int level ){
+		m_level = level;
+	}
+
+	/**
+	 * Opens the file and writes its header.
+	 * @param file Path to the file to write particles to
+	 */
+	void open( const std::string& file ){
+		m_fout.open( file.c_str(), std::ios::out | std::ios::binary );
+		if( m_fout.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for writing" );
+
+		m_filePath = file;
+		m_fout.exceptions( std::ios::badbit|std::ios::failbit ); //We want an exception if writing anything fails.
+
+		m_countLocation = detail::write_prt_header( m_fout, m_layout, -1 );
+		m_particleCount = 0;
+		m_stitcher.begin( m_fout );
+	}
+
+	/**
+	 * Terminates the particle stream and writes the final particle count into the header. Every producer must have
+	 * flushed first; blocks submitted afterwards are rejected.
+	 */
+	void close(){
+		std::lock_guard<std::mutex> lock( m_mutex );
+
+		if( m_fout.is_open() ){
+			if( m_stitcher.is_open() )
+				m_stitcher.finish();
+
+			m_fout.seekp( m_countLocation, std::ios::beg );
+			m_fout.write( reinterpret_cast<char*>( &m_particleCount ), 8 );
+			m_fout.close();
+		}
+
+		m_filePath.clear();
+	}
+
+	/**
+	 * @return The number of particles submitted by producers so far.
+	 */
+	detail::prt_int64 particle_count(){
+		std::lock_guard<std::mutex> lock( m_mutex );
+		return m_particleCount;
+	}
+};
+
+}//namespace prtio
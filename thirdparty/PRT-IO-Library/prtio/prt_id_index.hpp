@@ -0,0 +1,281 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a class for finding particles in a PRT file by ID without decoding the file.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/id_index_file.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/resume_reader.hpp>
+#include <prtio/particle_table.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class finds particles by ID in a PRT file, using the ID index sidecar next to it (see
+ * prt_ofstream::set_id_index()). The index holds every ID sorted, with the particle's place in the file, and the
+ * file's resume points. A lookup binary searches the IDs, then decompresses only from the resume point before each
+ * wanted particle, stopping after the last one wanted in that stretch. With the default of a point every 65536
+ * particles, finding a handful of particles in a file of millions decodes a few hundred thousand at most.
+ *
+ * An index can also be built for a file written without one, which decodes the file once. Such a file has no resume
+ * points besides its start, so lookups still decompress from the start, but stop after the last wanted particle.
+ *
+ * Lookups don't modify the object, so any number of threads may make them at once.
+ *
+ * Usage:
+ *   prt_id_index index( "frame.0001.prt" );
+ *   particle_table found;
+ *   index.read( ids, found );
+ */
+class prt_id_index{
+	std::string m_filePath;
+	detail::id_index_file m_index;
+	prt_layout m_layout;
+	detail::particle_quantizer m_quantizer; //Converts fixed point channels back to floating point.
+
+	/**
+	 * Reads the layout of the PRT file from its header.
+	 * @return The file offset of the compressed particle data.
+	 */
+	data_types::int64_t read_layout(){
+		std::ifstream fin( m_filePath.c_str(), std::ios::in | std::ios::binary );
+		if( fin.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + m_filePath + "\"" );
+
+		prt_metadata metadata;
+		m_layout.clear();
+		detail::read_prt_header( fin, m_filePath, m_layout, &metadata );
+		m_quantizer.init_read( m_layout, metadata, m_filePath );
+		return static_cast<data_types::int64_t>( fin.tellg() );
+	}
+
+public:
+	prt_id_index()
+	{}
+
+	/**
+	 * Opens the index of a PRT file. See open().
+	 */
+	explicit prt_id_index( const std::string& prtFile ){
+		open( prtFile );
+	}
+
+	/**
+	 * Loads the ID index sidecar of a PRT file.
+	 * @param prtFile The path to the PRT file, not the index.
+	 * @throws std::runtime_error If the index is missing, or was made for a different version of the file.
+	 */
+	void open( const std::string& prtFile ){
+		m_filePath = prtFile;
+		m_index.load( detail::id_index_file::path_for( prtFile ) );
+		if( !m_index.matches( prtFile ) )
+			throw std::runtime_error( "The ID index of \"" + prtFile + "\" is out of date" );
+		read_layout();
+	}
+
+	/**
+	 * @return True if the PRT file has an index that is up to date.
+	 */
+	static bool has_index( const std::string& prtFile ){
+		try{
+			detail::id_index_file index;
+			index.load( detail::id_index_file::path_for( prtFile ) );
+			return index.matches( prtFile );
+		}catch( const std::exception& ){
+			return false;
+		}
+	}
+
+	/**
+	 * Builds the index of a PRT file by decoding it. The index has a resume point only at the start of the file's data,
+	 * since points where the compressed data can't be resumed don't show in it. Call save() to keep the index.
+	 * @param prtFile The path to the PRT file.
+	 * @param idChannel The integer channel holding the particle IDs.
+	 */
+	void build( const std::string& prtFile, const std::string& idChannel = "ID" ){
+		prt_ifstream fin( prtFile );
+
+		if( !fin.has_channel( idChannel ) )
+			throw std::runtime_error( "The file \"" + prtFile + "\" has no \"" + idChannel + "\" channel to index" );
+
+		const detail::prt_channel& ch = fin.get_layout().get_channel( idChannel );
+		if( !detail::is_integral( ch.type ) || ch.arity != 1 )
+			throw std::runtime_error( "The \"" + idChannel + "\" channel of \"" + prtFile + "\" is not a single integer" );
+
+		detail::id_index_file index;
+		index.idChannel = idChannel;
+
+		const std::size_t particleSize = fin.get_layout().size();
+		const std::size_t batchParticles = std::max<std::size_t>( 1, ( 1 << 20 ) / particleSize );
+		std::vector<char> buffer( batchParticles * particleSize );
+		detail::convert_fn_t toInt64 = detail::get_read_converter<data_types::int64_t>( ch.type );
+
+		if( fin.particles_remaining() > 0 )
+			index.entries.reserve( static_cast<std::size_t>( fin.particles_remaining() ) );
+
+		std::size_t count;
+		while( ( count = fin.read_particle_block( &buffer[0], batchParticles ) ) > 0 ){
+			const char* src = &buffer[ ch.offset ];
+			for( std::size_t i = 0; i < count; ++i, src += particleSize ){
+				detail::id_entry entry;
+				toInt64( &entry.id, src, 1 );
+				entry.particle = index.particleCount++;
+				index.entries.push_back( entry );
+			}
+		}
+		fin.close();
+
+		std::sort( index.entries.begin(), index.entries.end() );
+
+		if( !detail::id_index_file::fingerprint( prtFile, index.fileSize, index.adler ) )
+			throw std::ios_base::failure( "Failed to read \"" + prtFile + "\"" );
+
+		//Raw inflate can start after the 2 byte zlib header at the start of the particle data.
+		m_filePath = prtFile;
+		detail::resume_point pt = { 0, read_layout() + 2 };
+		index.points.push_back( pt );
+
+		std::swap( m_index, index );
+	}
+
+	/**
+	 * Writes the index next to the PRT file, replacing any that was there.
+	 */
+	void save() const {
+		m_index.save( detail::id_index_file::path_for( m_filePath ) );
+	}
+
+	const std::string& get_file_path() const {
+		return m_filePath;
+	}
+
+	/**
+	 * @return The layout of the particles in the PRT file.
+	 */
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	/**
+	 * @return The number of particles in the PRT file.
+	 */
+	data_types::int64_t num_particles() const {
+		return m_index.particleCount;
+	}
+
+	/**
+	 * @return The number of places decompression can start, including the start of the file.
+	 */
+	std::size_t num_resume_points() const {
+		return m_index.points.size();
+	}
+
+	/**
+	 * @return The places decompression can start, in particle order, for other indexes of the same file.
+	 */
+	const std::vector<detail::resume_point>& get_resume_points() const {
+		return m_index.points;
+	}
+
+	/**
+	 * Finds the particles with the given IDs. Every particle with a wanted ID is found, if IDs repeat.
+	 * @param ids The IDs to find, in any order.
+	 * @param count The number of IDs.
+	 * @param particles Receives the index in the file of each particle found, sorted and without repeats.
+	 */
+	void find( const data_types::int64_t* ids, std::size_t count, std::vector<data_types::int64_t>& particles ) const {
+		particles.clear();
+		for( std::size_t i = 0; i < count; ++i ){
+			detail::id_entry key = { ids[i], std::numeric_limits<data_types::int64_t>::min() };
+			std::vector<detail::id_entry>::const_iterator it = std::lower_bound( m_index.entries.begin(), m_index.entries.end(), key );
+			for( ; it != m_index.entries.end() && it->id == ids[i]; ++it )
+				particles.push_back( it->particle );
+		}
+
+		std::sort( particles.begin(), particles.end() );
+		particles.erase( std::unique( particles.begin(), particles.end() ), particles.end() );
+	}
+
+	/**
+	 * Reads the particles with the given IDs, in the order they are in the file.
+	 * @param ids The IDs to find, in any order.
+	 * @param result Receives the particles. If it has no channels it gets every channel of the file, otherwise the file
+	 *               must have its channels with the same types.
+	 * @param decoded If not NULL, receives the number of particles that were decompressed to find them.
+	 * @return The number of particles read.
+	 */
+	std::size_t read( const std::vector<data_types::int64_t>& ids, particle_table& result, data_types::int64_t* decoded = NULL ) const {
+		if( decoded )
+			*decoded = 0;
+
+		std::vector<data_types::int64_t> particles;
+		if( !ids.empty() )
+			find( &ids[0], ids.size(), particles );
+		if( particles.empty() )
+			return 0;
+
+		data_types::int64_t n = detail::read_particles_at( m_filePath, m_quantizer.get_stored_layout(), &m_index.points[0], m_index.points.size(), m_index.particleCount, particles, result, &m_quantizer );
+		if( decoded )
+			*decoded = n;
+
+		return particles.size();
+	}
+};
+
+/**
+ * Reads the particles with the given IDs from each of several PRT files, decoding the files on several threads.
+ * Useful for following some particles through a sequence of frames.
+ * @param files The PRT files, each with an ID index.
+ * @param ids The IDs to find.
+ * @param results Receives a table per file, in the order of 'files'.
+ * @param threads The maximum number of threads to use, or 0 for one per core.
+ * @param buildMissing If true, files without an up to date index have one built and saved, instead of throwing.
+ * @return The total number of particles read.
+ */
+inline std::size_t read_ids( const std::vector<std::string>& files, const std::vector<data_types::int64_t>& ids, std::vector<particle_table>& results, unsigned threads = 0, bool buildMissing = false ){
+	results.clear();
+	results.resize( files.size() );
+
+	std::vector<std::size_t> counts( files.size(), 0 );
+	detail::parallel_for( files.size(), [&]( std::size_t i ){
+		prt_id_index index;
+		if( buildMissing && !prt_id_index::has_index( files[i] ) ){
+			index.build( files[i] );
+			index.save();
+		}else{
+			index.open( files[i] );
+		}
+		counts[i] = index.read( ids, results[i] );
+	}, threads );
+
+	std::size_t total = 0;
+	for( std::size_t i = 0; i < counts.size(); ++i )
+		total += counts[i];
+	return total;
+}
+
+}//namespace prtio
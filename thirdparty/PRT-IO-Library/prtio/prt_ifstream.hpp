@@ -21,88 +21,126 @@
 
 #include <prtio/prt_istream.hpp>
 #include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/quantize.hpp>
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <limits>
+#include <thread>
 #include <zlib.h>
 
 namespace prtio{
 
 /**
  * This class implements the prt_istream interface, for reading particles from a file.
+ *
+ * With set_follow() enabled it can also read a file that another process is still writing, in the manner of 'tail -f'.
+ * prt_ofstream writes a particle count of -1 until close(), so such a file's length is unknown. Particles are decoded
+ * as the compressed bytes reach the disk, polling for more whenever the reader catches up with the writer, and the
+ * stream ends when the zlib stream does. Since prt_ofstream writes the compressed data in 512KB pieces, particles
+ * become readable in bursts of that size.
+ *
+ * It can also read from a std::istream the caller owns, ex. one handed to a plugin by its host application. Such a
+ * stream is only read and skipped forwards (with relative seekg() calls), and it can't be followed.
+ *
+ * Channels written as fixed point (see prt_ofstream::set_quantization()) are converted back to their floating point
+ * type as they are read, and get_layout() describes them that way.
  */
 class prt_ifstream : public prt_istream{
 	std::string m_filePath; //The path to the PRT file.
 	std::ifstream m_fin;    //The stream that is reading bytes from the file.
+	std::istream* m_in;     //Either 'm_fin', or the caller's stream. NULL when closed.
 	z_stream m_zstream;     //The zlib stream that is decompressing particle from the file.
 
 	char* m_buffer;           //A temporary buffer for storing the compressed file data before being unzipped.
 	std::size_t m_bufferSize; //The size of 'm_buffer' in bytes.
 
-	detail::prt_int64 m_particleCount; //The number of particles remaining in the file.
+	detail::prt_int64 m_particleCount; //The number of particles remaining in the file, or -1 if the file is unfinished.
+
+	bool m_follow;             //True if the file may still be being written. See set_follow().
+	unsigned m_pollInterval;   //Milliseconds to wait before checking an unfinished file for more data.
+	unsigned m_followTimeout;  //Milliseconds without growth before an unfinished file is abandoned, or 0 to wait forever.
+	unsigned m_idleTime;       //Milliseconds waited since the file last grew.
+	detail::prt_int64 m_particlesRead; //The number of particles decoded from an unfinished file.
+
+	detail::particle_quantizer m_quantizer; //Converts quantized channels back to floating point.
+	std::vector<char> m_storedBuffer;       //Particles as stored in the file, when they need converting.
 
 private:
 	/**
 	 * This function reads the uncompressed header portion of the PRT file and leaves the read pointer
-	 * of 'm_fin' at the beginning of the compressed particle data portion of the file. It will populate
-	 * the member 'm_layout' with the layout of particle data after being decompressed.
+	 * of 'm_in' at the beginning of the compressed particle data portion of the file. It will populate
+	 * the member 'm_layout' with the layout of particle data after being decompressed (and converted from fixed
+	 * point), and 'm_metadata' with any metadata chunks.
 	 */
 	void read_header(){
-		using namespace detail;
-
-		prt_header_v1 header;
-		m_fin.read(reinterpret_cast<char*>(&header), sizeof(prt_header_v1));
-
-		//This is not a prt file (as opposed to a corrupt prt file);
-		if( header.magicNumber != prt_magic_number() )
-			throw std::runtime_error( "The input stream \"" + m_filePath + "\" did not contain the .prt file magic number." );
-
-		//This is not a prt file (as opposed to a corrupt prt file);
-		if( strncmp(prt_signature_string(), header.fmtIdentStr, 32) != 0 )
-			throw std::runtime_error( "The input stream \"" + m_filePath + "\" did not contain the signature string '" + prt_signature_string() + "'." );
-
-		m_particleCount = header.particleCount;
-		if( header.particleCount < 0 )
-			throw std::runtime_error( "The input stream \"" + m_filePath + "\" was not closed correctly and reported negative particles within." );
-
-		// Skip parts of the file header which may have been added since the first version of the .prt format
-		if( header.headerLength != sizeof(prt_header_v1) )
-			m_fin.seekg(header.headerLength - sizeof(prt_header_v1), std::ios::cur);
-
-		prt_int32 attrLength;
-		m_fin.read(reinterpret_cast<char*>(&attrLength), 4);
-
-		if( attrLength != 4 )
-			throw std::runtime_error( "The reserved int value is not set to 4." );
-
-		prt_int32 channelCount, perChannelLength;
-		m_fin.read(reinterpret_cast<char*>(&channelCount), 4);
-		m_fin.read(reinterpret_cast<char*>(&perChannelLength), 4);
-
-		for(int i = 0; i < channelCount; ++i){
-			prt_channel_header_v1 channel;
-			m_fin.read(reinterpret_cast<char*>(&channel), sizeof(prt_channel_header_v1));
+		if( !m_follow ){
+			m_particleCount = detail::read_prt_header( *m_in, m_filePath, m_layout, &m_metadata );
+			m_quantizer.init_read( m_layout, m_metadata, m_filePath );
+			return;
+		}
 
-			// Make sure the channel name is null terminated
-			channel.channelName[31] = '\0';
+		//The writer may not have flushed all of the header yet. If reading it ran off the end of the file, whatever went
+		//wrong is because it was cut short, so start again once the file has grown.
+		for(;;){
+			try{
+				m_particleCount = detail::read_prt_header( m_fin, m_filePath, m_layout, &m_metadata, true );
+				if( !m_fin.fail() )
+					break;
+			}catch( const std::exception& ){
+				if( !m_fin.eof() )
+					throw;
+			}
 
-			if( channel.channelType < 0 || channel.channelType >= data_types::type_count )
-				throw std::runtime_error( std::string() + "The data type specified in channel \"" + channel.channelName + "\" in the input stream \"" + m_filePath + "\" is not valid." );
+			m_layout.clear();
+			m_metadata.clear();
+			if( !wait_for_data() )
+				throw std::runtime_error( "Timed out waiting for the header of \"" + m_filePath + "\" to be written" );
+			m_fin.seekg( 0, std::ios::beg );
+		}
+		m_quantizer.init_read( m_layout, m_metadata, m_filePath );
+
+		//Until the writer closes the file, its ranges are the empty placeholders written by
+		//prt_ofstream::reserve_stats(), which would make every particle look out of bounds.
+		if( m_particleCount < 0 ){
+			m_metadata.erase( "BoundBox" );
+			for( std::size_t i = 0, iEnd = m_layout.num_channels(); i < iEnd; ++i ){
+				m_metadata.erase( "Min", m_layout.get_channel_name( i ) );
+				m_metadata.erase( "Max", m_layout.get_channel_name( i ) );
+			}
+		}
+	}
 
-			if( channel.channelArity < 0 )
-				throw std::runtime_error( std::string() + "The arity specified in channel \"" + channel.channelName + "\" in the input stream \"" + m_filePath + "\" is not valid." );
+	/**
+	 * @return The size of a particle as stored in the file.
+	 */
+	std::size_t stored_size() const {
+		return m_quantizer.empty() ? m_layout.size() : m_quantizer.get_stored_layout().size();
+	}
 
-			if( channel.channelOffset < 0 )
-				throw std::runtime_error( std::string() + "The offset specified in channel \"" + channel.channelName + "\" in the input stream \"" + m_filePath + "\" is not valid." );
+	/**
+	 * Waits one poll interval for an unfinished file to grow, then clears the stream's EOF state so it can read again.
+	 * @return False if the file has been idle longer than the follow timeout.
+	 */
+	bool wait_for_data(){
+		if( m_followTimeout > 0 && m_idleTime >= m_followTimeout )
+			return false;
 
-			m_layout.add_channel(
-				std::string( channel.channelName ),
-				static_cast<data_types::enum_t>( channel.channelType ),
-				static_cast<std::size_t>( channel.channelArity ),
-				static_cast<std::size_t>( channel.channelOffset )
-			);
+		std::this_thread::sleep_for( std::chrono::milliseconds( m_pollInterval ) );
+		m_idleTime += m_pollInterval;
+		m_fin.clear();
+		return true;
+	}
 
-			if( perChannelLength != sizeof(prt_channel_header_v1) )
-				m_fin.seekg(perChannelLength - sizeof(prt_channel_header_v1), std::ios::cur);	//Skip unknown parts of the channel header
-		}
+	/**
+	 * Reads the particle count currently in the header of the file, which is -1 until the writer closes it.
+	 */
+	detail::prt_int64 peek_particle_count() const {
+		std::ifstream fin( m_filePath.c_str(), std::ios::in | std::ios::binary );
+		detail::prt_int64 result = -1;
+		fin.seekg( 48, std::ios::beg ); //The offset of prt_header_v1::particleCount.
+		fin.read( reinterpret_cast<char*>( &result ), 8 );
+		return fin ? result : -1;
 	}
 
 	/**
@@ -126,6 +164,12 @@ public:
 		m_buffer = NULL;
 		m_bufferSize = 0;
 		m_particleCount = 0;
+		m_follow = false;
+		m_pollInterval = 100;
+		m_followTimeout = 60000;
+		m_idleTime = 0;
+		m_particlesRead = 0;
+		m_in = NULL;
 		memset( &m_zstream, 0, sizeof(m_zstream) );
 	}
 
@@ -137,6 +181,12 @@ public:
 		m_buffer = NULL;
 		m_bufferSize = 0;
 		m_particleCount = 0;
+		m_follow = false;
+		m_pollInterval = 100;
+		m_followTimeout = 60000;
+		m_idleTime = 0;
+		m_particlesRead = 0;
+		m_in = NULL;
 		memset( &m_zstream, 0, sizeof(m_zstream) );
 
 		open( filePath );
@@ -146,17 +196,67 @@ public:
 		close();
 	}
 
+	/**
+	 * Enables reading files that are still being written. Must be called before open(). Following a file that was
+	 * already closed by its writer costs nothing, so it is safe to enable when unsure. An unfinished file's metadata
+	 * has no "BoundBox", "Min" or "Max" values, since the writer only fills them in when it closes the file.
+	 * @param follow If true, open() accepts an unfinished file (and waits for it to be created), and reads wait for
+	 *               the writer instead of failing at the end of the data written so far.
+	 * @param timeout Milliseconds the file may go without growing before the reader gives up, or 0 to wait forever.
+	 * @param pollInterval Milliseconds between checks for more data.
+	 */
+	void set_follow( bool follow, unsigned timeout = 60000, unsigned pollInterval = 100 ){
+		m_follow = follow;
+		m_followTimeout = timeout;
+		m_pollInterval = ( pollInterval > 0 ) ? pollInterval : 1;
+	}
+
+	/**
+	 * @return True if the file was opened before its writer closed it, and the end of its particles hasn't been reached.
+	 */
+	bool unfinished() const {
+		return m_particleCount < 0;
+	}
+
 	/**
 	 * Opens the prt_ifstream to read from the specified file
 	 * @param file Path to the file to read particles from
 	 */
 	void open( const std::string& file ){
+		m_idleTime = 0;
+		m_particlesRead = 0;
+		m_stats.reset();
+
 		m_fin.open( file.c_str(), std::ios::in | std::ios::binary );
+		while( m_fin.fail() && m_follow && wait_for_data() )
+			m_fin.open( file.c_str(), std::ios::in | std::ios::binary );
 		if( m_fin.fail() )
 			throw std::ios_base::failure( "Failed to open file \"" + file + "\"" );
 
 		m_filePath = file;
 		m_fin.exceptions( std::ios::badbit );
+		m_in = &m_fin;
+
+		read_header();
+		init_zlib();
+	}
+
+	/**
+	 * Opens the prt_ifstream to read from a stream the caller owns, starting at its current position. The stream is not
+	 * closed by close(), and is left wherever the compressed data was last read up to.
+	 * @param in The stream to read particles from. It must outlive this object, or the next call to close().
+	 * @param name The name to use for the stream in error messages.
+	 */
+	void open( std::istream& in, const std::string& name ){
+		if( m_follow )
+			throw std::logic_error( "Only files can be followed, not the stream \"" + name + "\"" );
+
+		m_idleTime = 0;
+		m_particlesRead = 0;
+		m_stats.reset();
+
+		m_filePath = name;
+		m_in = &in;
 
 		read_header();
 		init_zlib();
@@ -167,7 +267,9 @@ public:
 	 */
 	void close(){
 		m_filePath.clear();
-		m_fin.close();
+		if( m_in == &m_fin )
+			m_fin.close();
+		m_in = NULL;
 
 		if( m_buffer ){
 			inflateEnd( &m_zstream );
@@ -178,39 +280,58 @@ public:
 		}
 
 		m_layout.clear();
+		m_metadata.clear();
+		m_quantizer.clear();
 
 		m_bufferSize = 0;
 		m_particleCount = 0;
 	}
 
-protected:
 	/**
-	 * Reads a single particle from disk into the specified buffer.
-	 * @param data The location to read a single particle to. Must be at least m_layout.size() bytes.
-	 * @return True if a particle was read, false if EOF or the stream was never opened.
+	 * @return The number of particles that have not been read from the file yet, or -1 if the file is unfinished.
 	 */
-	virtual bool read_impl( char* data ){
-		if( m_particleCount == 0 ){
-			if( !m_fin.is_open() || m_fin.eof() )
-				return false;
-			throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
-		}
+	virtual data_types::int64_t particles_remaining() const {
+		return m_particleCount;
+	}
 
-		m_zstream.avail_out = static_cast<uInt>( m_layout.size() );
+private:
+	/**
+	 * Decompresses the next 'count' particles from the file into 'data', refilling 'm_buffer' from disk as needed.
+	 * @param data The location to decompress to. Must be at least count * stored_size() bytes.
+	 * @param count The number of particles to decompress. The caller must ensure at least this many remain.
+	 */
+	void inflate_particles( char* data, std::size_t count ){
+		//avail_out is a uInt, so 4GB or more is inflated into 'data' a piece at a time.
+		std::size_t remaining = count * stored_size();
+		m_zstream.avail_out = 0;
 		m_zstream.next_out = reinterpret_cast<unsigned char*>(data);
 
-		do{
+		while( m_zstream.avail_out != 0 || remaining != 0 ){
+			if( m_zstream.avail_out == 0 ){
+				m_zstream.avail_out = static_cast<uInt>( std::min<std::size_t>( remaining, std::numeric_limits<uInt>::max() ) );
+				remaining -= m_zstream.avail_out;
+			}
+
 			if(m_zstream.avail_in == 0){
-				m_fin.read(m_buffer, m_bufferSize);
+				{
+					detail::stats_timer timer( m_timing ? &m_stats.ioSeconds : NULL );
+					m_in->read(m_buffer, m_bufferSize);
+				}
 
-				if( m_fin.fail() && m_bufferSize == 0 )
+				if( m_in->fail() && m_bufferSize == 0 )
 					throw std::ios_base::failure( "Failed to read from file \"" + m_filePath + "\"" );
 
-				m_zstream.avail_in = static_cast<uInt>(m_fin.gcount());
+				m_zstream.avail_in = static_cast<uInt>(m_in->gcount());
 				m_zstream.next_in = reinterpret_cast<unsigned char*>(m_buffer);
+				m_stats.compressedBytes += m_zstream.avail_in;
+				++m_stats.bufferRefills;
 			}
 
-			int ret = inflate(&m_zstream, Z_SYNC_FLUSH);
+			int ret;
+			{
+				detail::stats_timer timer( m_timing ? &m_stats.zlibSeconds : NULL );
+				ret = inflate(&m_zstream, Z_SYNC_FLUSH);
+			}
 			if(Z_OK != ret && Z_STREAM_END != ret){
 				std::stringstream ss;
 				ss << "inflate() on file \"" << m_filePath << "\" ";
@@ -220,12 +341,162 @@ protected:
 				throw std::runtime_error( ss.str() );
 			}
 
-		}while(m_zstream.avail_out != 0);
+			//A truncated file would otherwise spin here forever, since there is no more input to fill the request.
+			if( Z_STREAM_END == ret && ( m_zstream.avail_out != 0 || remaining != 0 ) )
+				throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+		}
+
+		m_particleCount -= static_cast<detail::prt_int64>( count );
+	}
+
+	/**
+	 * Decompresses up to 'count' particles from an unfinished file into 'data', waiting for the writer whenever the
+	 * data on disk runs out. Once the zlib stream ends the file is treated as finished.
+	 * @return The number of particles decompressed, which is less than 'count' only at the end of the stream.
+	 */
+	std::size_t follow_particles( char* data, std::size_t count ){
+		const std::size_t particleSize = stored_size();
+		std::size_t remaining = count * particleSize; //Not yet given to inflate() in avail_out, which is a uInt.
+		m_zstream.avail_out = 0;
+		m_zstream.next_out = reinterpret_cast<unsigned char*>(data);
+
+		bool ended = false;
+		while( ( m_zstream.avail_out != 0 || remaining != 0 ) && !ended ){
+			if( m_zstream.avail_out == 0 ){
+				m_zstream.avail_out = static_cast<uInt>( std::min<std::size_t>( remaining, std::numeric_limits<uInt>::max() ) );
+				remaining -= m_zstream.avail_out;
+			}
+
+			if( m_zstream.avail_in == 0 ){
+				{
+					detail::stats_timer timer( m_timing ? &m_stats.ioSeconds : NULL );
+					m_fin.read( m_buffer, m_bufferSize );
+				}
+				m_zstream.avail_in = static_cast<uInt>( m_fin.gcount() );
+				m_zstream.next_in = reinterpret_cast<unsigned char*>( m_buffer );
+				m_stats.compressedBytes += m_zstream.avail_in;
+				++m_stats.bufferRefills;
+
+				if( m_zstream.avail_in == 0 ){
+					if( !wait_for_data() )
+						throw std::runtime_error( "Timed out waiting for more particles to be written to \"" + m_filePath + "\"" );
+					continue;
+				}
+				m_idleTime = 0;
+			}
 
-		--m_particleCount;
+			//Z_BUF_ERROR only means the input ran out partway through a block, so more is needed.
+			int ret;
+			{
+				detail::stats_timer timer( m_timing ? &m_stats.zlibSeconds : NULL );
+				ret = inflate( &m_zstream, Z_SYNC_FLUSH );
+			}
+			if( Z_STREAM_END == ret ){
+				ended = true;
+			}else if( Z_OK != ret && Z_BUF_ERROR != ret ){
+				std::stringstream ss;
+				ss << "inflate() on unfinished file \"" << m_filePath << "\" ";
+				ss << "after " << m_particlesRead << " particles failed:\n\t";
+				ss << zError(ret);
+
+				throw std::runtime_error( ss.str() );
+			}
+		}
+
+		const std::size_t bytes = count * particleSize - remaining - m_zstream.avail_out;
+		if( bytes % particleSize != 0 )
+			throw std::runtime_error( "The compressed data in \"" + m_filePath + "\" ended partway through a particle" );
+
+		const std::size_t result = bytes / particleSize;
+		m_particlesRead += static_cast<detail::prt_int64>( result );
+
+		if( ended ){
+			//The writer patches the count just after the stream ends, so it may or may not be there yet.
+			detail::prt_int64 finalCount = peek_particle_count();
+			if( finalCount >= 0 && finalCount != m_particlesRead )
+				throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+			m_particleCount = 0;
+		}
+
+		return result;
+	}
+
+	/**
+	 * Reads a single particle as stored in the file.
+	 * @param data The location to read a single particle to. Must be at least stored_size() bytes.
+	 * @return True if a particle was read, false if EOF or the stream was never opened.
+	 */
+	bool read_stored( char* data ){
+		if( m_particleCount < 0 )
+			return follow_particles( data, 1 ) == 1;
 
+		if( m_particleCount == 0 ){
+			//A followed file was checked against its count when its stream ended.
+			if( !m_in || m_in->eof() || m_particlesRead > 0 )
+				return false;
+			throw std::runtime_error( "The file \"" + m_filePath + "\" did not contain the number of particles it claimed" );
+		}
+
+		inflate_particles( data, 1 );
+
+		return true;
+	}
+
+	/**
+	 * Reads up to 'count' particles as stored in the file with a single pass through inflate().
+	 * @param data The location to read the particles to. Must be at least count * stored_size() bytes.
+	 * @param count The maximum number of particles to read.
+	 * @return The number of particles read, which is less than 'count' only when the file has no more particles.
+	 */
+	std::size_t read_stored_block( char* data, std::size_t count ){
+		if( m_particleCount < 0 )
+			return follow_particles( data, count );
+
+		if( static_cast<detail::prt_int64>( count ) > m_particleCount )
+			count = static_cast<std::size_t>( m_particleCount );
+
+		if( count > 0 )
+			inflate_particles( data, count );
+
+		return count;
+	}
+
+protected:
+	/**
+	 * Reads a single particle from disk into the specified buffer.
+	 * @param data The location to read a single particle to. Must be at least m_layout.size() bytes.
+	 * @return True if a particle was read, false if EOF or the stream was never opened.
+	 */
+	virtual bool read_impl( char* data ){
+		if( m_quantizer.empty() )
+			return read_stored( data );
+
+		m_storedBuffer.resize( stored_size() );
+		if( !read_stored( &m_storedBuffer[0] ) )
+			return false;
+
+		m_quantizer.decode( &m_storedBuffer[0], 1, data );
 		return true;
 	}
+
+	/**
+	 * Reads up to 'count' particles from disk into the specified buffer with a single pass through inflate().
+	 * @param data The location to read the particles to. Must be at least count * m_layout.size() bytes.
+	 * @param count The maximum number of particles to read.
+	 * @return The number of particles read, which is less than 'count' only when the file has no more particles.
+	 */
+	virtual std::size_t read_block_impl( char* data, std::size_t count ){
+		if( m_quantizer.empty() || count == 0 )
+			return read_stored_block( data, count );
+
+		m_storedBuffer.resize( count * stored_size() );
+		const std::size_t result = read_stored_block( &m_storedBuffer[0], count );
+		{
+			detail::stats_timer timer( m_timing ? &m_stats.convertSeconds : NULL );
+			m_quantizer.decode( &m_storedBuffer[0], result, data );
+		}
+		return result;
+	}
 };
 
 }//namespace prtio
\ No newline at end of file
@@ -0,0 +1,473 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a class that writes sub-frames between two PRT frames by matching particle IDs.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/id_hash.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/particle_table.hpp>
+#include <prtio/prt_block_reader.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_ofstream.hpp>
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class writes sub-frames between two frames of a particle sequence, for motion blur and retiming. Particles are
+ * matched between the frames by their ID channel, and each sub-frame is written as a PRT file.
+ *
+ * Position is interpolated along a cubic Hermite curve when both frames have a Velocity channel, so particles follow
+ * their curved paths instead of cutting corners, and linearly otherwise. Velocity (which is in units per second) is
+ * scaled by the frame time, see set_frame_time(). Orientation quaternions are normalized after blending along the
+ * shorter arc. Other floating point channels are interpolated linearly, and integer channels come from the nearer
+ * frame. The sub-frames have the channels the two frames share, each of a type that holds both frames' values.
+ *
+ * The first frame is loaded into memory (only the channels being interpolated) and indexed by ID in a hash table.
+ * The second frame is then streamed through a block at a time: each block is joined against the index, interpolated
+ * and written to every sub-frame, so memory use is proportional to one frame. The lookups within a block and the
+ * sub-frames' interpolation and compression are spread over threads.
+ *
+ * Particles that exist in only one of the frames are dropped, unless set_keep_unmatched() is enabled. Then particles
+ * born in the second frame and particles that died after the first are written too, moved along their velocity
+ * (or held still without one). Sub-frames have the matched and newborn particles in the second frame's order, then
+ * the dying particles in the first frame's order.
+ *
+ * Usage:
+ *   prt_interpolate interp;
+ *   interp.add_output( 0.25, "frame_0010.25.prt" );
+ *   interp.add_output( 0.5, "frame_0010.5.prt" );
+ *   interp.write( "frame_0010.prt", "frame_0011.prt" );
+ */
+class prt_interpolate{
+	enum blend_mode{
+		blend_linear,
+		blend_hermite, //Position, with Velocity as the tangents.
+		blend_nlerp,   //Orientation quaternions.
+		blend_nearest  //Integer channels.
+	};
+
+	/**
+	 * This internal struct is one channel of the sub-frames.
+	 */
+	struct channel{
+		std::string name;
+		data_types::enum_t type; //The type in the sub-frames.
+		std::size_t arity;
+		blend_mode mode;
+	};
+
+	/**
+	 * This internal struct is one sub-frame being written.
+	 */
+	struct output{
+		double time;
+		std::string path;
+		prt_ofstream stream;
+		particle_table block;
+		std::vector<double> values;
+	};
+
+	/**
+	 * This internal struct holds a block of particles as they were in each of the two frames, one array per channel.
+	 */
+	struct pair_block{
+		std::size_t count;
+		std::vector< std::vector<double> > first, second;
+	};
+
+	std::vector<channel> m_channels;
+	std::vector< std::unique_ptr<output> > m_outputs;
+	std::size_t m_positionIndex, m_velocityIndex; //Indices into m_channels, or npos.
+
+	std::string m_idChannel;
+	double m_frameTime;
+	bool m_keepUnmatched;
+	unsigned m_threads;
+	std::size_t m_blockSize;
+
+	detail::prt_int64 m_matched, m_born, m_died;
+
+	static const std::size_t npos = static_cast<std::size_t>( -1 );
+
+private:
+	/**
+	 * Converts a channel of the given rows of a table to doubles. If 'rows' is NULL the first 'count' rows are used.
+	 */
+	static void read_rows( const particle_table& table, const channel& ch, const std::vector<std::size_t>* rows, std::size_t count, std::vector<double>& dest ){
+		dest.resize( count * ch.arity );
+		if( count == 0 )
+			return;
+
+		if( !rows ){
+			table.copy_channel( ch.name, &dest[0], 0, count );
+			return;
+		}
+
+		std::size_t index = table.channel_index( ch.name );
+		data_types::enum_t type = table.get_layout().get_channel( ch.name ).type;
+		std::size_t stride = data_types::sizes[type] * ch.arity;
+		detail::convert_fn_t fn = detail::get_read_converter<double>( type );
+
+		const char* column = static_cast<const char*>( table.get_column( index ) );
+		for( std::size_t i = 0; i < count; ++i )
+			fn( &dest[i * ch.arity], column + stride * (*rows)[i], ch.arity );
+	}
+
+	void read_side( const particle_table& table, const std::vector<std::size_t>* rows, std::size_t count, std::vector< std::vector<double> >& side ) const {
+		side.resize( m_channels.size() );
+		for( std::size_t c = 0, cEnd = m_channels.size(); c < cEnd; ++c )
+			read_rows( table, m_channels[c], rows, count, side[c] );
+	}
+
+	/**
+	 * Makes 'side' a copy of 'from' with the particles moved along their velocity by 'frames' frames. This stands in
+	 * for the missing frame of a particle that was born or died between the frames.
+	 */
+	void extrapolate( const std::vector< std::vector<double> >& from, double frames, std::vector< std::vector<double> >& side ) const {
+		side = from;
+		if( m_positionIndex == npos || m_velocityIndex == npos )
+			return;
+
+		std::vector<double>& pos = side[m_positionIndex];
+		const std::vector<double>& vel = from[m_velocityIndex];
+		const double scale = frames * m_frameTime;
+		for( std::size_t i = 0, iEnd = pos.size(); i < iEnd; ++i )
+			pos[i] += scale * vel[i];
+	}
+
+	/**
+	 * Interpolates one channel of a block for a sub-frame.
+	 */
+	void blend( const pair_block& pairs, std::size_t c, double t, std::vector<double>& result ) const {
+		const channel& ch = m_channels[c];
+		const std::vector<double>& a = pairs.first[c];
+		const std::vector<double>& b = pairs.second[c];
+		const std::size_t n = a.size();
+		result.resize( n );
+
+		switch( ch.mode ){
+		case blend_hermite:{
+			//The cubic Hermite basis, with the tangents being the velocities over one frame.
+			const double t2 = t * t, t3 = t2 * t;
+			const double h00 = 2 * t3 - 3 * t2 + 1, h10 = ( t3 - 2 * t2 + t ) * m_frameTime;
+			const double h01 = -2 * t3 + 3 * t2, h11 = ( t3 - t2 ) * m_frameTime;
+			const std::vector<double>& va = pairs.first[m_velocityIndex];
+			const std::vector<double>& vb = pairs.second[m_velocityIndex];
+			for( std::size_t i = 0; i < n; ++i )
+				result[i] = h00 * a[i] + h10 * va[i] + h01 * b[i] + h11 * vb[i];
+			break;
+		}
+		case blend_nlerp:
+			for( std::size_t i = 0; i < n; i += ch.arity ){
+				double dot = 0;
+				for( std::size_t k = 0; k < ch.arity; ++k )
+					dot += a[i + k] * b[i + k];
+				const double sign = ( dot < 0 ) ? -1 : 1; //q and -q are the same rotation, so take the shorter way.
+
+				double length = 0;
+				for( std::size_t k = 0; k < ch.arity; ++k ){
+					result[i + k] = a[i + k] + ( sign * b[i + k] - a[i + k] ) * t;
+					length += result[i + k] * result[i + k];
+				}
+				if( length > 0 ){
+					length = 1 / std::sqrt( length );
+					for( std::size_t k = 0; k < ch.arity; ++k )
+						result[i + k] *= length;
+				}
+			}
+			break;
+		case blend_nearest:
+			result = ( t < 0.5 ) ? a : b;
+			break;
+		default:
+			for( std::size_t i = 0; i < n; ++i )
+				result[i] = a[i] + ( b[i] - a[i] ) * t;
+			break;
+		}
+	}
+
+	/**
+	 * Interpolates a block for every sub-frame and writes it, one sub-frame per thread.
+	 */
+	void write_block( const pair_block& pairs ){
+		if( pairs.count == 0 )
+			return;
+
+		detail::parallel_for( m_outputs.size(), [&]( std::size_t o ){
+			output& out = *m_outputs[o];
+			out.block.resize( pairs.count );
+
+			for( std::size_t c = 0, cEnd = m_channels.size(); c < cEnd; ++c ){
+				blend( pairs, c, out.time, out.values );
+				detail::get_write_converter<double>( m_channels[c].type )( out.block.get_column( c ), &out.values[0], out.values.size() );
+			}
+
+			out.block.save( out.stream );
+		}, m_threads );
+	}
+
+	/**
+	 * Picks the channels of the sub-frames from the channels the two frames share.
+	 */
+	void build_channels( const prt_layout& first, const prt_layout& second ){
+		m_channels.clear();
+		m_positionIndex = m_velocityIndex = npos;
+
+		for( std::size_t i = 0, iEnd = first.num_channels(); i < iEnd; ++i ){
+			const std::string& name = first.get_channel_name( i );
+			if( !second.has_channel( name ) )
+				continue;
+
+			const detail::prt_channel& a = first.get_channel( name );
+			const detail::prt_channel& b = second.get_channel( name );
+			if( a.arity != b.arity )
+				continue;
+
+			channel ch;
+			ch.name = name;
+			ch.arity = a.arity;
+			ch.type = detail::common_type( a.type, b.type );
+			if( ch.type == data_types::type_count )
+				ch.type = a.type;
+
+			if( !detail::is_float( ch.type ) )
+				ch.mode = blend_nearest;
+			else if( name == "Orientation" && ch.arity == 4 )
+				ch.mode = blend_nlerp;
+			else
+				ch.mode = blend_linear;
+
+			if( name == "Position" && ch.arity == 3 && detail::is_float( ch.type ) )
+				m_positionIndex = m_channels.size();
+			else if( name == "Velocity" && ch.arity == 3 && detail::is_float( ch.type ) )
+				m_velocityIndex = m_channels.size();
+
+			m_channels.push_back( ch );
+		}
+
+		if( m_positionIndex != npos && m_velocityIndex != npos )
+			m_channels[m_positionIndex].mode = blend_hermite;
+	}
+
+public:
+	prt_interpolate() : m_positionIndex( npos ), m_velocityIndex( npos ), m_idChannel( "ID" ), m_frameTime( 1.0 / 24 ), m_keepUnmatched( false ), m_threads( 0 ), m_blockSize( 65536 ), m_matched( 0 ), m_born( 0 ), m_died( 0 )
+	{}
+
+	/**
+	 * Adds a sub-frame to write.
+	 * @param time Where the sub-frame falls between the frames, from 0 (the first frame) to 1 (the second).
+	 * @param file Path to the PRT file to create.
+	 */
+	void add_output( double time, const std::string& file ){
+		if( !( time >= 0 && time <= 1 ) )
+			throw std::invalid_argument( "The sub-frame for \"" + file + "\" is not between the two frames" );
+
+		std::unique_ptr<output> out( new output );
+		out->time = time;
+		out->path = file;
+		m_outputs.push_back( std::move( out ) );
+	}
+
+	/**
+	 * Sets the channel that identifies a particle in both frames. Defaults to "ID".
+	 */
+	void set_id_channel( const std::string& name ){
+		m_idChannel = name;
+	}
+
+	/**
+	 * Sets the time between the frames in seconds, which converts Velocity (in units per second) to a distance.
+	 * Defaults to 1/24.
+	 */
+	void set_frame_time( double seconds ){
+		m_frameTime = seconds;
+	}
+
+	/**
+	 * Enables writing particles that are in only one of the frames. See the class description.
+	 */
+	void set_keep_unmatched( bool keep ){
+		m_keepUnmatched = keep;
+	}
+
+	/**
+	 * Sets the maximum number of threads to use, or 0 for one per core.
+	 */
+	void set_threads( unsigned threads ){
+		m_threads = threads;
+	}
+
+	/**
+	 * @return The number of particles found in both frames by the last write().
+	 */
+	detail::prt_int64 matched_count() const {
+		return m_matched;
+	}
+
+	/**
+	 * @return The number of particles only in the second frame, found by the last write().
+	 */
+	detail::prt_int64 born_count() const {
+		return m_born;
+	}
+
+	/**
+	 * @return The number of particles only in the first frame, found by the last write().
+	 */
+	detail::prt_int64 died_count() const {
+		return m_died;
+	}
+
+	/**
+	 * Writes every sub-frame added with add_output().
+	 * @param firstFile Path to the earlier frame.
+	 * @param secondFile Path to the later frame.
+	 */
+	void write( const std::string& firstFile, const std::string& secondFile ){
+		if( m_outputs.empty() )
+			throw std::logic_error( "No sub-frames were given to interpolate between \"" + firstFile + "\" and \"" + secondFile + "\"" );
+
+		m_matched = m_born = m_died = 0;
+
+		prt_ifstream firstIn( firstFile ), secondIn( secondFile );
+		if( !firstIn.has_channel( m_idChannel ) )
+			throw std::runtime_error( "The file \"" + firstFile + "\" has no " + m_idChannel + " channel to match particles by" );
+		if( !secondIn.has_channel( m_idChannel ) )
+			throw std::runtime_error( "The file \"" + secondFile + "\" has no " + m_idChannel + " channel to match particles by" );
+
+		//The IDs are copied out as single 64 bit integers, so anything else can't be matched.
+		const detail::prt_channel& firstId = firstIn.get_layout().get_channel( m_idChannel );
+		if( !detail::is_integral( firstId.type ) || firstId.arity != 1 )
+			throw std::runtime_error( "The " + m_idChannel + " channel of \"" + firstFile + "\" is not a single integer" );
+		const detail::prt_channel& secondId = secondIn.get_layout().get_channel( m_idChannel );
+		if( !detail::is_integral( secondId.type ) || secondId.arity != 1 )
+			throw std::runtime_error( "The " + m_idChannel + " channel of \"" + secondFile + "\" is not a single integer" );
+
+		build_channels( firstIn.get_layout(), secondIn.get_layout() );
+
+		//Load the channels being interpolated, and the ID, from the first frame, and index it by ID.
+		particle_table first, second;
+		for( std::size_t c = 0, cEnd = m_channels.size(); c < cEnd; ++c ){
+			first.add_channel( m_channels[c].name, firstIn.get_layout().get_channel( m_channels[c].name ).type, m_channels[c].arity );
+			second.add_channel( m_channels[c].name, secondIn.get_layout().get_channel( m_channels[c].name ).type, m_channels[c].arity );
+		}
+		if( !first.has_channel( m_idChannel ) ){
+			first.add_channel( m_idChannel, firstId.type, 1 );
+			second.add_channel( m_idChannel, secondId.type, 1 );
+		}
+
+		first.load( firstIn );
+		firstIn.close();
+
+		std::vector<data_types::int64_t> ids( first.size() );
+		if( !ids.empty() )
+			first.copy_channel( m_idChannel, &ids[0], 0, ids.size() );
+
+		detail::id_hash index;
+		if( index.build( ids.empty() ? NULL : &ids[0], ids.size() ) > 0 )
+			throw std::runtime_error( "The file \"" + firstFile + "\" has more than one particle with the same " + m_idChannel );
+		std::vector<data_types::int64_t>().swap( ids );
+
+		std::vector<unsigned char> matched( first.size(), 0 );
+
+		for( std::vector< std::unique_ptr<output> >::iterator it = m_outputs.begin(), itEnd = m_outputs.end(); it != itEnd; ++it ){
+			output& out = **it;
+			out.block = particle_table();
+			for( std::size_t c = 0, cEnd = m_channels.size(); c < cEnd; ++c )
+				out.block.add_channel( m_channels[c].name, m_channels[c].type, m_channels[c].arity );
+			out.block.declare_channels( out.stream );
+			out.stream.set_compute_stats( true );
+			out.stream.open( out.path );
+		}
+
+		//Stream the second frame through, joining each block against the index.
+		prt_block_reader reader( secondIn, m_blockSize );
+		std::vector<data_types::int64_t> blockIds;
+		std::vector<std::size_t> rows, firstRows, secondRows, bornRows;
+		pair_block pairs, born;
+
+		while( reader.read_next_block( second ) ){
+			const std::size_t n = second.size();
+			blockIds.resize( n );
+			rows.resize( n );
+			second.copy_channel( m_idChannel, &blockIds[0], 0, n );
+
+			const std::size_t chunk = 8192;
+			detail::parallel_for( ( n + chunk - 1 ) / chunk, [&]( std::size_t k ){
+				for( std::size_t i = k * chunk, iEnd = std::min( n, i + chunk ); i < iEnd; ++i )
+					rows[i] = index.find( blockIds[i] );
+			}, m_threads );
+
+			firstRows.clear();
+			secondRows.clear();
+			bornRows.clear();
+			for( std::size_t i = 0; i < n; ++i ){
+				if( rows[i] != detail::id_hash::npos ){
+					matched[rows[i]] = 1;
+					firstRows.push_back( rows[i] );
+					secondRows.push_back( i );
+				}else{
+					bornRows.push_back( i );
+				}
+			}
+			m_matched += static_cast<detail::prt_int64>( firstRows.size() );
+			m_born += static_cast<detail::prt_int64>( bornRows.size() );
+
+			pairs.count = firstRows.size();
+			read_side( first, &firstRows, pairs.count, pairs.first );
+			read_side( second, &secondRows, pairs.count, pairs.second );
+			write_block( pairs );
+
+			if( m_keepUnmatched && !bornRows.empty() ){
+				born.count = bornRows.size();
+				read_side( second, &bornRows, born.count, born.second );
+				extrapolate( born.second, -1, born.first );
+				write_block( born );
+			}
+		}
+		secondIn.close();
+
+		//Every particle of the first frame that wasn't matched died before the second.
+		for( std::size_t i = 0, iEnd = matched.size(); i < iEnd; ){
+			firstRows.clear();
+			for( ; i < iEnd && firstRows.size() < m_blockSize; ++i ){
+				if( !matched[i] )
+					firstRows.push_back( i );
+			}
+			m_died += static_cast<detail::prt_int64>( firstRows.size() );
+
+			if( m_keepUnmatched && !firstRows.empty() ){
+				pairs.count = firstRows.size();
+				read_side( first, &firstRows, pairs.count, pairs.first );
+				extrapolate( pairs.first, 1, pairs.second );
+				write_block( pairs );
+			}
+		}
+
+		for( std::vector< std::unique_ptr<output> >::iterator it = m_outputs.begin(), itEnd = m_outputs.end(); it != itEnd; ++it )
+			(*it)->stream.close();
+	}
+};
+
+}//namespace prtio
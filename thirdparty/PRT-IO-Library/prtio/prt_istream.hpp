@@ -21,6 +21,8 @@
 #include <prtio/detail/conversion.hpp>
 #include <prtio/detail/data_types.hpp>
 #include <prtio/prt_layout.hpp>
+#include <prtio/prt_metadata.hpp>
+#include <prtio/prt_stats.hpp>
 
 #include <cstring>
 #include <exception>
@@ -51,6 +53,13 @@ protected:
 	//The layout of the particle data from the source (ex. PRT file).
 	prt_layout m_layout;
 
+	//The key/value metadata from the source, if it has any.
+	prt_metadata m_metadata;
+
+	//What the stream has done so far. Subclasses add the work they do below this class, ex. decompression.
+	prt_stats m_stats;
+	bool m_timing;
+
 	/**
 	 * This abstract function provides the interface for subclasses to produce particle data.
 	 * When prt_istream::read_next_particle() is called, it uses read_impl() to get the next
@@ -63,8 +72,24 @@ protected:
 	 */
 	virtual bool read_impl( char* dest ) = 0;
 
+	/**
+	 * This function provides the interface for subclasses to produce a contiguous block of particles. The default
+	 * implementation calls read_impl() once per particle, but subclasses should override it when they can produce
+	 * many particles more cheaply in one go (ex. a single inflate() call for the whole block).
+	 * @param dest A pointer to the location where the subclass should read 'count' particles with layout 'm_layout',
+	 *             packed one after the other.
+	 * @param count The maximum number of particles to read.
+	 * @return The number of particles read. A return less than 'count' indicates EOF.
+	 */
+	virtual std::size_t read_block_impl( char* dest, std::size_t count ){
+		std::size_t result = 0;
+		for( std::size_t particleSize = m_layout.size(); result < count && this->read_impl( dest ); ++result )
+			dest += particleSize;
+		return result;
+	}
+
 public:
-	prt_istream()
+	prt_istream() : m_timing( false )
 	{}
 
 	virtual ~prt_istream()
@@ -79,6 +104,55 @@ public:
 		return m_layout.has_channel( name );
 	}
 
+	/**
+	 * @return The layout of the particles produced by this stream, as they appear before any bound channels are extracted.
+	 */
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	/**
+	 * @return The metadata of the stream, ex. the "BoundBox" of a version 2 PRT file. Empty if the source has none.
+	 */
+	const prt_metadata& get_metadata() const {
+		return m_metadata;
+	}
+
+	/**
+	 * @return The counters and timers of the work the stream has done. See prt_stats.
+	 */
+	const prt_stats& get_stats() const {
+		return m_stats;
+	}
+
+	void reset_stats(){
+		m_stats.reset();
+	}
+
+	/**
+	 * Enables the timers in get_stats(). They are off by default, since they read the clock around every call into the
+	 * stream's source and every particle extracted by read_next_particle().
+	 */
+	void set_timing( bool timing ){
+		m_timing = timing;
+	}
+
+	/**
+	 * @return The timer that consumers who extract channels themselves (ex. particle_table::load()) should add their
+	 *         time to, or NULL if timing is disabled. For use with detail::stats_timer.
+	 */
+	double* convert_timer(){
+		return m_timing ? &m_stats.convertSeconds : NULL;
+	}
+
+	/**
+	 * Subclasses that know how many particles they will produce can override this to let consumers preallocate.
+	 * @return The number of particles remaining in the stream, or -1 if that is not known.
+	 */
+	virtual data_types::int64_t particles_remaining() const {
+		return -1;
+	}
+
 	/**
 	 * This template function will bind a user-supplied variable to a named channel extracted from a prt_istream
 	 * @tparam T The type of the variable to bind to.
@@ -131,13 +205,31 @@ public:
 
 		bool result = this->read_impl( data );
 		if( result ){
+			++m_stats.particles;
+			m_stats.rawBytes += static_cast<data_types::int64_t>( m_layout.size() );
+
 			//If we read a particle from the source, extract the channel data as requested by the user.
+			detail::stats_timer timer( convert_timer() );
 			for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it )
 				it->copyFn( it->dest, data + it->src, it->arity );
 		}
 
 		return result;
 	}
+
+	/**
+	 * This reads up to 'count' particles in the stream's own layout (see get_layout()) without extracting any bound
+	 * channels. This is the bulk path for consumers that store particles themselves, such as particle_table.
+	 * @param dest A pointer to at least count * get_layout().size() bytes.
+	 * @param count The maximum number of particles to read.
+	 * @return The number of particles read. A return less than 'count' indicates EOF.
+	 */
+	std::size_t read_particle_block( char* dest, std::size_t count ){
+		std::size_t result = this->read_block_impl( dest, count );
+		m_stats.particles += static_cast<data_types::int64_t>( result );
+		m_stats.rawBytes += static_cast<data_types::int64_t>( result * m_layout.size() );
+		return result;
+	}
 	
 	/**
 	 * This returns an std::vector array of strings containing all the channels' names.
@@ -0,0 +1,602 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a KD-tree over the positions in a PRT file, which is saved next to the file.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/id_index_file.hpp>
+#include <prtio/detail/mapped_file.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/resume_reader.hpp>
+#include <prtio/particle_table.hpp>
+#include <prtio/prt_id_index.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+namespace detail{
+
+	/**
+	 * This struct is a node of a prt_kdtree, as stored in the sidecar. The nodes are in depth first order, so a node's
+	 * left child is the next node.
+	 */
+	struct kd_node{
+		float bmin[3], bmax[3];    //The bounds of the points under the node.
+		data_types::uint32_t first; //The first sorted point under the node.
+		data_types::uint32_t count; //The number of points under the node.
+		data_types::uint32_t right; //The index of the right child, or 0 for a leaf.
+		data_types::uint32_t reserved;
+	};
+
+	/**
+	 * @return The number of nodes in a tree over 'count' points.
+	 */
+	inline std::size_t kd_node_count( std::size_t count, std::size_t leafSize ){
+		if( count <= leafSize )
+			return 1;
+		return 1 + kd_node_count( count / 2, leafSize ) + kd_node_count( count - count / 2, leafSize );
+	}
+
+	/**
+	 * @return The squared distance from a point to a box, or 0 if it is inside.
+	 */
+	inline float box_distance_squared( const float* p, const kd_node& node ){
+		float d2 = 0;
+		for( int k = 0; k < 3; ++k ){
+			float d = std::max( node.bmin[k] - p[k], std::max( 0.f, p[k] - node.bmax[k] ) );
+			d2 += d * d;
+		}
+		return d2;
+	}
+
+}//namespace detail
+
+/**
+ * This struct is one result of a prt_kdtree search.
+ */
+struct kd_neighbor{
+	data_types::int64_t particle; //The index of the particle in the file.
+	float distanceSquared;
+
+	bool operator<( const kd_neighbor& rhs ) const {
+		return distanceSquared < rhs.distanceSquared || ( distanceSquared == rhs.distanceSquared && particle < rhs.particle );
+	}
+};
+
+/**
+ * This class is a KD-tree over the Position channel of a PRT file, for nearest neighbor and radius searches without
+ * loading the file. build() decodes the file once, builds the tree on several threads and save() writes it next to
+ * the file (the file's path with ".prtkd" appended). open() memory maps that sidecar, so a tool opening a frame pays
+ * nothing but the pages its searches touch, instead of rebuilding the tree each time.
+ *
+ * The tree is a flat array of nodes in depth first order, each with the bounds of its points, over a copy of the
+ * positions sorted into leaves of up to 16. Searches only read the tree; read() then decompresses just the parts of the
+ * PRT file holding the particles found, from the resume points of the file's ID index (see prt_id_index) if it had
+ * one when the tree was built, or from the start of the file otherwise.
+ *
+ * The sidecar records the PRT file's size and checksum, and open() refuses a sidecar left by an older version of the
+ * file. Searches don't modify the tree, so any number of threads may search at once.
+ *
+ * Usage:
+ *   prt_kdtree tree;
+ *   tree.open( "frame.0001.prt" );
+ *   std::vector<kd_neighbor> found;
+ *   tree.knn( p, 8, found );
+ *   particle_table particles;
+ *   tree.read( found, particles );
+ */
+class prt_kdtree{
+	std::string m_filePath;
+	prt_layout m_layout;
+	detail::particle_quantizer m_quantizer; //Converts fixed point channels back to floating point.
+
+	data_types::int64_t m_fileSize;
+	data_types::uint32_t m_adler;
+	data_types::uint32_t m_leafSize;
+	data_types::int64_t m_particleCount;
+
+	//The tree, pointing either into the vectors below after build(), or into the mapped sidecar after open().
+	const detail::kd_node* m_nodes;
+	std::size_t m_numNodes;
+	const data_types::uint32_t* m_order; //The index in the file of each sorted point.
+	const float* m_positions;            //The sorted points, as x, y, z.
+	const detail::resume_point* m_points;
+	std::size_t m_numPoints;
+
+	std::vector<detail::kd_node> m_nodeStore;
+	std::vector<data_types::uint32_t> m_orderStore;
+	std::vector<float> m_positionStore;
+	std::vector<detail::resume_point> m_pointStore;
+	detail::mapped_file m_map;
+
+	struct build_task{
+		std::size_t node, first, count;
+	};
+
+	static std::size_t padded( std::size_t bytes ){
+		return ( bytes + 7 ) & ~static_cast<std::size_t>( 7 );
+	}
+
+	static std::size_t header_size(){
+		return 48;
+	}
+
+	/**
+	 * Builds the subtree over sorted points [first, first + count) at 'node'. Subtrees at 'taskDepth' are added to
+	 * 'tasks' instead of being built, when 'tasks' isn't NULL.
+	 */
+	void build_node( const float* positions, std::size_t node, std::size_t first, std::size_t count, std::size_t depth, std::size_t taskDepth, std::vector<build_task>* tasks ){
+		if( tasks && depth == taskDepth ){
+			build_task task = { node, first, count };
+			tasks->push_back( task );
+			return;
+		}
+
+		detail::kd_node& n = m_nodeStore[node];
+		n.first = static_cast<data_types::uint32_t>( first );
+		n.count = static_cast<data_types::uint32_t>( count );
+		n.right = 0;
+		n.reserved = 0;
+		for( int k = 0; k < 3; ++k ){
+			n.bmin[k] = std::numeric_limits<float>::infinity();
+			n.bmax[k] = -std::numeric_limits<float>::infinity();
+		}
+
+		data_types::uint32_t* order = &m_orderStore[first];
+		for( std::size_t i = 0; i < count; ++i ){
+			const float* p = positions + 3 * static_cast<std::size_t>( order[i] );
+			for( int k = 0; k < 3; ++k ){
+				n.bmin[k] = std::min( n.bmin[k], p[k] );
+				n.bmax[k] = std::max( n.bmax[k], p[k] );
+			}
+		}
+
+		if( count <= m_leafSize )
+			return;
+
+		//Split the widest axis at the median, which keeps the tree balanced so the node layout is known in advance.
+		int axis = 0;
+		for( int k = 1; k < 3; ++k ){
+			if( n.bmax[k] - n.bmin[k] > n.bmax[axis] - n.bmin[axis] )
+				axis = k;
+		}
+
+		const std::size_t half = count / 2;
+		std::nth_element( order, order + half, order + count, [positions, axis]( data_types::uint32_t a, data_types::uint32_t b ){
+			return positions[3 * static_cast<std::size_t>( a ) + axis] < positions[3 * static_cast<std::size_t>( b ) + axis];
+		} );
+
+		const std::size_t right = node + 1 + detail::kd_node_count( half, m_leafSize );
+		n.right = static_cast<data_types::uint32_t>( right );
+
+		build_node( positions, node + 1, first, half, depth + 1, taskDepth, tasks );
+		build_node( positions, right, first + half, count - half, depth + 1, taskDepth, tasks );
+	}
+
+	void point_to_store(){
+		m_nodes = m_nodeStore.empty() ? NULL : &m_nodeStore[0];
+		m_numNodes = m_nodeStore.size();
+		m_order = m_orderStore.empty() ? NULL : &m_orderStore[0];
+		m_positions = m_positionStore.empty() ? NULL : &m_positionStore[0];
+		m_points = m_pointStore.empty() ? NULL : &m_pointStore[0];
+		m_numPoints = m_pointStore.size();
+	}
+
+	/**
+	 * Reads the layout of the PRT file from its header.
+	 * @return The file offset of the compressed particle data.
+	 */
+	data_types::int64_t read_layout(){
+		std::ifstream fin( m_filePath.c_str(), std::ios::in | std::ios::binary );
+		if( fin.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + m_filePath + "\"" );
+
+		prt_metadata metadata;
+		m_layout.clear();
+		detail::read_prt_header( fin, m_filePath, m_layout, &metadata );
+		m_quantizer.init_read( m_layout, metadata, m_filePath );
+		return static_cast<data_types::int64_t>( fin.tellg() );
+	}
+
+	void reset(){
+		m_filePath.clear();
+		m_layout.clear();
+		m_quantizer.clear();
+		m_fileSize = m_particleCount = 0;
+		m_adler = 0;
+		m_leafSize = 16;
+		m_nodes = NULL;
+		m_order = NULL;
+		m_positions = NULL;
+		m_points = NULL;
+		m_numNodes = m_numPoints = 0;
+		m_nodeStore.clear();
+		m_orderStore.clear();
+		m_positionStore.clear();
+		m_pointStore.clear();
+		m_map.close();
+	}
+
+	prt_kdtree( const prt_kdtree& );
+	prt_kdtree& operator=( const prt_kdtree& );
+
+public:
+	prt_kdtree(){
+		reset();
+	}
+
+	/**
+	 * @return The path of the tree sidecar for a PRT file.
+	 */
+	static std::string path_for( const std::string& prtFile ){
+		return prtFile + ".prtkd";
+	}
+
+	/**
+	 * @return True if the PRT file has a tree sidecar that is up to date.
+	 */
+	static bool has_index( const std::string& prtFile ){
+		try{
+			prt_kdtree tree;
+			tree.open( prtFile );
+			return true;
+		}catch( const std::exception& ){
+			return false;
+		}
+	}
+
+	/**
+	 * Builds the tree over a PRT file's positions, decoding the file once.
+	 * @param prtFile The path to the PRT file.
+	 * @param threads The maximum number of threads to use, or 0 for one per core.
+	 * @param leafSize The most points in a leaf.
+	 */
+	void build( const std::string& prtFile, unsigned threads = 0, std::size_t leafSize = 16 ){
+		reset();
+		m_leafSize = static_cast<data_types::uint32_t>( std::max<std::size_t>( 1, leafSize ) );
+
+		std::vector<float> positions;
+		{
+			prt_ifstream fin( prtFile );
+			if( !fin.has_channel( "Position" ) || fin.get_layout().get_channel( "Position" ).arity != 3 )
+				throw std::runtime_error( "The file \"" + prtFile + "\" has no Position channel with an arity of 3" );
+
+			const detail::prt_channel& ch = fin.get_layout().get_channel( "Position" );
+			const std::size_t particleSize = fin.get_layout().size();
+			const std::size_t batchParticles = std::max<std::size_t>( 1, ( 1 << 20 ) / particleSize );
+			std::vector<char> buffer( batchParticles * particleSize );
+			detail::convert_fn_t toFloat = detail::get_read_converter<float>( ch.type );
+
+			if( fin.particles_remaining() > 0 )
+				positions.reserve( 3 * static_cast<std::size_t>( fin.particles_remaining() ) );
+
+			std::size_t count;
+			while( ( count = fin.read_particle_block( &buffer[0], batchParticles ) ) > 0 ){
+				std::size_t base = positions.size();
+				positions.resize( base + 3 * count );
+
+				const char* src = &buffer[ ch.offset ];
+				for( std::size_t i = 0; i < count; ++i, src += particleSize )
+					toFloat( &positions[base + 3 * i], src, 3 );
+			}
+		}
+
+		const std::size_t count = positions.size() / 3;
+		if( count >= 0xFFFFFFFFu )
+			throw std::length_error( "Too many particles in \"" + prtFile + "\" for a KD-tree" );
+
+		m_filePath = prtFile;
+		m_particleCount = static_cast<data_types::int64_t>( count );
+		if( !detail::id_index_file::fingerprint( prtFile, m_fileSize, m_adler ) )
+			throw std::ios_base::failure( "Failed to read \"" + prtFile + "\"" );
+
+		//The ID index knows where the file can be resumed. Without one, only its start is known.
+		data_types::int64_t dataStart = read_layout();
+		try{
+			prt_id_index ids( prtFile );
+			m_pointStore = ids.get_resume_points();
+		}catch( const std::exception& ){
+			detail::resume_point pt = { 0, dataStart + 2 };
+			m_pointStore.assign( 1, pt );
+		}
+
+		m_orderStore.resize( count );
+		for( std::size_t i = 0; i < count; ++i )
+			m_orderStore[i] = static_cast<data_types::uint32_t>( i );
+		m_nodeStore.resize( detail::kd_node_count( count, m_leafSize ) );
+
+		//The top of the tree is split on this thread, until there are a few subtrees per thread to build in parallel.
+		std::size_t taskDepth = 2;
+		for( unsigned t = detail::thread_count( threads ); t > 1; t /= 2 )
+			++taskDepth;
+
+		const float* unsorted = positions.empty() ? NULL : &positions[0];
+		std::vector<build_task> tasks;
+		build_node( unsorted, 0, 0, count, 0, taskDepth, &tasks );
+		detail::parallel_for( tasks.size(), [&]( std::size_t i ){
+			build_node( unsorted, tasks[i].node, tasks[i].first, tasks[i].count, 0, 0, NULL );
+		}, threads );
+
+		m_positionStore.resize( 3 * count );
+		for( std::size_t i = 0; i < count; ++i )
+			memcpy( &m_positionStore[3 * i], &positions[3 * static_cast<std::size_t>( m_orderStore[i] )], 3 * sizeof(float) );
+
+		point_to_store();
+	}
+
+	/**
+	 * Writes the tree next to the PRT file, replacing any that was there. The layout is:
+	 *   char[8]  "PRTKD1" and two NULs
+	 *   int64    The size of the PRT file, uint32 the adler32 from its zlib trailer, and uint32 the leaf size.
+	 *   int64    The number of particles, the number of nodes and the number of resume points.
+	 *   The nodes (detail::kd_node), the index in the file of each sorted point as uint32, the sorted points as
+	 *   float32 x, y, z, and the resume points as two int64 (particle, offset), each array padded to 8 bytes.
+	 */
+	void save() const {
+		const std::string path = path_for( m_filePath );
+		std::ofstream fout( path.c_str(), std::ios::out | std::ios::binary );
+		if( fout.fail() )
+			throw std::ios_base::failure( "Failed to open the KD-tree \"" + path + "\" for writing" );
+
+		char magic[8] = { 'P', 'R', 'T', 'K', 'D', '1', '\0', '\0' };
+		data_types::int64_t numNodes = static_cast<data_types::int64_t>( m_numNodes );
+		data_types::int64_t numPoints = static_cast<data_types::int64_t>( m_numPoints );
+		const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		const std::size_t count = static_cast<std::size_t>( m_particleCount );
+
+		fout.write( magic, 8 );
+		fout.write( reinterpret_cast<const char*>( &m_fileSize ), 8 );
+		fout.write( reinterpret_cast<const char*>( &m_adler ), 4 );
+		fout.write( reinterpret_cast<const char*>( &m_leafSize ), 4 );
+		fout.write( reinterpret_cast<const char*>( &m_particleCount ), 8 );
+		fout.write( reinterpret_cast<const char*>( &numNodes ), 8 );
+		fout.write( reinterpret_cast<const char*>( &numPoints ), 8 );
+
+		fout.write( reinterpret_cast<const char*>( m_nodes ), sizeof(detail::kd_node) * m_numNodes );
+		if( count > 0 ){
+			fout.write( reinterpret_cast<const char*>( m_order ), sizeof(data_types::uint32_t) * count );
+			fout.write( zeros, padded( sizeof(data_types::uint32_t) * count ) - sizeof(data_types::uint32_t) * count );
+			fout.write( reinterpret_cast<const char*>( m_positions ), 3 * sizeof(float) * count );
+			fout.write( zeros, padded( 3 * sizeof(float) * count ) - 3 * sizeof(float) * count );
+		}
+		fout.write( reinterpret_cast<const char*>( m_points ), sizeof(detail::resume_point) * m_numPoints );
+
+		fout.close();
+		if( fout.fail() )
+			throw std::ios_base::failure( "Failed to write the KD-tree \"" + path + "\"" );
+	}
+
+	/**
+	 * Memory maps the tree sidecar of a PRT file.
+	 * @param prtFile The path to the PRT file, not the sidecar.
+	 * @throws std::runtime_error If the sidecar is missing, damaged, or was made for a different version of the file.
+	 */
+	void open( const std::string& prtFile ){
+		reset();
+
+		const std::string path = path_for( prtFile );
+		m_map.open( path );
+
+		const char* data = m_map.data();
+		if( m_map.size() < header_size() || memcmp( data, "PRTKD1\0", 8 ) != 0 )
+			throw std::runtime_error( "The file \"" + path + "\" is not a PRT KD-tree" );
+
+		data_types::int64_t numNodes, numPoints;
+		memcpy( &m_fileSize, data + 8, 8 );
+		memcpy( &m_adler, data + 16, 4 );
+		memcpy( &m_leafSize, data + 20, 4 );
+		memcpy( &m_particleCount, data + 24, 8 );
+		memcpy( &numNodes, data + 32, 8 );
+		memcpy( &numPoints, data + 40, 8 );
+
+		if( m_particleCount < 0 || m_particleCount >= 0xFFFFFFFFll || m_leafSize == 0 || numPoints < 1 || numNodes != static_cast<data_types::int64_t>( detail::kd_node_count( static_cast<std::size_t>( m_particleCount ), m_leafSize ) ) )
+			throw std::runtime_error( "The KD-tree \"" + path + "\" is corrupt" );
+
+		const std::size_t count = static_cast<std::size_t>( m_particleCount );
+		const std::size_t nodesAt = header_size();
+		const std::size_t orderAt = nodesAt + sizeof(detail::kd_node) * static_cast<std::size_t>( numNodes );
+		const std::size_t positionsAt = orderAt + padded( sizeof(data_types::uint32_t) * count );
+		const std::size_t pointsAt = positionsAt + padded( 3 * sizeof(float) * count );
+		if( m_map.size() != pointsAt + sizeof(detail::resume_point) * static_cast<std::size_t>( numPoints ) )
+			throw std::runtime_error( "The KD-tree \"" + path + "\" is truncated" );
+
+		data_types::int64_t fileSize;
+		data_types::uint32_t adler;
+		if( !detail::id_index_file::fingerprint( prtFile, fileSize, adler ) || fileSize != m_fileSize || adler != m_adler )
+			throw std::runtime_error( "The KD-tree of \"" + prtFile + "\" is out of date" );
+
+		m_filePath = prtFile;
+		read_layout();
+
+		m_nodes = reinterpret_cast<const detail::kd_node*>( data + nodesAt );
+		m_numNodes = static_cast<std::size_t>( numNodes );
+		m_order = reinterpret_cast<const data_types::uint32_t*>( data + orderAt );
+		m_positions = reinterpret_cast<const float*>( data + positionsAt );
+		m_points = reinterpret_cast<const detail::resume_point*>( data + pointsAt );
+		m_numPoints = static_cast<std::size_t>( numPoints );
+	}
+
+	const std::string& get_file_path() const {
+		return m_filePath;
+	}
+
+	/**
+	 * @return The layout of the particles in the PRT file.
+	 */
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	/**
+	 * @return The number of particles in the PRT file.
+	 */
+	data_types::int64_t num_particles() const {
+		return m_particleCount;
+	}
+
+	/**
+	 * @return The size of the tree in bytes, which is also the size of its sidecar.
+	 */
+	std::size_t memory_usage() const {
+		const std::size_t count = static_cast<std::size_t>( m_particleCount );
+		return header_size() + sizeof(detail::kd_node) * m_numNodes + padded( sizeof(data_types::uint32_t) * count ) + padded( 3 * sizeof(float) * count ) + sizeof(detail::resume_point) * m_numPoints;
+	}
+
+	/**
+	 * Finds the nearest particles to a point.
+	 * @param p The point, as x, y, z.
+	 * @param k The number of particles to find.
+	 * @param result Receives up to k particles, nearest first.
+	 */
+	void knn( const float* p, std::size_t k, std::vector<kd_neighbor>& result ) const {
+		result.clear();
+		if( k == 0 || m_numNodes == 0 || m_particleCount == 0 )
+			return;
+
+		//'result' is kept as a max heap on distance until the search ends.
+		std::pair<std::size_t, float> stack[64];
+		std::size_t depth = 0;
+		stack[depth++] = std::make_pair( std::size_t( 0 ), detail::box_distance_squared( p, m_nodes[0] ) );
+
+		while( depth > 0 ){
+			std::pair<std::size_t, float> top = stack[--depth];
+			if( result.size() == k && top.second > result.front().distanceSquared )
+				continue;
+
+			const detail::kd_node& node = m_nodes[top.first];
+			if( node.right == 0 ){
+				for( std::size_t i = node.first, iEnd = node.first + node.count; i < iEnd; ++i ){
+					const float* q = m_positions + 3 * i;
+					float x = q[0] - p[0], y = q[1] - p[1], z = q[2] - p[2];
+					kd_neighbor n = { static_cast<data_types::int64_t>( m_order[i] ), x * x + y * y + z * z };
+
+					if( result.size() < k ){
+						result.push_back( n );
+						std::push_heap( result.begin(), result.end() );
+					}else if( n < result.front() ){
+						std::pop_heap( result.begin(), result.end() );
+						result.back() = n;
+						std::push_heap( result.begin(), result.end() );
+					}
+				}
+				continue;
+			}
+
+			//Push the farther child first, so the nearer one is searched first and tightens the bound.
+			std::size_t left = top.first + 1, right = node.right;
+			float dLeft = detail::box_distance_squared( p, m_nodes[left] ), dRight = detail::box_distance_squared( p, m_nodes[right] );
+			if( dLeft < dRight ){
+				stack[depth++] = std::make_pair( right, dRight );
+				stack[depth++] = std::make_pair( left, dLeft );
+			}else{
+				stack[depth++] = std::make_pair( left, dLeft );
+				stack[depth++] = std::make_pair( right, dRight );
+			}
+		}
+
+		std::sort_heap( result.begin(), result.end() );
+	}
+
+	/**
+	 * Finds every particle within a radius of a point.
+	 * @param p The point, as x, y, z.
+	 * @param radius The search radius.
+	 * @param result Receives the particles, nearest first.
+	 */
+	void radius( const float* p, float radius, std::vector<kd_neighbor>& result ) const {
+		result.clear();
+		if( m_numNodes == 0 || m_particleCount == 0 )
+			return;
+
+		const float r2 = radius * radius;
+
+		std::size_t stack[64];
+		std::size_t depth = 0;
+		stack[depth++] = 0;
+
+		while( depth > 0 ){
+			const std::size_t index = stack[--depth];
+			const detail::kd_node& node = m_nodes[index];
+			if( detail::box_distance_squared( p, node ) > r2 )
+				continue;
+
+			if( node.right == 0 ){
+				for( std::size_t i = node.first, iEnd = node.first + node.count; i < iEnd; ++i ){
+					const float* q = m_positions + 3 * i;
+					float x = q[0] - p[0], y = q[1] - p[1], z = q[2] - p[2];
+					float d2 = x * x + y * y + z * z;
+					if( d2 <= r2 ){
+						kd_neighbor n = { static_cast<data_types::int64_t>( m_order[i] ), d2 };
+						result.push_back( n );
+					}
+				}
+				continue;
+			}
+
+			stack[depth++] = node.right;
+			stack[depth++] = index + 1;
+		}
+
+		std::sort( result.begin(), result.end() );
+	}
+
+	/**
+	 * Reads the particles found by a search from the PRT file, decompressing only the parts of the file holding them.
+	 * @param found The particles to read.
+	 * @param result Receives the particles, in the order of 'found'. If it has no channels it gets every channel of the
+	 *               file, otherwise the file must have its channels with the same types.
+	 * @param decoded If not NULL, receives the number of particles that were decompressed to find them.
+	 */
+	void read( const std::vector<kd_neighbor>& found, particle_table& result, data_types::int64_t* decoded = NULL ) const {
+		std::vector<data_types::int64_t> particles;
+		particles.reserve( found.size() );
+		for( std::vector<kd_neighbor>::const_iterator it = found.begin(), itEnd = found.end(); it != itEnd; ++it )
+			particles.push_back( it->particle );
+
+		std::sort( particles.begin(), particles.end() );
+		particles.erase( std::unique( particles.begin(), particles.end() ), particles.end() );
+
+		//The particles come back in file order, and are then put in the order they were found.
+		particle_table inFileOrder;
+		if( result.num_channels() > 0 ){
+			particle_table empty( result.get_layout() );
+			inFileOrder.swap( empty );
+		}
+
+		data_types::int64_t n = detail::read_particles_at( m_filePath, m_quantizer.get_stored_layout(), m_points, m_numPoints, m_particleCount, particles, inFileOrder, &m_quantizer );
+		if( decoded )
+			*decoded = n;
+
+		std::vector<std::size_t> rows;
+		rows.reserve( found.size() );
+		for( std::vector<kd_neighbor>::const_iterator it = found.begin(), itEnd = found.end(); it != itEnd; ++it )
+			rows.push_back( static_cast<std::size_t>( std::lower_bound( particles.begin(), particles.end(), it->particle ) - particles.begin() ) );
+
+		inFileOrder.gather( rows, result );
+	}
+};
+
+}//namespace prtio
@@ -28,9 +28,6 @@
 
 namespace prtio{
 
-class prt_istream;
-class prt_ostream;
-
 namespace detail{
 	//Stores the a PRT channel's offset from the start of the particle, as well as its type and arity.
 	struct prt_channel{
@@ -41,22 +38,21 @@ namespace detail{
 
 /**
  * This class represents the layout of a particle in the PRT file. It is created and used by the prt_istream and
- * subclasses.
+ * prt_ostream subclasses.
  */
 class prt_layout{
 	std::map<std::string, detail::prt_channel> m_channelMap;
 	std::vector<std::string> m_channels; //Stores the name of each channel, for easy integer indexing.
 	std::size_t m_totalSize;
 
-private:
-	friend class prt_istream;
-	friend class prt_ostream;
-
-	//private constructor so it can only be created by friend classes.
+public:
+	/**
+	 * Creates an empty layout. Layouts are usually obtained from a stream, but can be built directly with add_channel()
+	 * for writers that don't bind variables, such as prt_concurrent_ofstream.
+	 */
 	prt_layout() : m_totalSize( 0 )
 	{}
 
-public:
 	/**
 	 * Adds a named channel if it does not already exist.
 	 * @param name The name of the channel to add to the layout
@@ -85,6 +81,7 @@ public:
 	 */
 	void clear(){
 		m_channelMap.clear();
+		m_channels.clear();
 		m_totalSize = 0;
 	}
 
@@ -0,0 +1,444 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a class for combining several PRT files into one.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/quantize.hpp>
+#include <prtio/detail/zlib_blocks.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_layout.hpp>
+#include <prtio/prt_metadata.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+
+/**
+ * This class concatenates the particles of several PRT files into a single file.
+ *
+ * When every input has exactly the same layout, and none has channels stored as fixed point (whose parameters the
+ * merged file doesn't keep), the files are joined at the zlib level, in the manner of zlib's
+ * gzjoin example: each input's compressed data is copied verbatim with its final block demoted to an ordinary block,
+ * and only the checksums are combined. Nothing is recompressed, so the cost is one decode pass per input (run in
+ * parallel) to locate the block boundaries, followed by a sequential copy.
+ *
+ * Otherwise the output layout is the union of the input channels, with each channel widened to a type that holds
+ * every input's values (see detail::common_type()), and channels missing from an input are zero filled. The inputs
+ * are then decoded and converted one after another on the calling thread, and each block of converted particles is
+ * compressed on a work_queue as an independent deflate block (see detail::compress_block()). Blocks are appended in
+ * the order they were decoded, so the particles stay in input order and the output is the same on every run.
+ *
+ * Either way the merged file keeps the metadata the inputs agree on: the ranges ("BoundBox", and each channel's "Min"
+ * and "Max") are widened to cover every input, and any other value is kept if every input has the same one. Values
+ * that only some inputs have, or that differ between them, are dropped, as are the fixed point parameters of
+ * quantized inputs, since the merged file stores those channels as floats.
+ *
+ * Usage:
+ *   prt_merge merge;
+ *   merge.add_input( "a.prt" );
+ *   merge.add_input( "b.prt" );
+ *   merge.write( "ab.prt" );
+ */
+class prt_merge{
+	/**
+	 * This internal struct records what was learned about an input from its header.
+	 */
+	struct input{
+		std::string path;
+		prt_layout layout;
+		prt_metadata metadata;
+		detail::prt_int64 particleCount;
+		std::streamoff dataOffset; //The offset of the zlib stream in the file.
+		bool quantized;            //True if some channels are stored as fixed point, so the data can't be copied as is.
+	};
+
+	std::vector<input> m_inputs;
+	prt_layout m_layout;
+	prt_metadata m_metadata;
+	unsigned m_threads;
+	int m_level;
+	bool m_recompress;
+	bool m_joined;
+
+private:
+	static bool same_layout( const prt_layout& a, const prt_layout& b ){
+		if( a.num_channels() != b.num_channels() || a.size() != b.size() )
+			return false;
+
+		for( std::size_t i = 0, iEnd = a.num_channels(); i < iEnd; ++i ){
+			const std::string& name = a.get_channel_name( i );
+			if( !b.has_channel( name ) )
+				return false;
+
+			const detail::prt_channel& chA = a.get_channel( name );
+			const detail::prt_channel& chB = b.get_channel( name );
+			if( chA.type != chB.type || chA.arity != chB.arity || chA.offset != chB.offset )
+				return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Builds the union of the input layouts in m_layout, with the channels in order of first appearance.
+	 */
+	void build_union_layout(){
+		std::vector<std::string> names;
+		std::vector<detail::prt_channel> channels;
+
+		for( std::vector<input>::const_iterator it = m_inputs.begin(), itEnd = m_inputs.end(); it != itEnd; ++it ){
+			for( std::size_t i = 0, iEnd = it->layout.num_channels(); i < iEnd; ++i ){
+				const std::string& name = it->layout.get_channel_name( i );
+				const detail::prt_channel& ch = it->layout.get_channel( name );
+
+				std::size_t j = std::find( names.begin(), names.end(), name ) - names.begin();
+				if( j == names.size() ){
+					names.push_back( name );
+					channels.push_back( ch );
+					continue;
+				}
+
+				if( channels[j].arity != ch.arity )
+					throw std::runtime_error( "Channel \"" + name + "\" has a different arity in \"" + it->path + "\" than in an earlier input" );
+
+				data_types::enum_t type = detail::common_type( channels[j].type, ch.type );
+				if( type == data_types::type_count )
+					throw std::runtime_error( std::string() + "Channel \"" + name + "\" is stored as both " + data_types::names[ channels[j].type ] + " and " + data_types::names[ ch.type ] + ", which have no common type" );
+				channels[j].type = type;
+			}
+		}
+
+		m_layout.clear();
+		for( std::size_t i = 0, iEnd = names.size(); i < iEnd; ++i )
+			m_layout.add_channel( names[i], channels[i].type, channels[i].arity, m_layout.size() );
+	}
+
+	/**
+	 * @return True if a value holds a range of the particles, which is widened rather than required to match.
+	 */
+	static bool is_range( const prt_metadata::key_type& key ){
+		return key.first.empty() ? key.second == "BoundBox" : ( key.second == "Min" || key.second == "Max" );
+	}
+
+	/**
+	 * Widens a range to cover another input's range for the same key.
+	 * @return False if the two can't be combined, ex. because their arities differ.
+	 */
+	static bool widen_range( prt_metadata& metadata, const prt_metadata::key_type& key, const prt_metadata::value& range, const prt_metadata::value& other ){
+		if( range.type == data_types::type_count || other.type == data_types::type_count || range.arity != other.arity )
+			return false;
+		if( key.second == "BoundBox" && range.arity != 6 )
+			return false;
+
+		std::vector<double> a( range.arity ), b( range.arity );
+		if( !metadata.get( key.second, &a[0], a.size(), key.first ) )
+			return false;
+		detail::get_read_converter<double>( other.type )( &b[0], &other.data[0], other.arity );
+
+		//A BoundBox holds the minimum corner followed by the maximum corner.
+		for( std::size_t i = 0, iEnd = a.size(); i < iEnd; ++i ){
+			const bool isMax = ( key.second == "Max" ) || ( key.second == "BoundBox" && i >= 3 );
+			a[i] = isMax ? std::max( a[i], b[i] ) : std::min( a[i], b[i] );
+		}
+
+		if( range.type == data_types::type_float32 ){
+			std::vector<float> f( a.begin(), a.end() );
+			metadata.set( key.second, &f[0], f.size(), key.first );
+		}else{
+			metadata.set( key.second, &a[0], a.size(), key.first );
+		}
+		return true;
+	}
+
+	/**
+	 * Builds m_metadata from the inputs' metadata, as described in the class comment.
+	 */
+	void build_metadata(){
+		m_metadata = m_inputs.front().metadata;
+
+		for( std::size_t i = 1, iEnd = m_inputs.size(); i < iEnd; ++i ){
+			const prt_metadata& other = m_inputs[i].metadata;
+
+			std::vector<prt_metadata::key_type> dropped;
+			for( prt_metadata::const_iterator it = m_metadata.begin(), itEnd = m_metadata.end(); it != itEnd; ++it ){
+				const prt_metadata::value* v = other.find( it->first.second, it->first.first );
+				if( !v || ( is_range( it->first ) ? !widen_range( m_metadata, it->first, it->second, *v ) : ( v->rawType != it->second.rawType || v->data != it->second.data ) ) )
+					dropped.push_back( it->first );
+			}
+
+			for( std::vector<prt_metadata::key_type>::const_iterator it = dropped.begin(), itEnd = dropped.end(); it != itEnd; ++it )
+				m_metadata.erase( it->second, it->first );
+		}
+
+		for( std::size_t i = 0, iEnd = m_layout.num_channels(); i < iEnd; ++i ){
+			const std::string& name = m_layout.get_channel_name( i );
+			m_metadata.erase( "QuantizeMin", name );
+			m_metadata.erase( "QuantizeStep", name );
+			m_metadata.erase( "QuantizeType", name );
+			m_metadata.erase( "QuantizeError", name );
+		}
+	}
+
+	/**
+	 * Writes the output by copying each input's compressed data. Only valid when every input has the same layout.
+	 */
+	void join( const std::string& file ){
+		std::vector<detail::deflate_span> spans( m_inputs.size() );
+
+		detail::parallel_for( m_inputs.size(), [&]( std::size_t i ){
+			const input& in = m_inputs[i];
+
+			std::ifstream fin( in.path.c_str(), std::ios::in | std::ios::binary );
+			if( fin.fail() )
+				throw std::ios_base::failure( "Unable to open file \"" + in.path + "\"" );
+
+			fin.seekg( in.dataOffset, std::ios::beg );
+			spans[i] = detail::scan_zlib_stream( fin, in.path );
+
+			if( spans[i].rawSize != static_cast<data_types::uint64_t>( in.particleCount ) * in.layout.size() )
+				throw std::runtime_error( "The particle count in the header of \"" + in.path + "\" does not match its compressed data" );
+		}, m_threads );
+
+		detail::prt_int64 total = 0;
+		for( std::vector<input>::const_iterator it = m_inputs.begin(), itEnd = m_inputs.end(); it != itEnd; ++it )
+			total += it->particleCount;
+
+		std::ofstream fout( file.c_str(), std::ios::out | std::ios::binary );
+		if( fout.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for writing" );
+		fout.exceptions( std::ios::badbit|std::ios::failbit );
+
+		detail::write_prt_header( fout, m_layout, total, &m_metadata );
+
+		detail::zlib_stitcher stitcher;
+		stitcher.begin( fout );
+		for( std::size_t i = 0, iEnd = m_inputs.size(); i < iEnd; ++i ){
+			std::ifstream fin( m_inputs[i].path.c_str(), std::ios::in | std::ios::binary );
+			if( fin.fail() )
+				throw std::ios_base::failure( "Unable to open file \"" + m_inputs[i].path + "\"" );
+			stitcher.append( fin, spans[i] );
+		}
+		stitcher.finish();
+
+		fout.close();
+	}
+
+	/**
+	 * Writes the output by decoding every input, converting it to the union layout and recompressing it.
+	 */
+	void recompress( const std::string& file ){
+		std::ofstream fout( file.c_str(), std::ios::out | std::ios::binary );
+		if( fout.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + file + "\" for writing" );
+		fout.exceptions( std::ios::badbit|std::ios::failbit );
+
+		const std::ostream::pos_type countLocation = detail::write_prt_header( fout, m_layout, -1, &m_metadata );
+
+		//The compression jobs finish in any order, so a block waits in 'ready' until every block before it is written.
+		std::mutex mutex;
+		detail::zlib_stitcher stitcher;
+		std::map<std::size_t, detail::deflate_block> ready;
+		std::size_t nextBlock = 0, blocksSubmitted = 0;
+		detail::prt_int64 particleCount = 0;
+
+		stitcher.begin( fout );
+		{
+			detail::work_queue queue( m_threads );
+			const std::size_t destSize = m_layout.size();
+			const std::size_t blockCount = std::max<std::size_t>( 1, ( 1 << 20 ) / destSize );
+			const int level = m_level;
+
+			for( std::vector<input>::const_iterator input = m_inputs.begin(), inputEnd = m_inputs.end(); input != inputEnd; ++input ){
+				prt_ifstream in( input->path );
+				const prt_layout& inLayout = in.get_layout();
+
+				//Work out the conversion for each input channel once, rather than per particle.
+				struct channel_copy{
+					std::size_t srcOffset, destOffset, arity;
+					detail::convert_fn_t fn;
+				};
+				std::vector<channel_copy> copies;
+				for( std::size_t i = 0, iEnd = inLayout.num_channels(); i < iEnd; ++i ){
+					const detail::prt_channel& src = inLayout.get_channel( inLayout.get_channel_name( i ) );
+					const detail::prt_channel& dest = m_layout.get_channel( inLayout.get_channel_name( i ) );
+
+					channel_copy c;
+					c.srcOffset = src.offset;
+					c.destOffset = dest.offset;
+					c.arity = src.arity;
+					c.fn = detail::get_converter( dest.type, src.type );
+					copies.push_back( c );
+				}
+
+				const std::size_t srcSize = inLayout.size();
+				std::vector<char> srcBuffer( blockCount * srcSize );
+
+				for( std::size_t count; ( count = in.read_particle_block( &srcBuffer[0], blockCount ) ) > 0; ){
+					//The new buffer is zero filled, which covers the channels this input doesn't have.
+					std::shared_ptr< std::vector<char> > data = std::make_shared< std::vector<char> >( count * destSize );
+
+					for( std::vector<channel_copy>::const_iterator it = copies.begin(), itEnd = copies.end(); it != itEnd; ++it ){
+						const char* src = &srcBuffer[0] + it->srcOffset;
+						char* dest = &(*data)[0] + it->destOffset;
+						for( std::size_t j = 0; j < count; ++j, src += srcSize, dest += destSize )
+							it->fn( dest, src, it->arity );
+					}
+
+					const std::size_t sequence = blocksSubmitted++;
+					queue.push( [=, &mutex, &stitcher, &ready, &nextBlock, &particleCount](){
+						detail::deflate_block block;
+						detail::compress_block( &(*data)[0], data->size(), level, block );
+						block.particles = count;
+
+						std::lock_guard<std::mutex> lock( mutex );
+						std::swap( ready[sequence], block );
+
+						for( std::map<std::size_t, detail::deflate_block>::iterator it = ready.begin(); it != ready.end() && it->first == nextBlock; it = ready.begin() ){
+							stitcher.append( it->second );
+							particleCount += static_cast<detail::prt_int64>( it->second.particles );
+							++nextBlock;
+							ready.erase( it );
+						}
+					} );
+				}
+			}
+
+			queue.wait();
+		}
+		stitcher.finish();
+
+		fout.seekp( countLocation, std::ios::beg );
+		fout.write( reinterpret_cast<const char*>( &particleCount ), 8 );
+		fout.close();
+	}
+
+public:
+	prt_merge() : m_threads( 0 ), m_level( Z_DEFAULT_COMPRESSION ), m_recompress( false ), m_joined( false )
+	{}
+
+	/**
+	 * Adds a file to the end of the list of files to merge. Only the header is read.
+	 * @param file Path to the PRT file.
+	 */
+	void add_input( const std::string& file ){
+		std::ifstream fin( file.c_str(), std::ios::in | std::ios::binary );
+		if( fin.fail() )
+			throw std::ios_base::failure( "Unable to open file \"" + file + "\"" );
+
+		input in;
+		in.path = file;
+		in.particleCount = detail::read_prt_header( fin, file, in.layout, &in.metadata );
+		in.dataOffset = fin.tellg();
+		if( !fin )
+			throw std::runtime_error( "The input stream \"" + file + "\" has a truncated header." );
+
+		//The merged file is written without the fixed point parameters, so fixed point channels are read back as floats.
+		detail::particle_quantizer quantizer;
+		quantizer.init_read( in.layout, in.metadata, file );
+		in.quantized = !quantizer.empty();
+
+		m_inputs.push_back( in );
+	}
+
+	/**
+	 * Sets the maximum number of threads to use, or 0 for one per core.
+	 */
+	void set_threads( unsigned threads ){
+		m_threads = threads;
+	}
+
+	/**
+	 * Sets the zlib compression level used when the inputs have to be recompressed.
+	 */
+	void set_compression_level( int level ){
+		m_level = level;
+	}
+
+	/**
+	 * Forces the inputs to be recompressed even when they could be joined, ex. to change the compression level.
+	 */
+	void set_recompress( bool recompress ){
+		m_recompress = recompress;
+	}
+
+	/**
+	 * @return The total number of particles in the inputs added so far.
+	 */
+	detail::prt_int64 particle_count() const {
+		detail::prt_int64 result = 0;
+		for( std::vector<input>::const_iterator it = m_inputs.begin(), itEnd = m_inputs.end(); it != itEnd; ++it )
+			result += it->particleCount;
+		return result;
+	}
+
+	/**
+	 * @return The layout of the merged file. Only valid after write().
+	 */
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	/**
+	 * @return The metadata of the merged file. Only valid after write().
+	 */
+	const prt_metadata& get_metadata() const {
+		return m_metadata;
+	}
+
+	/**
+	 * @return True if the last write() joined the compressed data rather than recompressing it.
+	 */
+	bool joined() const {
+		return m_joined;
+	}
+
+	/**
+	 * Writes every input's particles, in order of add_input(), to a new file, along with the metadata the inputs agree
+	 * on (see the class comment).
+	 * @param file Path to the file to create. It must not be one of the inputs.
+	 */
+	void write( const std::string& file ){
+		if( m_inputs.empty() )
+			throw std::logic_error( "No input files were given to merge into \"" + file + "\"" );
+
+		m_joined = !m_recompress && !m_inputs.front().quantized;
+		for( std::vector<input>::const_iterator it = m_inputs.begin() + 1, itEnd = m_inputs.end(); it != itEnd && m_joined; ++it )
+			m_joined = !it->quantized && same_layout( m_inputs.front().layout, it->layout );
+
+		if( m_joined ){
+			m_layout = m_inputs.front().layout;
+			build_metadata();
+			join( file );
+		}else{
+			build_union_layout();
+			build_metadata();
+			recompress( file );
+		}
+	}
+};
+
+}//namespace prtio
@@ -0,0 +1,190 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of the typed key/value metadata stored in the header of version 2 PRT files.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/data_types.hpp>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class holds the metadata of a PRT file. Each value is an array of one of the PRT data types, named by a key and
+ * optionally attached to a channel. File level values (ex. "BoundBox") have an empty channel name.
+ *
+ * Values are converted on the way in and out like channels are, so get<double>() works on a float32 value. Values of a
+ * type this library doesn't know are kept as raw bytes, so they survive being read and written back, but can only be
+ * fetched with find().
+ */
+class prt_metadata{
+public:
+	/**
+	 * This struct is a single stored value.
+	 */
+	struct value{
+		data_types::enum_t type; //type_count if the type wasn't recognized, in which case 'rawType' has the file's code.
+		data_types::int32_t rawType;
+		std::size_t arity;
+		std::vector<char> data;
+	};
+
+	//A value's key is its channel name (empty for file level values) and its own name.
+	typedef std::pair<std::string, std::string> key_type;
+	typedef std::map<key_type, value>::const_iterator const_iterator;
+
+private:
+	std::map<key_type, value> m_values;
+
+public:
+	/**
+	 * Sets a value, replacing any value with the same key.
+	 * @param name The name of the value, ex. "BoundBox".
+	 * @param values The 'arity' elements of the value.
+	 * @param arity The number of elements.
+	 * @param channel The channel the value describes, or empty for a file level value.
+	 */
+	template <class T>
+	void set( const std::string& name, const T* values, std::size_t arity, const std::string& channel = std::string() ){
+		value& v = m_values[ key_type( channel, name ) ];
+		v.type = data_types::traits<T>::data_type();
+		v.rawType = static_cast<data_types::int32_t>( v.type );
+		v.arity = arity;
+		v.data.resize( sizeof(T) * arity );
+		if( arity > 0 )
+			memcpy( &v.data[0], values, sizeof(T) * arity );
+	}
+
+	/**
+	 * Sets a single element value.
+	 * @overload
+	 */
+	template <class T>
+	void set( const std::string& name, T scalar, const std::string& channel = std::string() ){
+		set( name, &scalar, 1, channel );
+	}
+
+	/**
+	 * Sets a value from raw bytes, as read from a file.
+	 */
+	void set_raw( const key_type& key, data_types::int32_t rawType, const char* data, std::size_t size ){
+		value& v = m_values[key];
+		v.rawType = rawType;
+		if( rawType >= 0 && rawType < data_types::type_count ){
+			v.type = static_cast<data_types::enum_t>( rawType );
+			v.arity = size / data_types::sizes[v.type];
+		}else{
+			v.type = data_types::type_count;
+			v.arity = size;
+		}
+		v.data.assign( data, data + size );
+	}
+
+	/**
+	 * Fetches a value, converting it to T.
+	 * @param values Receives 'arity' elements.
+	 * @return False, leaving 'values' unchanged, if there is no such value, it isn't numeric, or its arity differs.
+	 */
+	template <class T>
+	bool get( const std::string& name, T* values, std::size_t arity, const std::string& channel = std::string() ) const {
+		const value* v = find( name, channel );
+		if( !v || v->type == data_types::type_count || v->arity != arity )
+			return false;
+
+		if( arity > 0 )
+			detail::get_read_converter<T>( v->type )( values, &v->data[0], arity );
+		return true;
+	}
+
+	/**
+	 * Fetches a single element value, or 'defaultValue' if there is none.
+	 * @overload
+	 */
+	template <class T>
+	T get( const std::string& name, T defaultValue, const std::string& channel = std::string() ) const {
+		get( name, &defaultValue, 1, channel );
+		return defaultValue;
+	}
+
+	/**
+	 * @return The stored value, or NULL if there is none.
+	 */
+	const value* find( const std::string& name, const std::string& channel = std::string() ) const {
+		std::map<key_type, value>::const_iterator it = m_values.find( key_type( channel, name ) );
+		return ( it != m_values.end() ) ? &it->second : NULL;
+	}
+
+	bool has( const std::string& name, const std::string& channel = std::string() ) const {
+		return find( name, channel ) != NULL;
+	}
+
+	void erase( const std::string& name, const std::string& channel = std::string() ){
+		m_values.erase( key_type( channel, name ) );
+	}
+
+	void clear(){
+		m_values.clear();
+	}
+
+	bool empty() const {
+		return m_values.empty();
+	}
+
+	std::size_t size() const {
+		return m_values.size();
+	}
+
+	/**
+	 * Iterates over the values in key order, so file level values come first.
+	 */
+	const_iterator begin() const {
+		return m_values.begin();
+	}
+
+	const_iterator end() const {
+		return m_values.end();
+	}
+
+	/**
+	 * Sets the "BoundBox" value, which holds the minimum then the maximum corner of the particle positions.
+	 */
+	void set_bounds( const float minimum[3], const float maximum[3] ){
+		float box[6] = { minimum[0], minimum[1], minimum[2], maximum[0], maximum[1], maximum[2] };
+		set( "BoundBox", box, 6 );
+	}
+
+	/**
+	 * @return False if the file has no "BoundBox" value. A box with minimum > maximum means there are no particles.
+	 */
+	bool get_bounds( float minimum[3], float maximum[3] ) const {
+		float box[6];
+		if( !get( "BoundBox", box, 6 ) )
+			return false;
+
+		for( int i = 0; i < 3; ++i ){
+			minimum[i] = box[i];
+			maximum[i] = box[i+3];
+		}
+		return true;
+	}
+};
+
+}//namespace prtio
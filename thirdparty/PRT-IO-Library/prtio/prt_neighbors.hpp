@@ -0,0 +1,374 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of classes for fixed radius neighbor searches over particles.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/data_types.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/particle_table.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class is a spatial hash over a set of points, for finding every point within a fixed radius of another. Space
+ * is divided into cubic cells as wide as the radius, so a search only visits the 27 cells around the query. Cells are
+ * hashed into a table of buckets with at least as many buckets as points, and the points are counting sorted by
+ * bucket. The result is three flat arrays: bucket starts, the original index of each sorted point, and the sorted
+ * positions, which is about 20 bytes per point and keeps each bucket's points together in memory.
+ *
+ * The bucket of each point is computed on several threads. The sort itself is sequential, which keeps the order of
+ * points in a bucket (and so the order sums are accumulated in) the same on every run. Searches don't modify the
+ * grid, so any number of threads may search at once.
+ */
+class spatial_grid{
+	float m_radius, m_invCell;
+	std::size_t m_mask;
+	std::vector<data_types::uint32_t> m_start; //The first sorted point of each bucket, and one past the last at the end.
+	std::vector<data_types::uint32_t> m_order; //The original index of each sorted point.
+	std::vector<float> m_points;               //The sorted points, as x, y, z.
+
+	void cell_of( const float* p, data_types::int64_t c[3] ) const {
+		for( int k = 0; k < 3; ++k )
+			c[k] = static_cast<data_types::int64_t>( std::floor( p[k] * m_invCell ) );
+	}
+
+	std::size_t bucket( data_types::int64_t x, data_types::int64_t y, data_types::int64_t z ) const {
+		data_types::uint64_t h = static_cast<data_types::uint64_t>( x ) * 0x9E3779B97F4A7C15ull;
+		h ^= static_cast<data_types::uint64_t>( y ) * 0xC2B2AE3D27D4EB4Full;
+		h ^= static_cast<data_types::uint64_t>( z ) * 0x165667B19E3779F9ull;
+		return static_cast<std::size_t>( h ^ ( h >> 29 ) ) & m_mask;
+	}
+
+public:
+	spatial_grid() : m_radius( 0 ), m_invCell( 0 ), m_mask( 0 )
+	{}
+
+	/**
+	 * Builds the grid.
+	 * @param positions The points, as x, y, z for each. For example the Position column of a particle_table.
+	 * @param count The number of points.
+	 * @param radius The search radius. It must be greater than zero.
+	 * @param threads The maximum number of threads to use, or 0 for one per core.
+	 */
+	void build( const float* positions, std::size_t count, float radius, unsigned threads = 0 ){
+		if( !( radius > 0 ) )
+			throw std::invalid_argument( "The neighbor search radius must be greater than zero" );
+		if( count >= 0xFFFFFFFFu )
+			throw std::length_error( "Too many particles for a neighbor search" );
+
+		m_radius = radius;
+		m_invCell = 1.f / radius;
+
+		std::size_t buckets = 16;
+		while( buckets < count )
+			buckets *= 2;
+		m_mask = buckets - 1;
+
+		std::vector<data_types::uint32_t> keys( count );
+
+		const std::size_t chunkSize = 65536;
+		detail::parallel_for( ( count + chunkSize - 1 ) / chunkSize, [&]( std::size_t chunk ){
+			std::size_t end = std::min( count, ( chunk + 1 ) * chunkSize );
+			for( std::size_t i = chunk * chunkSize; i < end; ++i ){
+				data_types::int64_t c[3];
+				cell_of( positions + 3 * i, c );
+				keys[i] = static_cast<data_types::uint32_t>( bucket( c[0], c[1], c[2] ) );
+			}
+		}, threads );
+
+		m_start.assign( buckets + 1, 0 );
+		for( std::size_t i = 0; i < count; ++i )
+			++m_start[ keys[i] + 1 ];
+		for( std::size_t b = 0; b < buckets; ++b )
+			m_start[b + 1] += m_start[b];
+
+		//Scatter with a running cursor per bucket, which ends up as the next bucket's start and is then shifted back.
+		m_order.resize( count );
+		m_points.resize( 3 * count );
+		for( std::size_t i = 0; i < count; ++i ){
+			data_types::uint32_t k = m_start[ keys[i] ]++;
+			m_order[k] = static_cast<data_types::uint32_t>( i );
+			m_points[3 * k] = positions[3 * i];
+			m_points[3 * k + 1] = positions[3 * i + 1];
+			m_points[3 * k + 2] = positions[3 * i + 2];
+		}
+		for( std::size_t b = buckets; b > 0; --b )
+			m_start[b] = m_start[b - 1];
+		m_start[0] = 0;
+	}
+
+	/**
+	 * Calls fn( index, distanceSquared ) for every point within the radius of 'p', including a point at 'p' itself.
+	 * @param p The position to search around, as x, y, z.
+	 * @param fn The function to call, with the index the point had when the grid was built.
+	 */
+	template <class Fn>
+	void for_each_neighbor( const float* p, Fn fn ) const {
+		if( m_order.empty() )
+			return;
+
+		const float r2 = m_radius * m_radius;
+
+		data_types::int64_t c[3];
+		cell_of( p, c );
+
+		//Distinct cells may share a bucket, which must only be visited once.
+		std::size_t visited[27];
+		std::size_t numVisited = 0;
+
+		for( int dz = -1; dz <= 1; ++dz )
+		for( int dy = -1; dy <= 1; ++dy )
+		for( int dx = -1; dx <= 1; ++dx ){
+			std::size_t b = bucket( c[0] + dx, c[1] + dy, c[2] + dz );
+
+			bool seen = false;
+			for( std::size_t v = 0; v < numVisited && !seen; ++v )
+				seen = ( visited[v] == b );
+			if( seen )
+				continue;
+			visited[numVisited++] = b;
+
+			for( data_types::uint32_t k = m_start[b], kEnd = m_start[b + 1]; k < kEnd; ++k ){
+				const float* q = &m_points[3 * k];
+				float x = q[0] - p[0], y = q[1] - p[1], z = q[2] - p[2];
+				float d2 = x * x + y * y + z * z;
+				if( d2 <= r2 )
+					fn( static_cast<std::size_t>( m_order[k] ), d2 );
+			}
+		}
+	}
+
+	float radius() const {
+		return m_radius;
+	}
+
+	std::size_t size() const {
+		return m_order.size();
+	}
+
+	/**
+	 * @return The original index of the point at sorted position k. Visiting points in sorted order keeps searches for
+	 *         nearby points close together in memory.
+	 */
+	std::size_t sorted_index( std::size_t k ) const {
+		return m_order[k];
+	}
+
+	/**
+	 * @return The point at sorted position k, as x, y, z.
+	 */
+	const float* sorted_position( std::size_t k ) const {
+		return &m_points[3 * k];
+	}
+
+	/**
+	 * @return The memory held by the grid, in bytes.
+	 */
+	std::size_t memory_usage() const {
+		return ( m_start.capacity() + m_order.capacity() ) * sizeof(data_types::uint32_t) + m_points.capacity() * sizeof(float);
+	}
+};
+
+/**
+ * This class computes channels from each particle's neighbors within a fixed radius: the number of neighbors, and an
+ * SPH density estimate using the poly6 kernel. It works on a particle_table, adding the computed channels as new
+ * columns, which particle_table::save() then writes to a prt_ostream along with the particles' other channels.
+ *
+ * Usage:
+ *   particle_table table;
+ *   table.load( fin );
+ *   prt_neighbors nb;
+ *   nb.set_radius( 0.1f );
+ *   nb.compute( table );
+ *   table.declare_channels( fout );
+ *   fout.open( "out.prt" );
+ *   table.save( fout );
+ */
+class prt_neighbors{
+	float m_radius;
+	float m_mass;
+	unsigned m_threads;
+	std::string m_densityChannel, m_countChannel, m_massChannel;
+	std::size_t m_gridMemory;
+
+	/**
+	 * Gets the Position channel as float32, converting it if the table stores another type.
+	 */
+	static const float* positions_of( const particle_table& table, std::vector<float>& scratch ){
+		if( !table.has_channel( "Position" ) )
+			throw std::runtime_error( "The particles have no Position channel for a neighbor search" );
+
+		const detail::prt_channel& ch = table.get_layout().get_channel( "Position" );
+		if( ch.arity != 3 )
+			throw std::runtime_error( "The Position channel must have an arity of 3 for a neighbor search" );
+
+		if( ch.type == data_types::type_float32 )
+			return static_cast<const float*>( table.get_column( table.channel_index( "Position" ) ) );
+
+		scratch.resize( 3 * table.size() );
+		if( !scratch.empty() )
+			table.copy_channel( "Position", &scratch[0], 0, table.size() );
+		return scratch.empty() ? NULL : &scratch[0];
+	}
+
+	/**
+	 * Stores a computed channel in the table, adding the column if needed. An existing column keeps its type, and the
+	 * values are converted to it (ex. a float64 Density from a simulation).
+	 */
+	static void set_column( particle_table& table, const std::string& name, data_types::enum_t type, const void* data ){
+		if( !table.has_channel( name ) )
+			table.add_channel( name, type, 1 );
+
+		const detail::prt_channel& ch = table.get_layout().get_channel( name );
+		if( ch.arity != 1 )
+			throw std::runtime_error( "The particles already have a \"" + name + "\" channel with an arity other than 1" );
+
+		detail::convert_fn_t convert = detail::get_converter( ch.type, type );
+		if( !convert )
+			throw std::runtime_error( "The channel \"" + name + "\" has a type that can't be converted to" );
+
+		if( table.size() > 0 )
+			convert( table.get_column( table.channel_index( name ) ), data, table.size() );
+	}
+
+public:
+	prt_neighbors() : m_radius( 0 ), m_mass( 1.f ), m_threads( 0 ), m_densityChannel( "Density" ), m_countChannel( "NeighborCount" ), m_massChannel( "Mass" ), m_gridMemory( 0 )
+	{}
+
+	/**
+	 * Sets the search radius, which is also the smoothing length of the density kernel. It must be set before computing.
+	 */
+	void set_radius( float radius ){
+		m_radius = radius;
+	}
+
+	/**
+	 * Sets the mass of each particle for the density estimate, used when the particles have no mass channel.
+	 * Defaults to 1.
+	 */
+	void set_mass( float mass ){
+		m_mass = mass;
+	}
+
+	/**
+	 * Sets the name of the density channel to write, or empty to not compute density. It is added as float32, or
+	 * converted to the type of an existing channel. Defaults to "Density".
+	 */
+	void set_density_channel( const std::string& name ){
+		m_densityChannel = name;
+	}
+
+	/**
+	 * Sets the name of the neighbor count channel to write, or empty to not count neighbors. It is added as int32, or
+	 * converted to the type of an existing channel. The count excludes the particle itself. Defaults to "NeighborCount".
+	 */
+	void set_count_channel( const std::string& name ){
+		m_countChannel = name;
+	}
+
+	/**
+	 * Sets the name of a channel holding each particle's mass for the density estimate. Defaults to "Mass". If the
+	 * particles don't have the channel, set_mass() is used for all of them.
+	 */
+	void set_mass_channel( const std::string& name ){
+		m_massChannel = name;
+	}
+
+	/**
+	 * Sets the maximum number of threads to use, or 0 for one per core.
+	 */
+	void set_threads( unsigned threads ){
+		m_threads = threads;
+	}
+
+	/**
+	 * @return The memory used by the spatial grid of the last computation, in bytes.
+	 */
+	std::size_t grid_memory() const {
+		return m_gridMemory;
+	}
+
+	/**
+	 * Computes the channels for the particles in a table, adding them as new columns (or overwriting existing ones with
+	 * an arity of 1, in their own type).
+	 */
+	void compute( particle_table& table ){
+		const std::size_t count = table.size();
+
+		std::vector<float> positionScratch;
+		const float* positions = positions_of( table, positionScratch );
+
+		spatial_grid grid;
+		grid.build( positions, count, m_radius, m_threads );
+		m_gridMemory = grid.memory_usage();
+
+		std::vector<float> massScratch;
+		const float* masses = NULL;
+		if( !m_densityChannel.empty() && !m_massChannel.empty() && table.has_channel( m_massChannel ) && count > 0 ){
+			if( table.get_layout().get_channel( m_massChannel ).arity != 1 )
+				throw std::runtime_error( "The mass channel \"" + m_massChannel + "\" must have an arity of 1" );
+
+			massScratch.resize( count );
+			table.copy_channel( m_massChannel, &massScratch[0], 0, count );
+			masses = &massScratch[0];
+		}
+
+		//Computed into separate arrays, since adding the columns moves the arena that 'positions' may point into.
+		std::vector<float> density( m_densityChannel.empty() ? 0 : count );
+		std::vector<data_types::int32_t> neighbors( m_countChannel.empty() ? 0 : count );
+
+		//poly6: W(r) = 315 / ( 64 pi h^9 ) * ( h^2 - r^2 )^3
+		const float h2 = m_radius * m_radius;
+		const float poly6 = static_cast<float>( 315.0 / ( 64.0 * 3.14159265358979323846 * std::pow( static_cast<double>( m_radius ), 9.0 ) ) );
+		const bool doDensity = !density.empty(), doCount = !neighbors.empty();
+
+		//Particles are visited in the grid's order, so consecutive searches touch the same buckets.
+		const std::size_t chunkSize = 4096;
+		detail::parallel_for( ( count + chunkSize - 1 ) / chunkSize, [&]( std::size_t chunk ){
+			std::size_t end = std::min( count, ( chunk + 1 ) * chunkSize );
+			for( std::size_t k = chunk * chunkSize; k < end; ++k ){
+				float sum = 0;
+				data_types::int32_t n = 0;
+
+				grid.for_each_neighbor( grid.sorted_position( k ), [&]( std::size_t j, float d2 ){
+					float w = h2 - d2;
+					sum += ( masses ? masses[j] : m_mass ) * w * w * w;
+					++n;
+				} );
+
+				std::size_t i = grid.sorted_index( k );
+				if( doDensity )
+					density[i] = poly6 * sum;
+				if( doCount )
+					neighbors[i] = n - 1;
+			}
+		}, m_threads );
+
+		if( doDensity )
+			set_column( table, m_densityChannel, data_types::type_float32, &density[0] );
+		if( doCount )
+			set_column( table, m_countChannel, data_types::type_int32, &neighbors[0] );
+	}
+};
+
+}//namespace prtio
@@ -20,18 +20,28 @@
 #pragma once
 
 #include <prtio/prt_ostream.hpp>
+#include <prtio/prt_metadata.hpp>
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/id_index_file.hpp>
 #include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/quantize.hpp>
+#include <prtio/detail/simd.hpp>
+#include <algorithm>
 #include <fstream>
+#include <limits>
+#include <vector>
 #include <zlib.h>
 
 namespace prtio{
 
 /**
- * This class implements the prt_istream interface, for reading particles from a file.
+ * This class implements the prt_ostream interface, for writing particles to a file, or to a std::ostream owned by the
+ * caller (ex. one handed to a plugin by its host application).
  */
 class prt_ofstream : public prt_ostream{
 	std::string m_filePath; //The path to the PRT file.
 	std::ofstream m_fout;   //The stream that is writing bytes to the file.
+	std::ostream* m_out;    //Either 'm_fout', or the caller's stream. NULL when closed.
 	z_stream m_zstream;     //The zlib stream that is compressing particles for writing to the file.
 
 	char* m_buffer;           //A temporary buffer for storing the compressed file data before being flushed to disk.
@@ -39,7 +49,39 @@ class prt_ofstream : public prt_ostream{
 
 	detail::prt_int64 m_particleCount; //The number of particles written so far.
 
-	std::ostream::streampos m_countLocation; //The location that we need to write the final particle count to.
+	std::ostream::pos_type m_countLocation; //The location that we need to write the final particle count to.
+
+	prt_metadata m_metadata;                       //Written as a version 2 header when not empty.
+	detail::metadata_locations m_metadataLocations; //Where each metadata value was written, for patching statistics.
+
+	/**
+	 * This internal struct accumulates the range of one floating point channel as particles are written.
+	 */
+	struct channel_stats{
+		std::string name;
+		std::size_t offset, arity;
+		detail::convert_fn_t toFloat;
+		std::vector<float> minimum, maximum;
+	};
+
+	bool m_computeStats;
+	std::vector<channel_stats> m_channelStats;
+	std::vector<float> m_statsScratch;
+
+	std::ostream::pos_type m_dataStart;               //Where the compressed particle data starts.
+	std::size_t m_resumeInterval;                     //Particles between resume points, or 0 for none.
+	std::size_t m_fileInterval;                       //The interval in effect for the open file.
+	std::size_t m_sinceResume;                        //Particles written since the last resume point.
+	std::vector<detail::resume_point> m_resumePoints; //Kept after close(), until the next open().
+
+	std::string m_indexChannel;                //The channel to index, or empty to write no ID index.
+	detail::convert_fn_t m_indexConvert;       //Reads the ID channel as int64.
+	std::size_t m_indexOffset;                 //The offset of the ID channel in a particle.
+	std::vector<detail::id_entry> m_indexEntries;
+
+	std::vector<detail::quantize_request> m_quantizeRequests; //The channels to store as fixed point.
+	detail::particle_quantizer m_quantizer;                   //Converts particles to the stored layout.
+	std::vector<char> m_quantizeBuffer;                       //Particles in the stored layout, before compression.
 
 private:
 	/**
@@ -47,48 +89,158 @@ private:
 	 * for the file. It expects 'm_layout' to not change afterwards, or else you are a bad human/android/robot.
 	 */
 	void write_header(){
-		using namespace detail;
+		if( m_computeStats )
+			reserve_stats();
 
-		// Write the main header data
-		prt_header_v1 header;
-		memset( &header, 0, sizeof(prt_header_v1) );
+		m_quantizer.clear();
+		if( !m_quantizeRequests.empty() )
+			m_quantizer.init_write( m_layout, m_quantizeRequests, m_metadata, m_filePath );
 
-		header.magicNumber = prt_magic_number();
-		header.headerLength = sizeof(prt_header_v1);
-		strncpy(header.fmtIdentStr, prt_signature_string(), 32);
-		header.version = 1;
-		header.particleCount = -1;
+		const prt_layout& storedLayout = m_quantizer.empty() ? m_layout : m_quantizer.get_stored_layout();
+		m_countLocation = detail::write_prt_header( *m_out, storedLayout, -1, &m_metadata, &m_metadataLocations );
+		m_dataStart = m_out->tellp();
 
-		m_countLocation = ((char*)&header.particleCount - (char*)&header) + m_fout.tellp(); //This is where we need to seek to in order to write the particle count at the end.
+		//Make the header visible right away to readers following the file (see prt_ifstream::set_follow()).
+		m_out->flush();
+	}
 
-		m_fout.write(reinterpret_cast<const char*>(&header), sizeof(prt_header_v1));
+	/**
+	 * Prepares the resume points and ID index for a newly opened file.
+	 * @param writeIndex Whether the file gets an ID index, which is only written next to files opened by path.
+	 */
+	void init_index( bool writeIndex ){
+		m_resumePoints.clear();
+		m_indexEntries.clear();
+		m_sinceResume = 0;
+		m_fileInterval = m_resumeInterval;
+		m_indexConvert = NULL;
+
+		if( writeIndex && !m_indexChannel.empty() ){
+			if( !m_layout.has_channel( m_indexChannel ) )
+				throw std::runtime_error( "The ID index channel \"" + m_indexChannel + "\" is not in the layout of \"" + m_filePath + "\"" );
+
+			const detail::prt_channel& ch = m_layout.get_channel( m_indexChannel );
+			if( !detail::is_integral( ch.type ) || ch.arity != 1 )
+				throw std::runtime_error( "The ID index channel \"" + m_indexChannel + "\" of \"" + m_filePath + "\" is not a single integer" );
+
+			m_indexConvert = detail::get_read_converter<data_types::int64_t>( ch.type );
+			m_indexOffset = ch.offset;
+			if( m_fileInterval == 0 )
+				m_fileInterval = 65536;
+		}
 
-		// Write the reserved bytes
-		prt_int32 reservedInt = 4;
-		m_fout.write(reinterpret_cast<const char*>(&reservedInt), 4);
+		//The data starts with a 2 byte zlib header, after which raw inflate can start.
+		if( m_fileInterval > 0 ){
+			detail::resume_point pt = { 0, static_cast<data_types::int64_t>( m_dataStart ) + 2 };
+			m_resumePoints.push_back( pt );
+		}
+	}
 
-		// Write the channel map
-		prt_channel_header_v1 prtChannel;
+	/**
+	 * Adds a resume point after the particles written so far. Z_FULL_FLUSH ends the current deflate block on a byte
+	 * boundary and forgets the history, so nothing after it refers back to data before it.
+	 */
+	void add_resume_point(){
+		for(;;){
+			int ret;
+			{
+				detail::stats_timer timer( m_timing ? &m_stats.zlibSeconds : NULL );
+				ret = deflate( &m_zstream, Z_FULL_FLUSH );
+			}
+			if( ret == Z_STREAM_ERROR )
+				throw std::runtime_error( "deflate() call writing to \"" + m_filePath + "\" failed:\n\t" + zError(ret) );
 
-		prt_int32 channelCount = static_cast<prt_int32>( m_layout.num_channels() );
-		prt_int32 channelHeaderItemSize = sizeof(prt_channel_header_v1);
+			//The flush is complete once deflate() leaves room in the buffer.
+			if( m_zstream.avail_out != 0 )
+				break;
+			flush();
+		}
+
+		detail::resume_point pt = { m_particleCount, static_cast<data_types::int64_t>( m_dataStart ) + static_cast<data_types::int64_t>( m_zstream.total_out ) };
+		m_resumePoints.push_back( pt );
+		m_sinceResume = 0;
+	}
+
+	/**
+	 * Writes the ID index sidecar for the file just closed.
+	 */
+	void write_index( data_types::int64_t fileSize, data_types::uint32_t adler ){
+		detail::id_index_file index;
+		index.fileSize = fileSize;
+		index.adler = adler;
+		index.particleCount = m_particleCount;
+		index.idChannel = m_indexChannel;
+		index.points = m_resumePoints;
+		index.entries.swap( m_indexEntries );
+		std::sort( index.entries.begin(), index.entries.end() );
+		index.save( detail::id_index_file::path_for( m_filePath ) );
+	}
+
+	/**
+	 * Adds placeholder "Min" and "Max" values for each floating point channel, and a "BoundBox" for Position, which are
+	 * overwritten in the header by close(). The placeholders describe an empty range, which is correct if no particles
+	 * are written.
+	 */
+	void reserve_stats(){
+		m_channelStats.clear();
+		for( std::size_t i = 0, iEnd = m_layout.num_channels(); i < iEnd; ++i ){
+			const std::string& name = m_layout.get_channel_name( i );
+			const detail::prt_channel& ch = m_layout.get_channel( name );
+			if( !detail::is_float( ch.type ) )
+				continue;
+
+			channel_stats stats;
+			stats.name = name;
+			stats.offset = ch.offset;
+			stats.arity = ch.arity;
+			stats.toFloat = detail::get_read_converter<float>( ch.type );
+			stats.minimum.assign( ch.arity, std::numeric_limits<float>::infinity() );
+			stats.maximum.assign( ch.arity, -std::numeric_limits<float>::infinity() );
+			m_channelStats.push_back( stats );
+
+			m_metadata.set( "Min", &stats.minimum[0], ch.arity, name );
+			m_metadata.set( "Max", &stats.maximum[0], ch.arity, name );
+			if( name == "Position" && ch.arity == 3 )
+				m_metadata.set_bounds( &stats.minimum[0], &stats.maximum[0] );
+		}
+	}
 
-		m_fout.write(reinterpret_cast<const char*>(&channelCount), 4);
-		m_fout.write(reinterpret_cast<const char*>(&channelHeaderItemSize), 4);
+	/**
+	 * Widens the channel ranges to include 'count' particles, just before they are compressed.
+	 */
+	void update_stats( const char* data, std::size_t count ){
+		const std::size_t particleSize = m_layout.size();
+		for( std::vector<channel_stats>::iterator it = m_channelStats.begin(), itEnd = m_channelStats.end(); it != itEnd; ++it ){
+			m_statsScratch.resize( count * it->arity );
 
-		for( int i = 0; i < channelCount; ++i ) {
-			memset( &prtChannel, 0, sizeof(prt_channel_header_v1) );
+			const char* src = data + it->offset;
+			for( std::size_t i = 0; i < count; ++i, src += particleSize )
+				it->toFloat( &m_statsScratch[i * it->arity], src, it->arity );
 
-			std::string chName = m_layout.get_channel_name( static_cast<std::size_t>(i) );
+			detail::minmax_interleaved( &m_statsScratch[0], count, it->arity, &it->minimum[0], &it->maximum[0] );
+		}
+	}
 
-			const detail::prt_channel& ch = m_layout.get_channel( chName );
+	/**
+	 * Overwrites a reserved metadata value in the header. The file pointer is left wherever the value ended.
+	 */
+	void patch_metadata( const std::string& name, const std::string& channel, const float* values, std::size_t arity ){
+		detail::metadata_locations::const_iterator it = m_metadataLocations.find( prt_metadata::key_type( channel, name ) );
+		if( it != m_metadataLocations.end() ){
+			m_out->seekp( it->second, std::ios::beg );
+			m_out->write( reinterpret_cast<const char*>( values ), sizeof(float) * arity );
+		}
+	}
 
-			strncpy( prtChannel.channelName, chName.c_str(), 32 );
-			prtChannel.channelArity = (prt_int32)ch.arity;
-			prtChannel.channelType = (prt_int32)ch.type;
-			prtChannel.channelOffset = (prt_int32)ch.offset;
+	void write_stats(){
+		for( std::vector<channel_stats>::const_iterator it = m_channelStats.begin(), itEnd = m_channelStats.end(); it != itEnd; ++it ){
+			patch_metadata( "Min", it->name, &it->minimum[0], it->arity );
+			patch_metadata( "Max", it->name, &it->maximum[0], it->arity );
 
-			m_fout.write(reinterpret_cast<const char*>(&prtChannel), sizeof(prt_channel_header_v1));
+			if( it->name == "Position" && it->arity == 3 ){
+				float box[6] = { it->minimum[0], it->minimum[1], it->minimum[2], it->maximum[0], it->maximum[1], it->maximum[2] };
+				patch_metadata( "BoundBox", std::string(), box, 6 );
+			}
 		}
 	}
 
@@ -114,7 +266,14 @@ private:
 	void flush(){
 		std::size_t numOut = (m_bufferSize - m_zstream.avail_out);
 		if( numOut > 0 ) {
-			m_fout.write( m_buffer, numOut );
+			{
+				detail::stats_timer timer( m_timing ? &m_stats.ioSeconds : NULL );
+				m_out->write( m_buffer, numOut );
+			}
+			m_stats.compressedBytes += static_cast<data_types::int64_t>( numOut );
+			++m_stats.bufferRefills;
+			if( m_out->fail() )
+				throw std::ios_base::failure( "Failed to write to \"" + m_filePath + "\"" );
 			m_zstream.avail_out = static_cast<unsigned int>( m_bufferSize );
 			m_zstream.next_out = reinterpret_cast<unsigned char*>( m_buffer );
 		}
@@ -129,6 +288,14 @@ public:
 		m_bufferSize = 0;
 		m_particleCount = 0;
 		m_countLocation = 0;
+		m_computeStats = false;
+		m_dataStart = 0;
+		m_resumeInterval = 0;
+		m_fileInterval = 0;
+		m_sinceResume = 0;
+		m_indexConvert = NULL;
+		m_indexOffset = 0;
+		m_out = NULL;
 		memset( &m_zstream, 0, sizeof(m_zstream) );
 	}
 
@@ -141,6 +308,89 @@ public:
 		close();
 	}
 
+	/**
+	 * @return The metadata to write in the file header. It must be filled in before open(), and is cleared by close().
+	 */
+	prt_metadata& get_metadata(){
+		return m_metadata;
+	}
+
+	/**
+	 * Enables computing the range of every floating point channel while particles are written, at the cost of one
+	 * min/max per element just before it is compressed. close() stores the ranges as each channel's "Min" and "Max"
+	 * metadata, and the range of Position as the file's "BoundBox", so readers can cull the file or plan allocations
+	 * without decoding it. Must be called before open().
+	 */
+	void set_compute_stats( bool computeStats ){
+		m_computeStats = computeStats;
+	}
+
+	/**
+	 * Makes the compressed data resumable every 'particles' particles, so a reader can seek to one of the points and
+	 * decompress from there instead of from the start of the file. Each point ends a deflate block early and restarts
+	 * the compressor's history, which grows the file slightly; at the default of 65536 particles this is well under a
+	 * percent. The points are available from get_resume_points() after close(). Must be called before open().
+	 * @param particles The number of particles between points, or 0 for none.
+	 */
+	void set_resume_interval( std::size_t particles ){
+		m_resumeInterval = particles;
+	}
+
+	/**
+	 * @return The resume points of the last file written, in particle order. The first is at particle 0. They are
+	 *         complete once the file is closed, and are kept until the next open().
+	 */
+	const std::vector<detail::resume_point>& get_resume_points() const {
+		return m_resumePoints;
+	}
+
+	/**
+	 * Enables writing an ID index next to the file (the file's path with ".prtidx" appended) when it is closed, for
+	 * finding particles by ID with prt_id_index without decompressing the whole file. The IDs are collected as
+	 * particles are written, at 16 bytes per particle, and sorted by close(). Enables resume points every 65536
+	 * particles unless set_resume_interval() chose otherwise. Only files opened by path get an index. Must be called
+	 * before open().
+	 * @param channel The integer channel holding the particle IDs, or empty to disable the index.
+	 */
+	void set_id_index( const std::string& channel = "ID" ){
+		m_indexChannel = channel;
+	}
+
+	/**
+	 * Stores a floating point channel as 16 or 32 bit fixed point within the given bounds, so that every value read
+	 * back is within 'maxError' of the value written. prt_ifstream converts it back to the channel's type, so readers
+	 * see the layout that was written. 16 bits are used when the bounds span at most 65535 steps of about
+	 * 2 * 'maxError' (ex. a Position within 100 units to 0.001), which halves a float32 channel before compression.
+	 * Writing a value outside the bounds throws std::out_of_range. Must be called before open().
+	 * @param channel The name of the channel, which must be floating point.
+	 * @param minimum The smallest value of each element of the channel.
+	 * @param maximum The largest value of each element of the channel.
+	 * @param arity The number of elements in 'minimum' and 'maximum', which must be the channel's arity.
+	 * @param maxError The largest difference allowed between a value written and the value read back.
+	 */
+	void set_quantization( const std::string& channel, const float* minimum, const float* maximum, std::size_t arity, double maxError ){
+		detail::quantize_request req;
+		req.channel = channel;
+		req.minimum.assign( minimum, minimum + arity );
+		req.maximum.assign( maximum, maximum + arity );
+		req.maxError = maxError;
+
+		for( std::vector<detail::quantize_request>::iterator it = m_quantizeRequests.begin(), itEnd = m_quantizeRequests.end(); it != itEnd; ++it ){
+			if( it->channel == channel ){
+				*it = req;
+				return;
+			}
+		}
+		m_quantizeRequests.push_back( req );
+	}
+
+	/**
+	 * Stops storing any channel as fixed point. Must be called before open().
+	 */
+	void clear_quantization(){
+		m_quantizeRequests.clear();
+	}
+
 	/**
 	 * Opens the prt_ofstream to write to the specified file
 	 * @param file Path to the file to write particles to
@@ -152,8 +402,31 @@ public:
 
 		m_filePath = file;
 		m_fout.exceptions( std::ios::badbit|std::ios::failbit ); //We want an exception if writing anything fails.
+		m_out = &m_fout;
+		m_stats.reset();
 
 		write_header();
+		init_index( true );
+		init_zlib();
+	}
+
+	/**
+	 * Opens the prt_ofstream to write to a stream the caller owns, starting at its current position. The stream must be
+	 * seekable, since close() goes back to fill in the particle count (and statistics). It is left positioned after the
+	 * particles, and is not closed.
+	 * @param out The stream to write particles to. It must outlive this object, or the next call to close().
+	 * @param name The name to use for the stream in error messages.
+	 */
+	void open( std::ostream& out, const std::string& name ){
+		if( out.tellp() == std::ostream::pos_type( -1 ) )
+			throw std::ios_base::failure( "The output stream \"" + name + "\" is not seekable" );
+
+		m_filePath = name;
+		m_out = &out;
+		m_stats.reset();
+
+		write_header();
+		init_index( false );
 		init_zlib();
 	}
 
@@ -161,11 +434,21 @@ public:
 	 * Closes the stream, and deallocates any memory used for decompressing particles.
 	 */
 	void close(){
+		data_types::uint32_t adler = 0;
 		if( m_buffer ){
 			// Write out all the rest of the stream data, until we hit Z_STREAM_END
-			while(Z_STREAM_END != deflate(&m_zstream, Z_FINISH))
+			for(;;){
+				int ret;
+				{
+					detail::stats_timer timer( m_timing ? &m_stats.zlibSeconds : NULL );
+					ret = deflate(&m_zstream, Z_FINISH);
+				}
+				if( ret == Z_STREAM_END )
+					break;
 				flush();
+			}
 			flush();
+			adler = static_cast<data_types::uint32_t>( m_zstream.adler );
 
 			delete[] m_buffer;
 			m_buffer = NULL;
@@ -178,43 +461,136 @@ public:
 		}
 
 		//Seek back to the beginning of the file and write the particle count in the header region.
-		if( m_fout.is_open() ){
+		if( m_out ){
+			std::ostream::pos_type end = m_out->tellp();
 			if( m_countLocation > 0 ){
-				m_fout.seekp( m_countLocation, std::ios::beg );
-				m_fout.write( reinterpret_cast<char*>( &m_particleCount ), 8 );
+				m_out->seekp( m_countLocation, std::ios::beg );
+				m_out->write( reinterpret_cast<char*>( &m_particleCount ), 8 );
+			}
+			write_stats();
+
+			//A point after the last particle would resume at the end of the data, so it is dropped.
+			if( m_resumePoints.size() > 1 && m_resumePoints.back().particle == m_particleCount )
+				m_resumePoints.pop_back();
+
+			if( m_out == &m_fout ){
+				m_fout.close();
+				if( !m_indexChannel.empty() )
+					write_index( static_cast<data_types::int64_t>( end ), adler );
+			}else{
+				m_out->seekp( end, std::ios::beg );
+				m_out->flush();
 			}
-			m_fout.close();
+			m_out = NULL;
 		}
 
 		m_filePath.clear();
 		m_layout.clear();
+		m_metadata.clear();
+		m_metadataLocations.clear();
+		m_channelStats.clear();
+		m_indexEntries.clear();
+		m_quantizer.clear();
 
 		m_bufferSize = 0;
 		m_particleCount = 0;
 		m_countLocation = 0;
 	}
 
+private:
+	/**
+	 * Compresses 'size' bytes of particle data into 'm_buffer', flushing to disk whenever the buffer fills.
+	 * @param data The particle data to compress.
+	 * @param size The number of bytes to compress.
+	 */
+	void deflate_particles( const char* data, std::size_t size ){
+		m_zstream.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>(data) );
+
+		//avail_in is a uInt, so 4GB or more is given to deflate() a piece at a time.
+		while( size != 0 ){
+			m_zstream.avail_in = static_cast<uInt>( std::min<std::size_t>( size, std::numeric_limits<uInt>::max() ) );
+			size -= m_zstream.avail_in;
+
+			for(;;) {
+				int ret;
+				{
+					detail::stats_timer timer( m_timing ? &m_stats.zlibSeconds : NULL );
+					ret = deflate(&m_zstream, Z_NO_FLUSH);
+				}
+				if(ret == Z_STREAM_ERROR)
+					throw std::runtime_error( "deflate() call writing to \"" + m_filePath + "\" failed:\n\t" + zError(ret) );
+
+				if(m_zstream.avail_out == 0) {	//Did we fill the output buffer completely? If so flush and loop.
+					flush();
+				} else {
+					break;
+				}
+			}
+		}
+	}
+
+	/**
+	 * Compresses 'count' particles that don't cross a resume point, updating the statistics and the ID index.
+	 */
+	void write_particles( const char* data, std::size_t count ){
+		//Quantizing comes first, since it fails on a value out of bounds.
+		const char* stored = data;
+		std::size_t storedSize = count * m_layout.size();
+		if( !m_quantizer.empty() ){
+			storedSize = count * m_quantizer.get_stored_layout().size();
+			m_quantizeBuffer.resize( storedSize );
+			{
+				detail::stats_timer timer( m_timing ? &m_stats.convertSeconds : NULL );
+				m_quantizer.encode( data, count, &m_quantizeBuffer[0] );
+			}
+			stored = &m_quantizeBuffer[0];
+		}
+
+		if( !m_channelStats.empty() )
+			update_stats( data, count );
+
+		if( m_indexConvert ){
+			const std::size_t particleSize = m_layout.size();
+			const char* src = data + m_indexOffset;
+			for( std::size_t i = 0; i < count; ++i, src += particleSize ){
+				detail::id_entry entry;
+				m_indexConvert( &entry.id, src, 1 );
+				entry.particle = m_particleCount + static_cast<detail::prt_int64>( i );
+				m_indexEntries.push_back( entry );
+			}
+		}
+
+		deflate_particles( stored, storedSize );
+		m_particleCount += static_cast<detail::prt_int64>( count );
+
+		if( m_fileInterval > 0 && ( m_sinceResume += count ) >= m_fileInterval )
+			add_resume_point();
+	}
+
 protected:
 	/**
 	 * Compresses a single particle into 'm_buffer' and flushes to disk if the buffer is full.
 	 * @param data The data for the particle to write to disk.
 	 */
 	virtual void write_impl( const char* data ){
-		++m_particleCount;
-
-		m_zstream.avail_in = static_cast<unsigned>( m_layout.size() );
-		m_zstream.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>(data) );
-
-		for(;;) {
-			int ret = deflate(&m_zstream, Z_NO_FLUSH);
-			if(ret == Z_STREAM_ERROR)
-				throw std::runtime_error( "deflate() call writing to \"" + m_filePath + "\" failed:\n\t" + zError(ret) );
+		write_particles( data, 1 );
+	}
 
-			if(m_zstream.avail_out == 0) {	//Did we fill the output buffer completely? If so flush and loop.
-				flush();
-			} else {
-				break;
-			}
+	/**
+	 * Compresses a block of particles into 'm_buffer' with a single deflate() pass, flushing to disk as the buffer fills.
+	 * @param data The data for 'count' particles to write to disk.
+	 * @param count The number of particles in 'data'.
+	 */
+	virtual void write_block_impl( const char* data, std::size_t count ){
+		//Blocks are split where they cross a resume point.
+		while( count > 0 ){
+			std::size_t n = count;
+			if( m_fileInterval > 0 )
+				n = std::min( n, m_fileInterval - m_sinceResume );
+
+			write_particles( data, n );
+			data += n * m_layout.size();
+			count -= n;
 		}
 	}
 };
@@ -21,7 +21,9 @@
 #include <prtio/detail/conversion.hpp>
 #include <prtio/detail/data_types.hpp>
 #include <prtio/prt_layout.hpp>
+#include <prtio/prt_stats.hpp>
 
+#include <cstring>
 #include <exception>
 #include <string>
 #include <sstream>
@@ -50,6 +52,10 @@ protected:
 	//The layout of the particle data from the source (ex. PRT file).
 	prt_layout m_layout;
 
+	//What the stream has done so far. Subclasses add the work they do below this class, ex. compression.
+	prt_stats m_stats;
+	bool m_timing;
+
 	/**
 	 * This abstract function provides the interface for subclasses to consume a single particle.
 	 * When prt_ostream::write_next_particle() is called, it uses write_impl() to commit the next
@@ -58,8 +64,20 @@ protected:
 	 */
 	virtual void write_impl( const char* src ) = 0;
 
+	/**
+	 * This function provides the interface for subclasses to consume a contiguous block of particles. The default
+	 * implementation calls write_impl() once per particle, but subclasses should override it when they can consume
+	 * many particles more cheaply in one go (ex. a single deflate() call for the whole block).
+	 * @param src A pointer to 'count' particles with layout described by 'm_layout', packed one after the other.
+	 * @param count The number of particles to write.
+	 */
+	virtual void write_block_impl( const char* src, std::size_t count ){
+		for( std::size_t i = 0, particleSize = m_layout.size(); i < count; ++i, src += particleSize )
+			this->write_impl( src );
+	}
+
 public:
-	prt_ostream()
+	prt_ostream() : m_timing( false )
 	{}
 
 	virtual ~prt_ostream()
@@ -75,8 +93,28 @@ public:
 	 */
 	template <typename T>
 	void bind( const std::string& name, T src[], std::size_t arity, data_types::enum_t destType = data_types::traits<T>::data_type() ){
-		if( m_layout.has_channel( name ) )
-			throw std::logic_error( "Channel \"" + name + "\" is already bound" );
+		std::size_t destOffset = m_layout.size();
+
+		//A channel previously declared with add_channel() is bound in place, keeping its declared type.
+		if( m_layout.has_channel( name ) ){
+			const detail::prt_channel& ch = m_layout.get_channel( name );
+			for( std::vector< bound_channel >::const_iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it ){
+				if( it->dest == ch.offset )
+					throw std::logic_error( "Channel \"" + name + "\" is already bound" );
+			}
+
+			if( arity != ch.arity ){
+				std::stringstream ss;
+				ss << "Incompatible types for channel \"" << name << "\"";
+				ss << ", cannot convert from arity: \"" << arity << "\"";
+				ss << "to: \"" << ch.arity << "\"";
+
+				throw std::logic_error( ss.str() );
+			}
+
+			destType = ch.type;
+			destOffset = ch.offset;
+		}
 
 		if( !detail::is_compatible( destType, data_types::traits<T>::data_type() ) ){
 			std::stringstream ss;
@@ -87,9 +125,8 @@ public:
 			throw std::logic_error( ss.str() );
 		}
 
-		std::size_t destOffset = m_layout.size();
-
-		m_layout.add_channel( name, destType, arity, destOffset );
+		if( !m_layout.has_channel( name ) )
+			m_layout.add_channel( name, destType, arity, destOffset );
 
 		bound_channel result;
 		result.src = src;
@@ -103,18 +140,85 @@ public:
 		m_boundChannels.push_back( result );
 	}
 
+	/**
+	 * Declares a channel in the stream's layout without binding a variable to it. The channel can be bound later with
+	 * bind(), or filled directly through write_particle_block(). Unbound channels are written as zeros by write_next_particle().
+	 * @param name The name of the channel to add.
+	 * @param type The data type the channel is stored as.
+	 * @param arity The number of grouped elements in the channel.
+	 */
+	void add_channel( const std::string& name, data_types::enum_t type, std::size_t arity ){
+		if( m_layout.has_channel( name ) )
+			throw std::logic_error( "Channel \"" + name + "\" is already declared" );
+
+		m_layout.add_channel( name, type, arity, m_layout.size() );
+	}
+
+	/**
+	 * @return The layout of the particles written to this stream, as determined by bind() and add_channel().
+	 */
+	const prt_layout& get_layout() const {
+		return m_layout;
+	}
+
+	/**
+	 * @return The counters and timers of the work the stream has done. See prt_stats.
+	 */
+	const prt_stats& get_stats() const {
+		return m_stats;
+	}
+
+	void reset_stats(){
+		m_stats.reset();
+	}
+
+	/**
+	 * Enables the timers in get_stats(). They are off by default, since they read the clock around every call into the
+	 * stream's destination and every particle packed by write_next_particle().
+	 */
+	void set_timing( bool timing ){
+		m_timing = timing;
+	}
+
+	/**
+	 * @return The timer that producers who pack channels themselves (ex. particle_table::save()) should add their
+	 *         time to, or NULL if timing is disabled. For use with detail::stats_timer.
+	 */
+	double* convert_timer(){
+		return m_timing ? &m_stats.convertSeconds : NULL;
+	}
+
 	/**
 	 * This extracts the next particle's channel data from the variables supplied to bind(), then commits the particle to the stream.
 	 */
 	void write_next_particle(){
 		//Allocate some temporary stack space for the particle.
 		char* data = (char*)alloca( m_layout.size() );
-
-		//Go through each bound channel, grabbing the data from the ptr supplied by the user and writing into the particle.
-		for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it )
-			it->copyFn( data + it->dest, it->src, it->arity );
+		{
+			detail::stats_timer timer( convert_timer() );
+			if( m_boundChannels.size() < m_layout.num_channels() )
+				memset( data, 0, m_layout.size() );
+
+			//Go through each bound channel, grabbing the data from the ptr supplied by the user and writing into the particle.
+			for( std::vector< bound_channel >::iterator it = m_boundChannels.begin(), itEnd = m_boundChannels.end(); it != itEnd; ++it )
+				it->copyFn( data + it->dest, it->src, it->arity );
+		}
 
 		this->write_impl( data );
+		++m_stats.particles;
+		m_stats.rawBytes += static_cast<data_types::int64_t>( m_layout.size() );
+	}
+
+	/**
+	 * This commits 'count' particles that are already in the stream's layout (see get_layout()), ignoring any bound
+	 * channels. This is the bulk path for producers that store particles themselves, such as particle_table.
+	 * @param src A pointer to count * get_layout().size() bytes of particle data.
+	 * @param count The number of particles to write.
+	 */
+	void write_particle_block( const char* src, std::size_t count ){
+		this->write_block_impl( src, count );
+		m_stats.particles += static_cast<data_types::int64_t>( count );
+		m_stats.rawBytes += static_cast<data_types::int64_t>( count * m_layout.size() );
 	}
 };
 
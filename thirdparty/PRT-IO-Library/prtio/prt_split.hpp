@@ -0,0 +1,343 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a class for splitting a PRT file into several smaller ones.
+ */
+
+#pragma once
+
+#include <prtio/detail/conversion.hpp>
+#include <prtio/detail/parallel.hpp>
+#include <prtio/detail/prt_header.hpp>
+#include <prtio/detail/zlib_blocks.hpp>
+#include <prtio/prt_ifstream.hpp>
+#include <prtio/prt_layout.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+namespace prtio{
+
+/**
+ * This class splits a PRT file into pieces, either into runs of consecutive particles with nearly equal counts or
+ * into the cells of a regular grid over the particle positions. Every piece keeps the source layout.
+ *
+ * The source is decoded once on the calling thread, which copies each particle into the buffer of the piece it
+ * belongs to. A full buffer becomes a job on a work_queue that compresses it as an independent deflate block
+ * (see detail::compress_block()), so the pieces are compressed concurrently, and even a single piece receiving a
+ * long run of particles is compressed by several threads. Blocks are appended to their file in the order they were
+ * filled, so each piece has its particles in source order.
+ *
+ * Memory use is one block buffer per piece plus the blocks waiting on the queue, which holds a fixed number of jobs.
+ * A grid split keeps one file open per occupied cell, so choose a cell size that produces a reasonable number of files.
+ *
+ * Usage:
+ *   prt_split split;
+ *   split.split_by_count( "big.prt", 8, "piece.prt" ); //Writes piece_0000.prt to piece_0007.prt
+ */
+class prt_split{
+	/**
+	 * This internal class is one output file and the blocks of it that are being compressed.
+	 */
+	struct output{
+		std::string path;
+		std::ofstream fout;
+		std::ostream::pos_type countLocation;
+
+		std::shared_ptr< std::vector<char> > buffer; //The particles being collected for the next block.
+		std::size_t bufferCount;
+
+		std::mutex mutex; //Guards everything below, which is updated by the compression jobs.
+		detail::zlib_stitcher stitcher;
+		detail::prt_int64 particleCount;
+		std::size_t nextBlock;                              //The sequence number of the next block to append to the file.
+		std::map<std::size_t, detail::deflate_block> ready; //Blocks compressed out of order, waiting for their turn.
+
+		std::size_t blocksSubmitted; //Only used by the decoding thread.
+	};
+
+	prt_layout m_layout;
+	std::vector< std::unique_ptr<output> > m_outputs;
+
+	unsigned m_threads;
+	int m_level;
+	std::size_t m_blockBytes;
+	std::string m_positionChannel;
+
+private:
+	/**
+	 * Inserts a suffix before the extension of a file name, so "a/b.prt" with "_0001" becomes "a/b_0001.prt".
+	 */
+	static std::string piece_name( const std::string& pattern, const std::string& suffix ){
+		std::string::size_type dot = pattern.find_last_of( '.' );
+		std::string::size_type slash = pattern.find_last_of( "/\\" );
+		if( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+			return pattern + suffix;
+		return pattern.substr( 0, dot ) + suffix + pattern.substr( dot );
+	}
+
+	output* open_output( const std::string& path ){
+		std::unique_ptr<output> result( new output );
+		result->path = path;
+		result->fout.open( path.c_str(), std::ios::out | std::ios::binary );
+		if( result->fout.fail() )
+			throw std::ios_base::failure( "Failed to open file \"" + path + "\" for writing" );
+		result->fout.exceptions( std::ios::badbit|std::ios::failbit );
+
+		result->countLocation = detail::write_prt_header( result->fout, m_layout, -1 );
+		result->stitcher.begin( result->fout );
+		result->particleCount = 0;
+		result->nextBlock = 0;
+		result->blocksSubmitted = 0;
+		result->bufferCount = 0;
+
+		m_outputs.push_back( std::move( result ) );
+		return m_outputs.back().get();
+	}
+
+	/**
+	 * Hands an output's buffered particles to the queue for compression.
+	 */
+	void submit( output& out, detail::work_queue& queue ){
+		if( out.bufferCount == 0 )
+			return;
+
+		std::shared_ptr< std::vector<char> > data = out.buffer;
+		const std::size_t count = out.bufferCount;
+		const std::size_t sequence = out.blocksSubmitted++;
+		const int level = m_level;
+		output* dest = &out;
+
+		queue.push( [=](){
+			detail::deflate_block block;
+			detail::compress_block( &(*data)[0], data->size(), level, block );
+			block.particles = count;
+
+			std::lock_guard<std::mutex> lock( dest->mutex );
+			std::swap( dest->ready[sequence], block );
+
+			for( std::map<std::size_t, detail::deflate_block>::iterator it = dest->ready.begin(); it != dest->ready.end() && it->first == dest->nextBlock; it = dest->ready.begin() ){
+				dest->stitcher.append( it->second );
+				dest->particleCount += static_cast<detail::prt_int64>( it->second.particles );
+				++dest->nextBlock;
+				dest->ready.erase( it );
+			}
+		} );
+
+		//The job owns the old buffer now, so start a new one.
+		out.buffer = std::make_shared< std::vector<char> >();
+		out.buffer->reserve( m_blockBytes + m_layout.size() );
+		out.bufferCount = 0;
+	}
+
+	void append( output& out, const char* particles, std::size_t count, detail::work_queue& queue ){
+		if( !out.buffer ){
+			out.buffer = std::make_shared< std::vector<char> >();
+			out.buffer->reserve( m_blockBytes + m_layout.size() );
+		}
+
+		out.buffer->insert( out.buffer->end(), particles, particles + count * m_layout.size() );
+		out.bufferCount += count;
+
+		if( out.buffer->size() >= m_blockBytes )
+			submit( out, queue );
+	}
+
+	/**
+	 * Compresses the remaining buffers, waits for the queue and finishes every file.
+	 */
+	std::vector<std::string> finish( detail::work_queue& queue ){
+		for( std::size_t i = 0, iEnd = m_outputs.size(); i < iEnd; ++i )
+			submit( *m_outputs[i], queue );
+		queue.wait();
+
+		std::vector<std::string> result;
+		for( std::size_t i = 0, iEnd = m_outputs.size(); i < iEnd; ++i ){
+			output& out = *m_outputs[i];
+			out.stitcher.finish();
+			out.fout.seekp( out.countLocation, std::ios::beg );
+			out.fout.write( reinterpret_cast<const char*>( &out.particleCount ), 8 );
+			out.fout.close();
+			result.push_back( out.path );
+		}
+
+		m_outputs.clear();
+		return result;
+	}
+
+	/**
+	 * Opens the source file and sets m_layout from it.
+	 */
+	void open_source( prt_ifstream& in, const std::string& file ){
+		in.open( file );
+		m_layout = in.get_layout();
+		m_outputs.clear();
+	}
+
+	/**
+	 * The number of particles decoded at a time from the source.
+	 */
+	static std::size_t read_count(){
+		return 4096;
+	}
+
+public:
+	prt_split() : m_threads( 0 ), m_level( Z_DEFAULT_COMPRESSION ), m_blockBytes( 1 << 20 ), m_positionChannel( "Position" )
+	{}
+
+	/**
+	 * Sets the number of compression threads, or 0 for one per core.
+	 */
+	void set_threads( unsigned threads ){
+		m_threads = threads;
+	}
+
+	void set_compression_level( int level ){
+		m_level = level;
+	}
+
+	/**
+	 * Sets how much uncompressed data is collected for a piece before it is compressed. This bounds the memory used
+	 * per piece.
+	 */
+	void set_block_size( std::size_t bytes ){
+		m_blockBytes = bytes;
+	}
+
+	void set_position_channel( const std::string& name ){
+		m_positionChannel = name;
+	}
+
+	/**
+	 * Splits a file into runs of consecutive particles.
+	 * @param file The file to split.
+	 * @param pieces The number of files to write. Every file is written, even if it gets no particles.
+	 * @param pattern The name of the output files, which get "_0000", "_0001", etc. added before the extension.
+	 * @return The names of the files written.
+	 */
+	std::vector<std::string> split_by_count( const std::string& file, std::size_t pieces, const std::string& pattern ){
+		if( pieces == 0 )
+			throw std::invalid_argument( "Cannot split \"" + file + "\" into zero pieces" );
+
+		prt_ifstream in;
+		open_source( in, file );
+
+		const data_types::uint64_t total = static_cast<data_types::uint64_t>( in.particles_remaining() );
+
+		for( std::size_t i = 0; i < pieces; ++i ){
+			char suffix[32];
+			sprintf( suffix, "_%04u", static_cast<unsigned>( i ) );
+			open_output( piece_name( pattern, suffix ) );
+		}
+
+		detail::work_queue queue( m_threads );
+
+		const std::size_t particleSize = m_layout.size();
+		std::vector<char> buffer( read_count() * particleSize );
+
+		data_types::uint64_t index = 0;
+		std::size_t piece = 0;
+		for( std::size_t count; ( count = in.read_particle_block( &buffer[0], read_count() ) ) > 0; ){
+			const char* it = &buffer[0];
+			while( count > 0 ){
+				//Piece p holds particles [p*total/pieces, (p+1)*total/pieces).
+				const data_types::uint64_t pieceEnd = ( piece + 1 == pieces ) ? total : total * ( piece + 1 ) / pieces;
+				if( index >= pieceEnd && piece + 1 < pieces ){
+					++piece;
+					continue;
+				}
+
+				std::size_t n = static_cast<std::size_t>( std::min<data_types::uint64_t>( count, pieceEnd > index ? pieceEnd - index : count ) );
+				append( *m_outputs[piece], it, n, queue );
+
+				it += n * particleSize;
+				count -= n;
+				index += n;
+			}
+		}
+
+		return finish( queue );
+	}
+
+	/**
+	 * Splits a file into the cells of a grid with a corner at the origin. Only cells that contain particles are written.
+	 * @param file The file to split.
+	 * @param cellSize The size of a grid cell along each axis.
+	 * @param pattern The name of the output files, which get "_x_y_z" added before the extension, where x, y and z
+	 *                are the integer cell coordinates.
+	 * @return The names of the files written.
+	 */
+	std::vector<std::string> split_by_cell( const std::string& file, const double cellSize[3], const std::string& pattern ){
+		if( !( cellSize[0] > 0 && cellSize[1] > 0 && cellSize[2] > 0 ) )
+			throw std::invalid_argument( "The cell size for splitting \"" + file + "\" must be positive" );
+
+		prt_ifstream in;
+		open_source( in, file );
+
+		const detail::prt_channel& posChannel = m_layout.get_channel( m_positionChannel );
+		if( posChannel.arity != 3 || !detail::is_float( posChannel.type ) )
+			throw std::runtime_error( "The channel \"" + m_positionChannel + "\" of \"" + file + "\" is not a floating point 3-vector" );
+		detail::convert_fn_t readPos = detail::get_read_converter<double>( posChannel.type );
+
+		detail::work_queue queue( m_threads );
+
+		typedef std::map< std::vector<long>, output* > cell_map;
+		cell_map cells;
+		std::vector<long> key( 3 ), lastKey;
+		output* lastOutput = NULL;
+
+		const std::size_t particleSize = m_layout.size();
+		std::vector<char> buffer( read_count() * particleSize );
+
+		for( std::size_t count; ( count = in.read_particle_block( &buffer[0], read_count() ) ) > 0; ){
+			const char* it = &buffer[0];
+			for( std::size_t i = 0; i < count; ++i, it += particleSize ){
+				double p[3];
+				readPos( p, it + posChannel.offset, 3 );
+				for( int axis = 0; axis < 3; ++axis ){
+					//Clamp so that stray or NaN positions land in an edge cell instead of overflowing the cast.
+					double cell = std::floor( p[axis] / cellSize[axis] );
+					key[axis] = ( cell > -1e9 ) ? static_cast<long>( std::min( cell, 1e9 ) ) : -1000000000L;
+				}
+
+				//Neighbouring particles are usually in the same cell, so skip the map lookup when they are.
+				if( key != lastKey ){
+					cell_map::iterator cell = cells.find( key );
+					if( cell == cells.end() ){
+						char suffix[96];
+						sprintf( suffix, "_%ld_%ld_%ld", key[0], key[1], key[2] );
+						cell = cells.insert( std::make_pair( key, open_output( piece_name( pattern, suffix ) ) ) ).first;
+					}
+					lastKey = key;
+					lastOutput = cell->second;
+				}
+
+				append( *lastOutput, it, 1, queue );
+			}
+		}
+
+		return finish( queue );
+	}
+};
+
+}//namespace prtio
@@ -0,0 +1,97 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the counters and timers that streams keep about their work.
+ */
+
+#pragma once
+
+#include <prtio/detail/data_types.hpp>
+
+#include <chrono>
+#include <cstddef>
+
+namespace prtio{
+
+/**
+ * This struct holds what a stream has done since it was opened (or since prt_istream::reset_stats()), for finding
+ * where the time goes when reading or writing is slow. The counters are always kept, since they cost an addition per
+ * block. The timers are only kept once enabled with set_timing() on the stream, since reading the clock around every
+ * inflate() or deflate() call is measurable when particles are read one at a time.
+ */
+struct prt_stats{
+	data_types::int64_t particles;       //Particles read or written.
+	data_types::int64_t rawBytes;        //Uncompressed particle data, in the file's layout.
+	data_types::int64_t compressedBytes; //Compressed particle data read from or written to the file. Excludes the header.
+	data_types::int64_t bufferRefills;   //Times the compressed data buffer was refilled from the file, or flushed to it.
+
+	double ioSeconds;      //Time in the file's read() or write().
+	double zlibSeconds;    //Time in inflate() or deflate().
+	double convertSeconds; //Time moving channels between the file's layout and the caller's variables or columns.
+
+	prt_stats(){
+		reset();
+	}
+
+	void reset(){
+		particles = rawBytes = compressedBytes = bufferRefills = 0;
+		ioSeconds = zlibSeconds = convertSeconds = 0;
+	}
+
+	/**
+	 * Adds another stream's work to this one, for totals over several files.
+	 */
+	prt_stats& operator+=( const prt_stats& rhs ){
+		particles += rhs.particles;
+		rawBytes += rhs.rawBytes;
+		compressedBytes += rhs.compressedBytes;
+		bufferRefills += rhs.bufferRefills;
+		ioSeconds += rhs.ioSeconds;
+		zlibSeconds += rhs.zlibSeconds;
+		convertSeconds += rhs.convertSeconds;
+		return *this;
+	}
+
+	/**
+	 * @return The uncompressed size over the compressed size, or 0 if nothing has been compressed.
+	 */
+	double compression_ratio() const {
+		return compressedBytes > 0 ? static_cast<double>( rawBytes ) / static_cast<double>( compressedBytes ) : 0.0;
+	}
+};
+
+namespace detail{
+
+	/**
+	 * Adds the time between its construction and destruction to a timer in prt_stats. With a NULL timer it does nothing,
+	 * not even read the clock, which is how timing is disabled.
+	 */
+	class stats_timer{
+		double* m_dest;
+		std::chrono::steady_clock::time_point m_start;
+
+	public:
+		explicit stats_timer( double* dest ) : m_dest( dest ) {
+			if( m_dest )
+				m_start = std::chrono::steady_clock::now();
+		}
+
+		~stats_timer(){
+			if( m_dest )
+				*m_dest += std::chrono::duration<double>( std::chrono::steady_clock::now() - m_start ).count();
+		}
+	};
+
+}//namespace detail
+
+}//namespace prtio
@@ -0,0 +1,221 @@
+/**
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This file contains the definition of a class that records timed spans of work as Chrome trace events.
+ */
+
+#pragma once
+
+#include <prtio/prt_stats.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace prtio{
+
+/**
+ * This class records spans of work, such as reading a file or creating points, and writes them in the Chrome
+ * trace event format. Open the file in chrome://tracing or https://ui.perfetto.dev to see each thread's spans on a
+ * timeline. Spans may be recorded from any number of threads at once.
+ *
+ * Spans are recorded with the span class, which times its own lifetime. A span given a NULL trace does nothing, so
+ * code can be instrumented unconditionally and cost nothing unless a trace was asked for.
+ *
+ * Usage:
+ *   prt_trace trace;
+ *   {
+ *     prt_trace::span s( &trace, "load" );
+ *     ...
+ *     s.add_stats( stream.get_stats() );
+ *   }
+ *   trace.save( "trace.json" );
+ */
+class prt_trace{
+	struct event{
+		std::string name, category, args;
+		double start, duration; //In microseconds since the trace was created.
+		unsigned thread;
+	};
+
+	typedef std::chrono::steady_clock clock;
+
+	clock::time_point m_origin;
+	std::vector<event> m_events;
+	std::map<std::thread::id, unsigned> m_threads; //Small numbers for the threads, in the order they were first seen.
+	mutable std::mutex m_mutex;
+
+	static void write_string( std::ostream& os, const std::string& s ){
+		os << '"';
+		for( std::string::const_iterator it = s.begin(), itEnd = s.end(); it != itEnd; ++it ){
+			if( *it == '"' || *it == '\\' )
+				os << '\\' << *it;
+			else if( static_cast<unsigned char>( *it ) < 0x20 )
+				os << ' ';
+			else
+				os << *it;
+		}
+		os << '"';
+	}
+
+	void add( const std::string& name, const std::string& category, const std::string& args, clock::time_point start, clock::time_point end ){
+		event e;
+		e.name = name;
+		e.category = category;
+		e.args = args;
+		e.start = std::chrono::duration<double, std::micro>( start - m_origin ).count();
+		e.duration = std::chrono::duration<double, std::micro>( end - start ).count();
+
+		std::lock_guard<std::mutex> lock( m_mutex );
+		std::map<std::thread::id, unsigned>::iterator it = m_threads.find( std::this_thread::get_id() );
+		if( it == m_threads.end() )
+			it = m_threads.insert( std::make_pair( std::this_thread::get_id(), static_cast<unsigned>( m_threads.size() ) + 1 ) ).first;
+		e.thread = it->second;
+
+		m_events.push_back( e );
+	}
+
+public:
+	/**
+	 * This class records a span of work from its construction to its destruction. Spans nest, so a span made while
+	 * another is alive on the same thread shows up inside it.
+	 */
+	class span{
+		prt_trace* m_trace;
+		std::string m_name, m_category;
+		std::ostringstream m_args;
+		clock::time_point m_start;
+
+		span( const span& );
+		span& operator=( const span& );
+
+	public:
+		/**
+		 * @param trace The trace to record to, or NULL to record nothing.
+		 * @param name The name shown for the span.
+		 * @param category The category of the span, which the viewers can filter by.
+		 */
+		span( prt_trace* trace, const std::string& name, const std::string& category = "prtio" ) : m_trace( trace ) {
+			if( m_trace ){
+				m_name = name;
+				m_category = category;
+				m_start = clock::now();
+				m_args.precision( std::numeric_limits<double>::max_digits10 ); //Enough digits to read back exactly.
+			}
+		}
+
+		~span(){
+			if( m_trace )
+				m_trace->add( m_name, m_category, m_args.str(), m_start, clock::now() );
+		}
+
+		/**
+		 * Attaches a value to the span, which the viewers show when the span is selected. JSON has no infinity or NaN,
+		 * so those are written as null.
+		 */
+		void add_arg( const std::string& name, double value ){
+			if( !m_trace )
+				return;
+			if( m_args.tellp() > 0 )
+				m_args << ", ";
+			write_string( m_args, name );
+			m_args << ": ";
+			if( value == value && std::fabs( value ) <= std::numeric_limits<double>::max() )
+				m_args << value;
+			else
+				m_args << "null";
+		}
+
+		/**
+		 * Attaches a count to the span, written exactly.
+		 * @overload
+		 */
+		void add_arg( const std::string& name, data_types::int64_t value ){
+			if( !m_trace )
+				return;
+			if( m_args.tellp() > 0 )
+				m_args << ", ";
+			write_string( m_args, name );
+			m_args << ": " << value;
+		}
+
+		/**
+		 * Attaches a stream's counters and timers to the span.
+		 */
+		void add_stats( const prt_stats& stats ){
+			if( !m_trace )
+				return;
+			add_arg( "particles", stats.particles );
+			add_arg( "raw_bytes", stats.rawBytes );
+			add_arg( "compressed_bytes", stats.compressedBytes );
+			add_arg( "buffer_refills", stats.bufferRefills );
+			add_arg( "io_seconds", stats.ioSeconds );
+			add_arg( "zlib_seconds", stats.zlibSeconds );
+			add_arg( "convert_seconds", stats.convertSeconds );
+		}
+	};
+
+	prt_trace() : m_origin( clock::now() )
+	{}
+
+	/**
+	 * @return The number of spans recorded so far.
+	 */
+	std::size_t size() const {
+		std::lock_guard<std::mutex> lock( m_mutex );
+		return m_events.size();
+	}
+
+	/**
+	 * Writes the spans as a JSON trace event file.
+	 */
+	void write( std::ostream& os ) const {
+		std::lock_guard<std::mutex> lock( m_mutex );
+
+		os << "{\"traceEvents\": [";
+		for( std::vector<event>::const_iterator it = m_events.begin(), itEnd = m_events.end(); it != itEnd; ++it ){
+			os << ( it == m_events.begin() ? "\n" : ",\n" ) << "{\"name\": ";
+			write_string( os, it->name );
+			os << ", \"cat\": ";
+			write_string( os, it->category );
+			os << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << it->thread;
+			os << ", \"ts\": " << std::fixed << it->start << ", \"dur\": " << it->duration;
+			os.unsetf( std::ios::floatfield );
+			if( !it->args.empty() )
+				os << ", \"args\": {" << it->args << "}";
+			os << "}";
+		}
+		os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+	}
+
+	/**
+	 * Writes the spans to a JSON trace event file.
+	 */
+	void save( const std::string& file ) const {
+		std::ofstream fout( file.c_str() );
+		write( fout );
+		fout.close();
+		if( fout.fail() )
+			throw std::ios_base::failure( "Failed to write the trace \"" + file + "\"" );
+	}
+};
+
+}//namespace prtio